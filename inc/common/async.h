@@ -18,23 +18,40 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
-#if USE_CLIENT
+// Async work is executed on a pool of worker threads. Work callbacks must not
+// touch engine state that isn't thread safe (cvars, console). Zone allocator
+// is thread safe.
+// Done callbacks are always called on the main thread from
+// Com_CompleteAsyncWork(), in the order work has finished.
+
+typedef enum {
+    ASYNC_PRIO_LOW = -1,
+    ASYNC_PRIO_NORMAL,
+    ASYNC_PRIO_HIGH,
+} asyncprio_t;
+
+// 0 is never a valid handle
+typedef unsigned asynchandle_t;
 
 typedef struct asyncwork_s {
     void (*work_cb)(void *);
     void (*done_cb)(void *);
     void *cb_arg;
+    asyncprio_t prio;
+    asynchandle_t depends;      // don't start until this work has finished
+    asynchandle_t handle;       // set internally
     struct asyncwork_s *next;
 } asyncwork_t;
 
-void Com_QueueAsyncWork(asyncwork_t *work);
+asynchandle_t Com_QueueAsyncWork(asyncwork_t *work);
+bool Com_AsyncWorkPending(asynchandle_t handle);
+void Com_WaitAsyncWork(asynchandle_t handle);
 void Com_CompleteAsyncWork(void);
 void Com_ShutdownAsyncWork(void);
 
-#else
-
-#define Com_QueueAsyncWork(work)    (void)0
-#define Com_CompleteAsyncWork()     (void)0
-#define Com_ShutdownAsyncWork()     (void)0
+// Calls func(arg, i) for i in [0, count) split across worker threads and the
+// calling thread, and returns when all calls have finished. Must be called
+// from the main thread.
+void Com_ParallelFor(void (*func)(void *, int), void *arg, int count);
 
-#endif
+int Com_AsyncWorkerCount(void);
@@ -157,11 +157,17 @@ typedef struct {
     mtexinfo_t          *texinfo;
 } mbrushside_t;
 
+// brush side planes are also stored as structure of arrays in groups of
+// BRUSH_SIDE_GROUP sides: normal[0], normal[1], normal[2] and dist
+#define BRUSH_SIDE_GROUP    4
+#define BRUSH_SIDE_FLOATS   (BRUSH_SIDE_GROUP * 4)
+
 typedef struct {
     int                 contents;
     int                 numsides;
     mbrushside_t        *firstbrushside;
     unsigned            checkcount;         // to avoid repeated testings
+    float               *sideplanes;        // SoA copy of side planes
 } mbrush_t;
 
 typedef struct {
@@ -251,6 +257,7 @@ typedef struct bsp_s {
 
     int             numbrushes;
     mbrush_t        *brushes;
+    float           *brushplanes;       // sideplanes of all brushes
 
     int             numvisibility;
     int             visrowsize;
@@ -296,6 +303,9 @@ typedef struct bsp_s {
 
 	byte            *pvs_matrix;
 	byte            *pvs2_matrix;
+	size_t          pvs_stride;         // matrix row size, visrowsize rounded up to 64 bits
+	void            *pvs_cache;         // mapped PVS cache file the matrices may point into
+	size_t          pvs_cache_size;
 	bool            pvs_patched;
 
     bool            extended;
@@ -332,6 +342,7 @@ mmodel_t *BSP_InlineModel(bsp_t *bsp, const char *name);
 byte* BSP_GetPvs(bsp_t *bsp, int cluster);
 byte* BSP_GetPvs2(bsp_t *bsp, int cluster);
 
+bool BSP_SavePvsCache(bsp_t *bsp);
 bool BSP_SavePatchedPVS(bsp_t *bsp);
 
 void BSP_Init(void);
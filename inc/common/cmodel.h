@@ -79,6 +79,7 @@ byte        *CM_FatPVS(cm_t *cm, byte *mask, const vec3_t org, int vis);
 
 void        CM_SetAreaPortalState(cm_t *cm, int portalnum, bool open);
 bool        CM_AreasConnected(cm_t *cm, int area1, int area2);
+int         CM_AreaFloodnum(cm_t *cm, int area);
 
 int         CM_WriteAreaBits(cm_t *cm, byte *buffer, int area);
 int         CM_WritePortalBits(cm_t *cm, byte *buffer);
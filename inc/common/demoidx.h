@@ -0,0 +1,42 @@
+/*
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "common/zone.h"
+
+// Fake demo packet that reconstructs delta compression state, configstrings
+// and layouts at the given frame. Snapshots are sorted by frame number.
+typedef struct {
+    int         framenum;
+    int64_t     filepos;
+    size_t      msglen;
+    byte        data[1];
+} demosnap_t;
+
+// Demo snapshots are saved to a seek index file next to the demo, so that
+// seeking in a demo that has been played before doesn't need to parse it
+// up to the destination again. Index is only valid for the demo file of the
+// same size and modification time. Each gamestate in the demo has its own
+// segment of snapshots, identified by file position of its first snapshot.
+
+// returns number of snapshots loaded, 0 if index is missing or stale
+int Com_LoadDemoIndex(const char *demopath, int64_t segment,
+                      demosnap_t ***snapshots, memtag_t tag);
+
+// replaces given segment of index, keeping other segments
+void Com_SaveDemoIndex(const char *demopath, int64_t segment,
+                       demosnap_t **snapshots, int numsnapshots);
@@ -42,7 +42,6 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define FS_LoadFile(path, buf)  FS_LoadFileEx(path, buf, 0, TAG_FILESYSTEM)
 #define FS_LoadFileFlags(path, buf, flags)  \
                                 FS_LoadFileEx(path, buf, (flags), TAG_FILESYSTEM)
-#define FS_FreeFile(buf)        Z_Free(buf)
 
 // just regular malloc for now
 #define FS_AllocTempMem(size)   FS_Malloc(size)
@@ -82,6 +81,9 @@ int FS_LoadFileEx(const char *path, void **buffer, unsigned flags, memtag_t tag)
 // a NULL buffer will just return the file length without loading
 // length < 0 indicates error
 
+void FS_FreeFile(void *buf);
+// buffers loaded with FS_FLAG_MAPPED must be freed with this
+
 int FS_WriteFile(const char *path, const void *data, size_t len);
 
 bool FS_EasyWriteFile(char *buf, size_t size, unsigned mode,
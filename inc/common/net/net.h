@@ -195,6 +195,12 @@ bool        NET_GetAddress(netsrc_t sock, netadr_t *adr);
 void        NET_GetPackets(netsrc_t sock, void (*packet_cb)(void));
 bool        NET_SendPacket(netsrc_t sock, const void *data,
                            size_t len, const netadr_t *to);
+void        NET_BeginSendBatch(void);
+void        NET_FlushSendBatch(void);
+#if USE_CLIENT
+byte        *NET_BeginLoopPacket(netsrc_t sock, size_t len);
+void        NET_EndLoopPacket(netsrc_t sock, size_t len, const netadr_t *to);
+#endif
 
 char        *NET_AdrToString(const netadr_t *a);
 bool        NET_StringToAdr(const char *s, netadr_t *a, int default_port);
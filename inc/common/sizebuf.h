@@ -26,7 +26,7 @@ typedef struct {
     size_t      maxsize;
     size_t      cursize;
     size_t      readcount;
-    uint32_t    bits_buf;
+    uint64_t    bits_buf;
     uint32_t    bits_left;
     const char  *tag;           // for debugging
 } sizebuf_t;
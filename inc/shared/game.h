@@ -277,7 +277,7 @@ typedef game_export_t *(*game_entry_t)(game_import_t *);
  * game_export_ex_t structures, provided GAME_API_VERSION_EX is also bumped.
  */
 
-#define GAME_API_VERSION_EX     1
+#define GAME_API_VERSION_EX     3
 
 typedef struct {
     int     apiversion;
@@ -298,6 +298,15 @@ typedef struct {
 
     const char *(*ErrorString)(int error);
     void    *(*TagRealloc)(void *ptr, size_t size);
+
+    // version 2: traces count moves sharing mins/maxs, passent and
+    // contentmask, gathering entities only once for the whole batch
+    void    (*TraceBatch)(trace_t *traces, const vec3_t *starts, const vec3_t *ends, int count,
+                          const vec3_t mins, const vec3_t maxs, edict_t *passent, int contentmask);
+
+    // version 3: solid and trigger edicts that may be within radius,
+    // sorted by edict number
+    int     (*RadiusEdicts)(const vec3_t origin, float radius, edict_t **list, int maxcount);
 } game_import_ex_t;
 
 typedef struct {
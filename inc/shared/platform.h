@@ -122,6 +122,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #define q_unused            __attribute__((unused))
 
+// x must be non-zero
+#define q_ctz64(x)          __builtin_ctzll(x)
+
 #else /* __GNUC__ */
 
 #define q_printf(f, a)
@@ -149,4 +152,25 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #define q_unused
 
+#if defined(_MSC_VER) && defined(_WIN64)
+#include <intrin.h>
+#endif
+
+// x must be non-zero
+static inline int q_ctz64(uint64_t x)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return i;
+#else
+    int i = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
 #endif /* !__GNUC__ */
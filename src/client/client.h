@@ -28,6 +28,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/cmodel.h"
 #include "common/common.h"
 #include "common/cvar.h"
+#include "common/demoidx.h"
 #include "common/field.h"
 #include "common/files.h"
 #include "common/math.h"
@@ -393,13 +394,6 @@ typedef struct {
     char        path[1];
 } dlqueue_t;
 
-typedef struct {
-    int         framenum;
-    int64_t     filepos;
-    size_t      msglen;
-    byte        data[1];
-} demosnap_t;
-
 typedef struct client_static_s {
     connstate_t state;
     keydest_t   key_dest;
@@ -498,6 +492,9 @@ typedef struct client_static_s {
         sizebuf_t   buffer;
         demosnap_t  **snapshots;
         int         numsnapshots;
+        int         numindexed;         // number of snapshots loaded from seek index
+        int64_t     index_segment;      // file position of the first snapshot after gamestate
+        char        path[MAX_OSPATH];   // demo file path for seek index
         bool        paused;
         bool        seeking;
         bool        eof;
@@ -860,8 +857,6 @@ void CL_Trace(trace_t *tr, const vec3_t start, const vec3_t mins, const vec3_t m
 #define INSTANT_PARTICLE    -10000.0f
 
 typedef struct cparticle_s {
-    struct cparticle_s    *next;
-
     float   time;
 
     vec3_t  org;
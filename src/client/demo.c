@@ -28,6 +28,7 @@ static cvar_t   *cl_demosnaps;
 static cvar_t   *cl_demomsglen;
 static cvar_t   *cl_demowait;
 static cvar_t   *cl_demosuspendtoggle;
+static cvar_t   *cl_demoindex;
 
 // =========================================================================
 
@@ -744,6 +745,7 @@ static void CL_PlayDemo_f(void)
     CL_Disconnect(ERR_RECONNECT);
 
     cls.demo.playback = f;
+    Q_strlcpy(cls.demo.path, name, sizeof(cls.demo.path));
     cls.state = ca_connected;
     Q_strlcpy(cls.servername, COM_SkipPath(name), sizeof(cls.servername));
     cls.serverAddress.type = NA_LOOPBACK;
@@ -771,6 +773,35 @@ static void CL_Demo_c(genctx_t *ctx, int argnum)
 #define MIN_SNAPSHOTS   64
 #define MAX_SNAPSHOTS   250000000
 
+// loads snapshots of the current gamestate from seek index, if any
+static bool load_demo_index(int64_t pos)
+{
+    demosnap_t **snapshots;
+    int i, num;
+
+    cls.demo.index_segment = pos;
+    if (!cl_demoindex->integer || !*cls.demo.path)
+        return false;
+
+    num = Com_LoadDemoIndex(cls.demo.path, pos, &snapshots, TAG_GENERAL);
+    if (!num)
+        return false;
+
+    // initial snapshot must be the one we are about to emit
+    if (snapshots[0]->framenum != cls.demo.frames_read || snapshots[0]->filepos != pos) {
+        Com_DPrintf("Ignoring mismatched seek index for %s\n", cls.demo.path);
+        for (i = 0; i < num; i++)
+            Z_Free(snapshots[i]);
+        Z_Free(snapshots);
+        return false;
+    }
+
+    cls.demo.snapshots = snapshots;
+    cls.demo.numsnapshots = cls.demo.numindexed = num;
+    cls.demo.last_snapshot = snapshots[num - 1]->framenum;
+    return true;
+}
+
 /*
 ====================
 CL_EmitDemoSnapshot
@@ -807,6 +838,9 @@ void CL_EmitDemoSnapshot(void)
     if (pos < cls.demo.file_offset)
         return;
 
+    if (!cls.demo.numsnapshots && load_demo_index(pos))
+        return;
+
     // write all the backups, since we can't predict what frame the next
     // delta will come from
     lastframe = NULL;
@@ -929,6 +963,11 @@ CL_FreeDemoSnapshots
 */
 void CL_FreeDemoSnapshots(void)
 {
+    if (cls.demo.numsnapshots > cls.demo.numindexed && cl_demoindex->integer && *cls.demo.path)
+        Com_SaveDemoIndex(cls.demo.path, cls.demo.index_segment,
+                          cls.demo.snapshots, cls.demo.numsnapshots);
+    cls.demo.numindexed = 0;
+
     for (int i = 0; i < cls.demo.numsnapshots; i++)
         Z_Free(cls.demo.snapshots[i]);
     cls.demo.numsnapshots = 0;
@@ -1347,6 +1386,7 @@ void CL_InitDemos(void)
     cl_demomsglen = Cvar_Get("cl_demomsglen", va("%d", MAX_PACKETLEN_WRITABLE_DEFAULT), 0);
     cl_demowait = Cvar_Get("cl_demowait", "0", 0);
     cl_demosuspendtoggle = Cvar_Get("cl_demosuspendtoggle", "1", 0);
+    cl_demoindex = Cvar_Get("cl_demoindex", "1", 0);
 
     Cmd_Register(c_demo);
 }
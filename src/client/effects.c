@@ -19,8 +19,19 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // cl_fx.c -- entity effects parsing and management
 
 #include "client.h"
+#include "common/async.h"
 #include "shared/m_flash.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_PARTICLE_SIMD   1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define USE_PARTICLE_SIMD   1
+#else
+#define USE_PARTICLE_SIMD   0
+#endif
+
 static void CL_LogoutEffect(const vec3_t org, int type);
 
 static vec3_t avelocities[NUMVERTEXNORMALS];
@@ -830,12 +841,36 @@ void CL_MuzzleFlash2(void)
 
 PARTICLE MANAGEMENT
 
+Live particles are kept packed in a structure of arrays. Effects fill in
+particles returned by CL_AllocParticle, which are appended to the store by
+the next CL_AddParticles. CL_AddParticles streams through the store, emits
+visible particles to the renderer and compacts the store in place, dropping
+faded particles without chasing any pointers.
+
 ==============================================================
 */
 
-static cparticle_t  *active_particles, *free_particles;
+// arrays are padded so that they don't all map to the same cache sets
+#define PARTICLE_STRIDE (MAX_PARTICLES + 16)
 
+typedef struct {
+    int     count;
+    float   time[PARTICLE_STRIDE];
+    float   org[3][PARTICLE_STRIDE];
+    float   vel[3][PARTICLE_STRIDE];
+    float   accel[3][PARTICLE_STRIDE];
+    float   alpha[PARTICLE_STRIDE];
+    float   alphavel[PARTICLE_STRIDE];
+    int     color[PARTICLE_STRIDE];
+    color_t rgba[PARTICLE_STRIDE];
+    float   brightness[PARTICLE_STRIDE];
+} particle_store_t;
+
+static particle_store_t pstore;
+
+// particles spawned since last CL_AddParticles
 static cparticle_t  particles[MAX_PARTICLES];
+static int          num_particles;
 
 extern uint32_t d_8to24table[256];
 
@@ -850,28 +885,16 @@ void FX_Init(void)
 
 static void CL_ClearParticles(void)
 {
-    int     i;
-
-    free_particles = &particles[0];
-    active_particles = NULL;
-
-    for (i = 0; i < MAX_PARTICLES - 1; i++)
-        particles[i].next = &particles[i + 1];
-    particles[i].next = NULL;
+    pstore.count = 0;
+    num_particles = 0;
 }
 
 cparticle_t *CL_AllocParticle(void)
 {
-    cparticle_t *p;
-
-    if (!free_particles)
+    if (pstore.count + num_particles >= MAX_PARTICLES)
         return NULL;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
 
-    return p;
+    return &particles[num_particles++];
 }
 
 /*
@@ -1917,76 +1940,312 @@ void CL_TeleportParticles(const vec3_t org)
 extern int          r_numparticles;
 extern particle_t   r_particles[MAX_PARTICLES];
 
+// particles are updated in batches, split across worker threads if there
+// is more than one batch
+#define PARTICLE_BATCH  2048
+
+typedef struct {
+    particle_store_t    *s;
+    particle_t          *parts;     // renderer particles
+    int                 room;       // number of free renderer particles
+    float               now;
+    int                 counts[MAX_PARTICLES / PARTICLE_BATCH];
+    int                 offsets[MAX_PARTICLES / PARTICLE_BATCH];
+} particle_update_t;
+
+static void CL_AppendParticles(particle_store_t *s)
+{
+    cparticle_t *p;
+    int i, j, n;
+
+    for (i = 0, p = particles; i < num_particles; i++, p++) {
+        n = s->count++;
+        s->time[n] = p->time;
+        for (j = 0; j < 3; j++) {
+            s->org[j][n] = p->org[j];
+            s->vel[j][n] = p->vel[j];
+            s->accel[j][n] = p->accel[j];
+        }
+        s->alpha[n] = p->alpha;
+        s->alphavel[n] = p->alphavel;
+        s->color[n] = p->color;
+        s->rgba[n] = p->rgba;
+        s->brightness[n] = p->brightness;
+    }
+
+    num_particles = 0;
+}
+
 /*
-===============
-CL_AddParticles
-===============
+Evaluates 4 particles starting at index i. Returns mask of particles that
+are still visible, and their time and alpha. Arrays are sized in multiples of
+4, lanes past the end of the store are evaluated, but never used.
 */
-void CL_AddParticles(void)
+#if USE_PARTICLE_SIMD
+
+#if defined(__aarch64__)
+
+typedef float32x4_t     simd4f_t;
+
+#define simd_load(p)        vld1q_f32(p)
+#define simd_store(p, v)    vst1q_f32(p, v)
+#define simd_splat(x)       vdupq_n_f32(x)
+#define simd_add(a, b)      vaddq_f32(a, b)
+#define simd_sub(a, b)      vsubq_f32(a, b)
+#define simd_mul(a, b)      vmulq_f32(a, b)
+#define simd_gt(a, b)       vreinterpretq_f32_u32(vcgtq_f32(a, b))
+#define simd_eq(a, b)       vreinterpretq_f32_u32(vceqq_f32(a, b))
+#define simd_or(a, b)       vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b)))
+#define simd_select(m, a, b) vbslq_f32(vreinterpretq_u32_f32(m), a, b)
+
+static inline int simd_mask(simd4f_t m)
 {
-    cparticle_t     *p, *next;
-    float           alpha;
-    float           time = 0, time2;
-    int             color;
-    cparticle_t     *active, *tail;
-    particle_t      *part;
-
-    active = NULL;
-    tail = NULL;
-
-    for (p = active_particles; p; p = next) {
-        next = p->next;
-
-        if (p->alphavel != INSTANT_PARTICLE) {
-            time = (cl.time - p->time) * 0.001f;
-            alpha = p->alpha + time * p->alphavel;
-            if (alpha <= 0) {
-                // faded out
-                p->next = free_particles;
-                free_particles = p;
-                continue;
-            }
+    static const int32_t shifts[4] = { 0, 1, 2, 3 };
+    uint32x4_t bits = vshrq_n_u32(vreinterpretq_u32_f32(m), 31);
+    return vaddvq_u32(vshlq_u32(bits, vld1q_s32(shifts)));
+}
+
+#else
+
+typedef __m128          simd4f_t;
+
+#define simd_load(p)        _mm_loadu_ps(p)
+#define simd_store(p, v)    _mm_storeu_ps(p, v)
+#define simd_splat(x)       _mm_set1_ps(x)
+#define simd_add(a, b)      _mm_add_ps(a, b)
+#define simd_sub(a, b)      _mm_sub_ps(a, b)
+#define simd_mul(a, b)      _mm_mul_ps(a, b)
+#define simd_gt(a, b)       _mm_cmpgt_ps(a, b)
+#define simd_eq(a, b)       _mm_cmpeq_ps(a, b)
+#define simd_or(a, b)       _mm_or_ps(a, b)
+#define simd_select(m, a, b) _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+#define simd_mask(m)        _mm_movemask_ps(m)
+
+#endif
+
+static inline int CL_EvalParticles(const particle_store_t *s, int i, float now,
+                                   float time[4], float alpha[4])
+{
+    simd4f_t t = simd_mul(simd_sub(simd_splat(now), simd_load(&s->time[i])), simd_splat(0.001f));
+    simd4f_t av = simd_load(&s->alphavel[i]);
+    simd4f_t a = simd_load(&s->alpha[i]);
+    simd4f_t instant = simd_eq(av, simd_splat(INSTANT_PARTICLE));
+
+    a = simd_select(instant, a, simd_add(a, simd_mul(t, av)));
+    simd_store(time, t);
+    simd_store(alpha, a);
+
+    return simd_mask(simd_or(instant, simd_gt(a, simd_splat(0))));
+}
+
+// org + vel * time + accel * time * time
+static inline void CL_ParticleOrigins(const particle_store_t *s, int i,
+                                      const float time[4], float org[3][4])
+{
+    simd4f_t t = simd_load(time);
+    simd4f_t t2 = simd_mul(t, t);
+
+    for (int j = 0; j < 3; j++) {
+        simd4f_t o = simd_add(simd_load(&s->org[j][i]), simd_mul(simd_load(&s->vel[j][i]), t));
+        simd_store(org[j], simd_add(o, simd_mul(simd_load(&s->accel[j][i]), t2)));
+    }
+}
+
+#else
+
+static inline int CL_EvalParticles(const particle_store_t *s, int i, float now,
+                                   float time[4], float alpha[4])
+{
+    int k, mask = 0;
+
+    for (k = 0; k < 4; k++) {
+        time[k] = (now - s->time[i + k]) * 0.001f;
+        if (s->alphavel[i + k] == INSTANT_PARTICLE) {
+            alpha[k] = s->alpha[i + k];
+            mask |= 1 << k;
         } else {
-            alpha = p->alpha;
+            alpha[k] = s->alpha[i + k] + time[k] * s->alphavel[i + k];
+            if (alpha[k] > 0)
+                mask |= 1 << k;
         }
+    }
 
-        if (r_numparticles >= MAX_PARTICLES)
-            break;
-        part = &r_particles[r_numparticles++];
-
-        p->next = NULL;
-        if (!tail)
-            active = tail = p;
-        else {
-            tail->next = p;
-            tail = p;
-        }
+    return mask;
+}
+
+// org + vel * time + accel * time * time
+static inline void CL_ParticleOrigins(const particle_store_t *s, int i,
+                                      const float time[4], float org[3][4])
+{
+    for (int k = 0; k < 4; k++) {
+        float time2 = time[k] * time[k];
+        for (int j = 0; j < 3; j++)
+            org[j][k] = s->org[j][i + k] + s->vel[j][i + k] * time[k] + s->accel[j][i + k] * time2;
+    }
+}
+
+#endif
 
-        if (alpha > 1.0f)
-            alpha = 1;
-        color = p->color;
+static inline int CL_ParticleBatchMask(int i, int end)
+{
+    return end - i >= 4 ? 15 : (1 << (end - i)) - 1;
+}
 
-        time2 = time * time;
+static const byte particle_mask_count[16] = {
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+};
 
-        part->origin[0] = p->org[0] + p->vel[0] * time + p->accel[0] * time2;
-        part->origin[1] = p->org[1] + p->vel[1] * time + p->accel[1] * time2;
-        part->origin[2] = p->org[2] + p->vel[2] * time + p->accel[2] * time2;
+// counts visible particles in batch
+static void CL_CountParticles(void *arg, int batch)
+{
+    particle_update_t *u = arg;
+    int start = batch * PARTICLE_BATCH;
+    int end = min(start + PARTICLE_BATCH, u->s->count);
+    float time[4], alpha[4];
+    int i, count = 0;
+
+    for (i = start; i < end; i += 4) {
+        int mask = CL_EvalParticles(u->s, i, u->now, time, alpha);
+        count += particle_mask_count[mask & CL_ParticleBatchMask(i, end)];
+    }
 
-        part->rgba = p->rgba;
-        part->color = color;
-		part->brightness = p->brightness;
-        part->alpha = alpha;
-		part->radius = 0.f;
+    u->counts[batch] = count;
+}
+
+static void CL_MoveParticle(particle_store_t *s, int to, int from)
+{
+    s->time[to] = s->time[from];
+    for (int j = 0; j < 3; j++) {
+        s->org[j][to] = s->org[j][from];
+        s->vel[j][to] = s->vel[j][from];
+        s->accel[j][to] = s->accel[j][from];
+    }
+    s->alpha[to] = s->alpha[from];
+    s->alphavel[to] = s->alphavel[from];
+    s->color[to] = s->color[from];
+    s->rgba[to] = s->rgba[from];
+    s->brightness[to] = s->brightness[from];
+}
+
+// emits visible particles in batch to the renderer and packs them at the
+// start of the batch
+static void CL_UpdateParticles(void *arg, int batch)
+{
+    particle_update_t *u = arg;
+    particle_store_t *s = u->s;
+    int start = batch * PARTICLE_BATCH;
+    int end = min(start + PARTICLE_BATCH, s->count);
+    int n = start;
+    int ofs = u->offsets[batch] - start;
+    float time[4], alpha[4], org[3][4];
+    int i, k, mask;
+
+    for (i = start; i < end; i += 4) {
+        mask = CL_EvalParticles(s, i, u->now, time, alpha);
+        mask &= CL_ParticleBatchMask(i, end);
+        if (!mask)
+            continue;
+
+        CL_ParticleOrigins(s, i, time, org);
+
+        for (k = 0; k < 4; k++) {
+            if (!(mask & (1 << k)))
+                continue;
+
+            if (n + ofs < u->room) {
+                particle_t *part = &u->parts[n + ofs];
+                part->origin[0] = org[0][k];
+                part->origin[1] = org[1][k];
+                part->origin[2] = org[2][k];
+                part->rgba = s->rgba[i + k];
+                part->color = s->color[i + k];
+                part->brightness = s->brightness[i + k];
+                part->alpha = min(alpha[k], 1.0f);
+                part->radius = 0.f;
+            }
+
+            if (n != i + k)
+                CL_MoveParticle(s, n, i + k);
+
+            // instant particles are drawn once
+            if (s->alphavel[n] == INSTANT_PARTICLE) {
+                s->alphavel[n] = 0.0f;
+                s->alpha[n] = 0.0f;
+            }
 
-        if (p->alphavel == INSTANT_PARTICLE) {
-            p->alphavel = 0.0f;
-            p->alpha = 0.0f;
+            n++;
         }
     }
 
-    active_particles = active;
+    u->counts[batch] = n - start;
 }
 
+#define MOVE_ARRAY(a) \
+    memmove(&(a)[to], &(a)[from], count * sizeof((a)[0]))
+
+static void CL_MoveParticles(particle_store_t *s, int to, int from, int count)
+{
+    MOVE_ARRAY(s->time);
+    for (int j = 0; j < 3; j++) {
+        MOVE_ARRAY(s->org[j]);
+        MOVE_ARRAY(s->vel[j]);
+        MOVE_ARRAY(s->accel[j]);
+    }
+    MOVE_ARRAY(s->alpha);
+    MOVE_ARRAY(s->alphavel);
+    MOVE_ARRAY(s->color);
+    MOVE_ARRAY(s->rgba);
+    MOVE_ARRAY(s->brightness);
+}
+
+#undef MOVE_ARRAY
+
+/*
+===============
+CL_AddParticles
+===============
+*/
+void CL_AddParticles(void)
+{
+    particle_update_t u;
+    int i, count, batches;
+
+    CL_AppendParticles(&pstore);
+
+    if (!pstore.count)
+        return;
+
+    u.s = &pstore;
+    u.parts = &r_particles[r_numparticles];
+    u.room = MAX_PARTICLES - r_numparticles;
+    u.now = cl.time;
+
+    batches = (pstore.count + PARTICLE_BATCH - 1) / PARTICLE_BATCH;
+
+    // count visible particles in each batch to find where they go in the
+    // renderer list
+    if (batches > 1) {
+        Com_ParallelFor(CL_CountParticles, &u, batches);
+        for (i = count = 0; i < batches; i++) {
+            u.offsets[i] = count;
+            count += u.counts[i];
+        }
+    } else {
+        u.offsets[0] = 0;
+    }
+
+    Com_ParallelFor(CL_UpdateParticles, &u, batches);
+
+    // close the gaps between batches
+    for (i = count = 0; i < batches; i++) {
+        if (count != i * PARTICLE_BATCH && u.counts[i])
+            CL_MoveParticles(&pstore, count, i * PARTICLE_BATCH, u.counts[i]);
+        count += u.counts[i];
+    }
+
+    pstore.count = count;
+    r_numparticles += min(count, u.room);
+}
 
 /*
 ==============
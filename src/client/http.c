@@ -858,6 +858,8 @@ fail2:
             //rename the temp file
             Q_snprintf(temp, sizeof(temp), "%s/%s", fs_gamedir, dl->queue->path);
 
+            // also lets the filesystem index know about the new file
+            FS_CreatePath(temp);
             if (rename(dl->path, temp))
                 Com_EPrintf("[HTTP] Failed to rename '%s' to '%s': %s\n",
                             dl->path, dl->queue->path, strerror(errno));
@@ -1135,11 +1135,12 @@ static void CL_ParseDownload(int cmd)
 static void CL_ParseZPacket(void)
 {
 #if USE_ZLIB
+    static byte buffer[MAX_MSGLEN];
     sizebuf_t   temp;
-    byte        buffer[MAX_MSGLEN];
     int         ret, inlen, outlen;
 
-    if (msg_read.data != msg_read_buffer) {
+    // loopback packets are parsed in place, so check the inflate buffer
+    if (msg_read.data == buffer) {
         Com_Error(ERR_DROP, "%s: recursively entered", __func__);
     }
 
@@ -20,6 +20,16 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "sound.h"
 #include "common/intreadwrite.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_MIX_SIMD    1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define USE_MIX_SIMD    1
+#else
+#define USE_MIX_SIMD    0
+#endif
+
 #define PAINTBUFFER_SIZE    2048
 
 #define MAX_RAW_SAMPLES     8192
@@ -169,6 +179,43 @@ PAINTBUFFER TRANSFER
 ===============================================================================
 */
 
+static void TransferSamples16(int16_t *out, const samplepair_t *samp, int count)
+{
+    for (int i = 0; i < count; i++, samp++, out += 2) {
+        out[0] = Q_clip_int16(samp->left);
+        out[1] = Q_clip_int16(samp->right);
+    }
+}
+
+#if USE_MIX_SIMD
+
+// truncates and saturates exactly like TransferSamples16
+static void TransferSamples16_SIMD(int16_t *out, const samplepair_t *samp, int count)
+{
+    const float *in = &samp->left;
+    int i;
+
+    for (i = 0; i <= count - 4; i += 4, in += 8, out += 8) {
+#if defined(__aarch64__)
+        int32x4_t lo = vcvtq_s32_f32(vld1q_f32(in));
+        int32x4_t hi = vcvtq_s32_f32(vld1q_f32(in + 4));
+        vst1q_s16(out, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+#else
+        __m128i lo = _mm_cvttps_epi32(_mm_loadu_ps(in));
+        __m128i hi = _mm_cvttps_epi32(_mm_loadu_ps(in + 4));
+        _mm_storeu_si128((__m128i *)out, _mm_packs_epi32(lo, hi));
+#endif
+    }
+
+    TransferSamples16(out, samp + i, count - i);
+}
+
+#else
+
+#define TransferSamples16_SIMD  TransferSamples16
+
+#endif
+
 static void TransferStereo16(samplepair_t *samp, int endtime)
 {
     int ltime = s_paintedtime;
@@ -180,11 +227,8 @@ static void TransferStereo16(samplepair_t *samp, int endtime)
         int count = min(size - lpos, endtime - ltime);
 
         // write a linear blast of samples
-        int16_t *out = (int16_t *)dma.buffer + (lpos << 1);
-        for (int i = 0; i < count; i++, samp++, out += 2) {
-            out[0] = Q_clip_int16(samp->left);
-            out[1] = Q_clip_int16(samp->right);
-        }
+        TransferSamples16_SIMD((int16_t *)dma.buffer + (lpos << 1), samp, count);
+        samp += count;
 
         ltime += count;
     }
@@ -287,6 +331,55 @@ static void s_underwater_gain_hf_changed(cvar_t *self)
     a1 /= a0; a2 /= a0; b0 /= a0; b1 /= a0; b2 /= a0;
 }
 
+#if USE_MIX_SIMD
+
+// filters both channels at once, lane by lane in the same order as filter_ch
+static void underwater_filter(samplepair_t *samp, int count)
+{
+#if defined(__aarch64__)
+    float32x2_t z1 = { hist[0].z1, hist[1].z1 };
+    float32x2_t z2 = { hist[0].z2, hist[1].z2 };
+    float32x2_t vb0 = vdup_n_f32(b0), vb1 = vdup_n_f32(b1), vb2 = vdup_n_f32(b2);
+    float32x2_t va1 = vdup_n_f32(a1), va2 = vdup_n_f32(a2);
+
+    for (int i = 0; i < count; i++, samp++) {
+        float32x2_t input = vld1_f32(&samp->left);
+        float32x2_t output = vadd_f32(vmul_f32(input, vb0), z1);
+        z1 = vadd_f32(vsub_f32(vmul_f32(input, vb1), vmul_f32(output, va1)), z2);
+        z2 = vsub_f32(vmul_f32(input, vb2), vmul_f32(output, va2));
+        vst1_f32(&samp->left, output);
+    }
+
+    hist[0].z1 = vget_lane_f32(z1, 0);
+    hist[1].z1 = vget_lane_f32(z1, 1);
+    hist[0].z2 = vget_lane_f32(z2, 0);
+    hist[1].z2 = vget_lane_f32(z2, 1);
+#else
+    __m128 z1 = _mm_setr_ps(hist[0].z1, hist[1].z1, 0, 0);
+    __m128 z2 = _mm_setr_ps(hist[0].z2, hist[1].z2, 0, 0);
+    __m128 vb0 = _mm_set1_ps(b0), vb1 = _mm_set1_ps(b1), vb2 = _mm_set1_ps(b2);
+    __m128 va1 = _mm_set1_ps(a1), va2 = _mm_set1_ps(a2);
+    float tmp[4];
+
+    for (int i = 0; i < count; i++, samp++) {
+        __m128 input = _mm_castpd_ps(_mm_load_sd((const double *)samp));
+        __m128 output = _mm_add_ps(_mm_mul_ps(input, vb0), z1);
+        z1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(input, vb1), _mm_mul_ps(output, va1)), z2);
+        z2 = _mm_sub_ps(_mm_mul_ps(input, vb2), _mm_mul_ps(output, va2));
+        _mm_store_sd((double *)samp, _mm_castps_pd(output));
+    }
+
+    _mm_storeu_ps(tmp, z1);
+    hist[0].z1 = tmp[0];
+    hist[1].z1 = tmp[1];
+    _mm_storeu_ps(tmp, z2);
+    hist[0].z2 = tmp[0];
+    hist[1].z2 = tmp[1];
+#endif
+}
+
+#else
+
 static void filter_ch(hist_t *hist, float *samp, int count)
 {
     float z1 = hist->z1;
@@ -310,6 +403,8 @@ static void underwater_filter(samplepair_t *samp, int count)
     filter_ch(&hist[1], &samp->right, count);
 }
 
+#endif
+
 /*
 ===============================================================================
 
@@ -395,7 +490,7 @@ PAINTFUNC(PaintStereoFull16)
     }
 }
 
-static const paintfunc_t paintfuncs[] = {
+static const paintfunc_t paintfuncs_c[] = {
     PaintMono8,
     PaintStereoDmix8,
     PaintStereoFull8,
@@ -404,6 +499,350 @@ static const paintfunc_t paintfuncs[] = {
     PaintStereoFull16,
 };
 
+#if USE_MIX_SIMD
+
+/*
+Vectorized paint functions. Each iteration converts 4 source frames to float
+and accumulates them into 4 paint buffer sample pairs, using the same single
+precision operations as the scalar versions. Leftover frames are painted by
+the scalar version.
+*/
+
+#if defined(__aarch64__)
+
+typedef float32x4_t     mix4f_t;
+
+#define mix_load(p)         vld1q_f32(p)
+#define mix_store(p, v)     vst1q_f32(p, v)
+#define mix_splat(x)        vdupq_n_f32(x)
+#define mix_pair(l, r)      ((mix4f_t){ l, r, l, r })
+#define mix_add(a, b)       vaddq_f32(a, b)
+
+// out += in * vol
+static inline void mix_accum(float *out, mix4f_t in, mix4f_t vol)
+{
+    vst1q_f32(out, vaddq_f32(vld1q_f32(out), vmulq_f32(in, vol)));
+}
+
+// [s0 s1 s2 s3] -> [s0 s0 s1 s1] [s2 s2 s3 s3]
+static inline void mix_dup(mix4f_t v, mix4f_t *lo, mix4f_t *hi)
+{
+    float32x4x2_t z = vzipq_f32(v, v);
+    *lo = z.val[0];
+    *hi = z.val[1];
+}
+
+static inline mix4f_t mix_cvt(int32x4_t v)
+{
+    return vcvtq_f32_s32(v);
+}
+
+static inline int32x4_t mix_unsigned8(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    uint16x8_t w = vmovl_u8(vcreate_u8(v));
+    return vsubq_s32(vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(w))), vdupq_n_s32(128));
+}
+
+// 4 mono 8-bit frames
+static inline mix4f_t mix_mono8(const uint8_t *p)
+{
+    return mix_cvt(mix_unsigned8(p));
+}
+
+// 4 mono 16-bit frames
+static inline mix4f_t mix_mono16(const int16_t *p)
+{
+    return mix_cvt(vmovl_s16(vld1_s16(p)));
+}
+
+// 4 stereo 8-bit frames, left and right summed
+static inline mix4f_t mix_dmix8(const uint8_t *p)
+{
+    uint16x4_t sum = vpaddl_u8(vld1_u8(p));
+    return mix_cvt(vsubq_s32(vreinterpretq_s32_u32(vmovl_u16(sum)), vdupq_n_s32(256)));
+}
+
+// 4 stereo 16-bit frames, left and right summed
+static inline mix4f_t mix_dmix16(const int16_t *p)
+{
+    return mix_cvt(vpaddlq_s16(vld1q_s16(p)));
+}
+
+// 4 stereo 8-bit frames
+static inline void mix_stereo8(const uint8_t *p, mix4f_t *lo, mix4f_t *hi)
+{
+    *lo = mix_cvt(mix_unsigned8(p));
+    *hi = mix_cvt(mix_unsigned8(p + 4));
+}
+
+// 4 stereo 16-bit frames
+static inline void mix_stereo16(const int16_t *p, mix4f_t *lo, mix4f_t *hi)
+{
+    int16x8_t v = vld1q_s16(p);
+    *lo = mix_cvt(vmovl_s16(vget_low_s16(v)));
+    *hi = mix_cvt(vmovl_s16(vget_high_s16(v)));
+}
+
+#else
+
+typedef __m128          mix4f_t;
+
+#define mix_load(p)         _mm_loadu_ps(p)
+#define mix_store(p, v)     _mm_storeu_ps(p, v)
+#define mix_splat(x)        _mm_set1_ps(x)
+#define mix_pair(l, r)      _mm_setr_ps(l, r, l, r)
+#define mix_add(a, b)       _mm_add_ps(a, b)
+
+// out += in * vol
+static inline void mix_accum(float *out, mix4f_t in, mix4f_t vol)
+{
+    _mm_storeu_ps(out, _mm_add_ps(_mm_loadu_ps(out), _mm_mul_ps(in, vol)));
+}
+
+// [s0 s1 s2 s3] -> [s0 s0 s1 s1] [s2 s2 s3 s3]
+static inline void mix_dup(mix4f_t v, mix4f_t *lo, mix4f_t *hi)
+{
+    *lo = _mm_unpacklo_ps(v, v);
+    *hi = _mm_unpackhi_ps(v, v);
+}
+
+// sign extend low 4 words to dwords and convert
+static inline mix4f_t mix_cvtlo16(__m128i v)
+{
+    return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+}
+
+static inline mix4f_t mix_cvthi16(__m128i v)
+{
+    return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+}
+
+// 8 unsigned bytes to words, minus bias
+static inline __m128i mix_unsigned8(__m128i v)
+{
+    return _mm_sub_epi16(_mm_unpacklo_epi8(v, _mm_setzero_si128()), _mm_set1_epi16(128));
+}
+
+// 4 mono 8-bit frames
+static inline mix4f_t mix_mono8(const uint8_t *p)
+{
+    int32_t v;
+    memcpy(&v, p, sizeof(v));
+    return mix_cvtlo16(mix_unsigned8(_mm_cvtsi32_si128(v)));
+}
+
+// 4 mono 16-bit frames
+static inline mix4f_t mix_mono16(const int16_t *p)
+{
+    return mix_cvtlo16(_mm_loadl_epi64((const __m128i *)p));
+}
+
+// 4 stereo 8-bit frames, left and right summed
+static inline mix4f_t mix_dmix8(const uint8_t *p)
+{
+    __m128i v = mix_unsigned8(_mm_loadl_epi64((const __m128i *)p));
+    return _mm_cvtepi32_ps(_mm_madd_epi16(v, _mm_set1_epi16(1)));
+}
+
+// 4 stereo 16-bit frames, left and right summed
+static inline mix4f_t mix_dmix16(const int16_t *p)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    return _mm_cvtepi32_ps(_mm_madd_epi16(v, _mm_set1_epi16(1)));
+}
+
+// 4 stereo 8-bit frames
+static inline void mix_stereo8(const uint8_t *p, mix4f_t *lo, mix4f_t *hi)
+{
+    __m128i v = mix_unsigned8(_mm_loadl_epi64((const __m128i *)p));
+    *lo = mix_cvtlo16(v);
+    *hi = mix_cvthi16(v);
+}
+
+// 4 stereo 16-bit frames
+static inline void mix_stereo16(const int16_t *p, mix4f_t *lo, mix4f_t *hi)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    *lo = mix_cvtlo16(v);
+    *hi = mix_cvthi16(v);
+}
+
+#endif
+
+// paints remaining frames with scalar version
+static inline void PaintTail(paintfunc_t func, channel_t *ch, sfxcache_t *sc,
+                             int count, samplepair_t *samp, int i)
+{
+    if (i < count) {
+        channel_t tail = *ch;
+        tail.pos += i;
+        func(&tail, sc, count - i, samp + i);
+    }
+}
+
+PAINTFUNC(PaintMono8_SIMD)
+{
+    mix4f_t vol = mix_pair(ch->leftvol * snd_vol * 256, ch->rightvol * snd_vol * 256);
+    uint8_t *sfx = sc->data + ch->pos;
+    float *out = &samp->left;
+    mix4f_t lo, hi;
+    int i;
+
+    for (i = 0; i <= count - 4; i += 4, sfx += 4, out += 8) {
+        mix_dup(mix_mono8(sfx), &lo, &hi);
+        mix_accum(out, lo, vol);
+        mix_accum(out + 4, hi, vol);
+    }
+
+    PaintTail(PaintMono8, ch, sc, count, samp, i);
+}
+
+PAINTFUNC(PaintStereoDmix8_SIMD)
+{
+    mix4f_t vol = mix_pair(ch->leftvol * snd_vol * (256 * M_SQRT1_2),
+                           ch->rightvol * snd_vol * (256 * M_SQRT1_2));
+    uint8_t *sfx = sc->data + ch->pos * 2;
+    float *out = &samp->left;
+    mix4f_t lo, hi;
+    int i;
+
+    for (i = 0; i <= count - 4; i += 4, sfx += 8, out += 8) {
+        mix_dup(mix_dmix8(sfx), &lo, &hi);
+        mix_accum(out, lo, vol);
+        mix_accum(out + 4, hi, vol);
+    }
+
+    PaintTail(PaintStereoDmix8, ch, sc, count, samp, i);
+}
+
+PAINTFUNC(PaintStereoFull8_SIMD)
+{
+    mix4f_t vol = mix_splat(ch->leftvol * snd_vol * 256);
+    uint8_t *sfx = sc->data + ch->pos * 2;
+    float *out = &samp->left;
+    mix4f_t lo, hi;
+    int i;
+
+    for (i = 0; i <= count - 4; i += 4, sfx += 8, out += 8) {
+        mix_stereo8(sfx, &lo, &hi);
+        mix_accum(out, lo, vol);
+        mix_accum(out + 4, hi, vol);
+    }
+
+    PaintTail(PaintStereoFull8, ch, sc, count, samp, i);
+}
+
+PAINTFUNC(PaintMono16_SIMD)
+{
+    mix4f_t vol = mix_pair(ch->leftvol * snd_vol, ch->rightvol * snd_vol);
+    int16_t *sfx = (int16_t *)sc->data + ch->pos;
+    float *out = &samp->left;
+    mix4f_t lo, hi;
+    int i;
+
+    for (i = 0; i <= count - 4; i += 4, sfx += 4, out += 8) {
+        mix_dup(mix_mono16(sfx), &lo, &hi);
+        mix_accum(out, lo, vol);
+        mix_accum(out + 4, hi, vol);
+    }
+
+    PaintTail(PaintMono16, ch, sc, count, samp, i);
+}
+
+PAINTFUNC(PaintStereoDmix16_SIMD)
+{
+    mix4f_t vol = mix_pair(ch->leftvol * snd_vol * M_SQRT1_2,
+                           ch->rightvol * snd_vol * M_SQRT1_2);
+    int16_t *sfx = (int16_t *)sc->data + ch->pos * 2;
+    float *out = &samp->left;
+    mix4f_t lo, hi;
+    int i;
+
+    for (i = 0; i <= count - 4; i += 4, sfx += 8, out += 8) {
+        mix_dup(mix_dmix16(sfx), &lo, &hi);
+        mix_accum(out, lo, vol);
+        mix_accum(out + 4, hi, vol);
+    }
+
+    PaintTail(PaintStereoDmix16, ch, sc, count, samp, i);
+}
+
+PAINTFUNC(PaintStereoFull16_SIMD)
+{
+    mix4f_t vol = mix_splat(ch->leftvol * snd_vol);
+    int16_t *sfx = (int16_t *)sc->data + ch->pos * 2;
+    float *out = &samp->left;
+    mix4f_t lo, hi;
+    int i;
+
+    for (i = 0; i <= count - 4; i += 4, sfx += 8, out += 8) {
+        mix_stereo16(sfx, &lo, &hi);
+        mix_accum(out, lo, vol);
+        mix_accum(out + 4, hi, vol);
+    }
+
+    PaintTail(PaintStereoFull16, ch, sc, count, samp, i);
+}
+
+static const paintfunc_t paintfuncs[] = {
+    PaintMono8_SIMD,
+    PaintStereoDmix8_SIMD,
+    PaintStereoFull8_SIMD,
+    PaintMono16_SIMD,
+    PaintStereoDmix16_SIMD,
+    PaintStereoFull16_SIMD,
+};
+
+// dst += src
+static void AddSamples(samplepair_t *dst, const samplepair_t *src, int count)
+{
+    float *out = &dst->left;
+    const float *in = &src->left;
+    int i;
+
+    for (i = 0; i <= count - 2; i += 2, out += 4, in += 4)
+        mix_store(out, mix_add(mix_load(out), mix_load(in)));
+
+    if (i < count) {
+        out[0] += in[0];
+        out[1] += in[1];
+    }
+}
+
+#else
+
+#define paintfuncs  paintfuncs_c
+
+// dst += src
+static void AddSamples(samplepair_t *dst, const samplepair_t *src, int count)
+{
+    for (int i = 0; i < count; i++) {
+        dst[i].left += src[i].left;
+        dst[i].right += src[i].right;
+    }
+}
+
+#endif
+
+// copies or adds streaming samples in [start, stop) to paint buffer
+static void MixRawSamples(samplepair_t *out, int start, int stop, bool add)
+{
+    while (start < stop) {
+        int pos = start & (MAX_RAW_SAMPLES - 1);
+        int count = min(stop - start, MAX_RAW_SAMPLES - pos);
+
+        if (add)
+            AddSamples(out, &s_rawsamples[pos], count);
+        else
+            memcpy(out, &s_rawsamples[pos], count * sizeof(out[0]));
+
+        out += count;
+        start += count;
+    }
+}
+
 static void PaintChannels(int endtime)
 {
     samplepair_t paintbuffer[PAINTBUFFER_SIZE];
@@ -431,9 +870,7 @@ static void PaintChannels(int endtime)
         memset(paintbuffer, 0, (end - s_paintedtime) * sizeof(paintbuffer[0]));
 
         // copy from the streaming sound source
-        int stop = min(end, s_rawend);
-        for (i = s_paintedtime; i < stop; i++)
-            paintbuffer[i - s_paintedtime] = s_rawsamples[i & (MAX_RAW_SAMPLES - 1)];
+        MixRawSamples(paintbuffer, s_paintedtime, min(end, s_rawend), false);
 
         // paint in the channels.
         for (i = 0, ch = s_channels; i < s_numchannels; i++, ch++) {
@@ -485,12 +922,7 @@ static void PaintChannels(int endtime)
           if (underwater)
             underwater_filter(paintbuffer, stop - s_paintedtime);
 
-          for (int i = s_paintedtime; i < stop; i++)
-          {
-            int s = i & (MAX_RAW_SAMPLES - 1);
-            paintbuffer[i - s_paintedtime].left += s_rawsamples[s].left;
-            paintbuffer[i - s_paintedtime].right += s_rawsamples[s].right;
-          }
+          MixRawSamples(paintbuffer, s_paintedtime, stop, true);
         }
 
         // transfer out according to DMA format
@@ -499,6 +931,139 @@ static void PaintChannels(int endtime)
     }
 }
 
+/*
+===============================================================================
+
+MIXER BENCHMARK
+
+===============================================================================
+*/
+
+#define BENCH_BLOCK     1024
+#define BENCH_LENGTH    (8192 + 3)
+
+typedef void (*transferfunc_t)(int16_t *, const samplepair_t *, int);
+
+static void MixBenchFrame(const paintfunc_t *funcs, transferfunc_t transfer,
+                          channel_t *channels, int numchannels,
+                          samplepair_t *paintbuffer, int16_t *out)
+{
+    channel_t *ch;
+    int i, n, count;
+
+    memset(paintbuffer, 0, BENCH_BLOCK * sizeof(paintbuffer[0]));
+
+    for (i = 0, ch = channels; i < numchannels; i++, ch++) {
+        sfxcache_t *sc = ch->sfx->cache;
+        int func = (sc->width - 1) * 3 + (sc->channels - 1) * (ch->autosound + 1);
+
+        for (count = 0; count < BENCH_BLOCK; count += n) {
+            n = min(BENCH_BLOCK - count, sc->length - ch->pos);
+            funcs[func](ch, sc, n, paintbuffer + count);
+            ch->pos += n;
+            if (ch->pos == sc->length)
+                ch->pos = 0;
+        }
+    }
+
+    transfer(out, paintbuffer, BENCH_BLOCK);
+}
+
+/*
+=================
+DMA_MixBench_f
+
+Mixes random channels into a private buffer, leaving the sound device and
+channel state alone. Runs both scalar and vectorized mixers and compares
+their output.
+=================
+*/
+void DMA_MixBench_f(void)
+{
+    static const char *const modes[2] = { "scalar", "simd" };
+    static const paintfunc_t *const funcs[2] = { paintfuncs_c, paintfuncs };
+    static const transferfunc_t transfers[2] = { TransferSamples16, TransferSamples16_SIMD };
+    sfx_t sfx[6];
+    channel_t *channels;
+    samplepair_t *paintbuffer;
+    int16_t *out[2];
+    int i, j, mode, numchannels, frames;
+    unsigned start, msec;
+    float oldvol;
+
+    if (Cmd_Argc() > 3) {
+        Com_Printf("Usage: %s [channels] [frames]\n", Cmd_Argv(0));
+        return;
+    }
+
+    numchannels = Cmd_Argc() > 1 ? Q_clip(Q_atoi(Cmd_Argv(1)), 1, 1024) : 64;
+    frames = Cmd_Argc() > 2 ? max(Q_atoi(Cmd_Argv(2)), 1) : 1000;
+
+    // one sound of each format, odd length to exercise scalar tails
+    memset(sfx, 0, sizeof(sfx));
+    for (i = 0; i < 6; i++) {
+        int width = i / 3 + 1;
+        int numch = i % 3 ? 2 : 1;
+        int size = BENCH_LENGTH * width * numch;
+        sfxcache_t *sc = Z_Malloc(sizeof(*sc) + size - 1);
+
+        sc->length = BENCH_LENGTH;
+        sc->loopstart = 0;
+        sc->width = width;
+        sc->channels = numch;
+        sc->size = size;
+        for (j = 0; j < size; j++)
+            sc->data[j] = Q_rand();
+        sfx[i].cache = sc;
+    }
+
+    // autosound selects full volume stereo paint function here
+    channels = Z_Mallocz(sizeof(channels[0]) * numchannels);
+    paintbuffer = Z_Malloc(sizeof(paintbuffer[0]) * BENCH_BLOCK);
+    out[0] = Z_Malloc(sizeof(out[0][0]) * BENCH_BLOCK * 2);
+    out[1] = Z_Malloc(sizeof(out[1][0]) * BENCH_BLOCK * 2);
+
+    for (i = 0; i < numchannels; i++) {
+        channels[i].sfx = &sfx[Q_rand_uniform(6)];
+        channels[i].leftvol = frand();
+        channels[i].rightvol = frand();
+        channels[i].autosound = Q_rand() & 1;
+    }
+
+    Com_Printf("Mixing %d frames of %d samples from %d channels\n",
+               frames, BENCH_BLOCK, numchannels);
+
+    oldvol = snd_vol;
+    snd_vol = 1.0f;
+
+    for (mode = 0; mode < 2; mode++) {
+        for (i = 0; i < numchannels; i++)
+            channels[i].pos = i * 997 % BENCH_LENGTH;
+
+        start = Sys_Milliseconds();
+        for (i = 0; i < frames; i++)
+            MixBenchFrame(funcs[mode], transfers[mode], channels, numchannels, paintbuffer, out[mode]);
+        msec = Sys_Milliseconds() - start;
+
+        Com_Printf("%-6s: %u msec, %.1f usec per frame\n",
+                   modes[mode], msec, msec * 1000.0f / frames);
+    }
+
+    snd_vol = oldvol;
+
+    if (memcmp(out[0], out[1], sizeof(out[0][0]) * BENCH_BLOCK * 2))
+        Com_Printf("Output differs between mixers\n");
+    else
+        Com_Printf("Output matches\n");
+
+    Z_Free(out[0]);
+    Z_Free(out[1]);
+    Z_Free(paintbuffer);
+    Z_Free(channels);
+    for (i = 0; i < 6; i++)
+        Z_Free(sfx[i].cache);
+}
+
 static void s_volume_changed(cvar_t *self)
 {
     snd_vol = S_GetLinearVolume(Cvar_ClampValue(self, 0, 1));
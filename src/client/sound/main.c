@@ -116,6 +116,9 @@ static const cmdreg_t c_sound[] = {
     { "stopsound", S_StopAllSounds },
     { "soundlist", S_SoundList_f },
     { "soundinfo", S_SoundInfo_f },
+#if USE_SNDDMA
+    { "s_mixbench", DMA_MixBench_f },
+#endif
 
     { NULL }
 };
@@ -130,6 +130,7 @@ typedef struct {
 
 #if USE_SNDDMA
 extern const sndapi_t   snd_dma;
+void DMA_MixBench_f(void);
 #endif
 
 #if USE_OPENAL
@@ -18,64 +18,353 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "shared/shared.h"
 #include "common/async.h"
+#include "common/common.h"
+#include "common/cvar.h"
 #include "common/zone.h"
 #include "system/pthread.h"
+#include "system/system.h"
+
+#define MAX_ASYNC_WORKERS   32
+
+#define NUM_PRIOS           (ASYNC_PRIO_HIGH - ASYNC_PRIO_LOW + 1)
+#define PRIO_INDEX(prio)    (Q_clip(prio, ASYNC_PRIO_LOW, ASYNC_PRIO_HIGH) - ASYNC_PRIO_LOW)
+
+// slot of the main thread in run_work[]
+#define MAIN_SLOT           MAX_ASYNC_WORKERS
+
+typedef struct {
+    asyncwork_t *head;
+    asyncwork_t **tail;
+} workqueue_t;
+
+typedef struct {
+    void (*func)(void *, int);
+    void *arg;
+    int count;
+    int chunk;
+    int next;       // next index to hand out
+    int done;       // number of indices finished
+} parallel_t;
 
 static bool work_initialized;
 static bool work_terminate;
 static pthread_mutex_t work_lock;
-static pthread_cond_t work_cond;
-static pthread_t work_thread;
-static asyncwork_t *pend_head;
-static asyncwork_t *done_head;
+static pthread_cond_t work_cond;    // signaled when work is available
+static pthread_cond_t done_cond;    // signaled when work has finished
+static pthread_t work_threads[MAX_ASYNC_WORKERS];
+static int num_workers;
+static asynchandle_t last_handle;
 
-static void append_work(asyncwork_t **head, asyncwork_t *work)
+static workqueue_t pend_queues[NUM_PRIOS];
+static workqueue_t wait_queue;      // blocked on dependency
+static workqueue_t done_queue;
+static asyncwork_t *run_work[MAX_ASYNC_WORKERS + 1];
+static parallel_t *parallel;
+
+static cvar_t *com_async_workers;
+
+static void queue_init(workqueue_t *q)
+{
+    q->head = NULL;
+    q->tail = &q->head;
+}
+
+static void queue_append(workqueue_t *q, asyncwork_t *work)
 {
-    asyncwork_t *c, **p;
-    for (p = head, c = *head; c; p = &c->next, c = c->next)
-        ;
     work->next = NULL;
-    *p = work;
+    *q->tail = work;
+    q->tail = &work->next;
+}
+
+static asyncwork_t *queue_remove(workqueue_t *q, asynchandle_t handle)
+{
+    asyncwork_t *work, **p;
+
+    for (p = &q->head; (work = *p) != NULL; p = &work->next) {
+        if (handle && work->handle != handle)
+            continue;
+        *p = work->next;
+        if (!*p)
+            q->tail = p;
+        return work;
+    }
+
+    return NULL;
+}
+
+static bool queue_contains(const workqueue_t *q, asynchandle_t handle)
+{
+    for (asyncwork_t *work = q->head; work; work = work->next)
+        if (work->handle == handle)
+            return true;
+
+    return false;
+}
+
+// work_lock must be held for all functions below
+
+static bool is_pending(asynchandle_t handle)
+{
+    int i;
+
+    if (!handle)
+        return false;
+
+    for (i = 0; i < NUM_PRIOS; i++)
+        if (queue_contains(&pend_queues[i], handle))
+            return true;
+
+    if (queue_contains(&wait_queue, handle))
+        return true;
+
+    for (i = 0; i <= MAX_ASYNC_WORKERS; i++)
+        if (run_work[i] && run_work[i]->handle == handle)
+            return true;
+
+    return false;
+}
+
+static asyncwork_t *pop_work(void)
+{
+    asyncwork_t *work;
+
+    for (int i = NUM_PRIOS - 1; i >= 0; i--)
+        if ((work = queue_remove(&pend_queues[i], 0)))
+            return work;
+
+    return NULL;
+}
+
+static void release_dependents(asynchandle_t handle)
+{
+    asyncwork_t *work, *next;
+    bool released = false;
+
+    work = wait_queue.head;
+    queue_init(&wait_queue);
+
+    for (; work; work = next) {
+        next = work->next;
+        if (work->depends == handle) {
+            queue_append(&pend_queues[PRIO_INDEX(work->prio)], work);
+            released = true;
+        } else {
+            queue_append(&wait_queue, work);
+        }
+    }
+
+    if (released)
+        pthread_cond_broadcast(&work_cond);
+}
+
+static void run_work_locked(asyncwork_t *work, int slot)
+{
+    run_work[slot] = work;
+
+    pthread_mutex_unlock(&work_lock);
+    work->work_cb(work->cb_arg);
+    pthread_mutex_lock(&work_lock);
+
+    run_work[slot] = NULL;
+
+    queue_append(&done_queue, work);
+    release_dependents(work->handle);
+    pthread_cond_broadcast(&done_cond);
+}
+
+static bool run_parallel(void)
+{
+    parallel_t *par = parallel;
+    int i, start, end;
+
+    if (!par || par->next >= par->count)
+        return false;
+
+    start = par->next;
+    end = min(start + par->chunk, par->count);
+    par->next = end;
+
+    pthread_mutex_unlock(&work_lock);
+    for (i = start; i < end; i++)
+        par->func(par->arg, i);
+    pthread_mutex_lock(&work_lock);
+
+    par->done += end - start;
+    if (par->done == par->count)
+        pthread_cond_broadcast(&done_cond);
+
+    return true;
 }
 
 static void *work_func(void *arg)
 {
+    int slot = (intptr_t)arg;
+    asyncwork_t *work;
+
     pthread_mutex_lock(&work_lock);
     while (1) {
-        while (!pend_head && !work_terminate)
-            pthread_cond_wait(&work_cond, &work_lock);
+        // parallel loops have main thread waiting on them
+        if (run_parallel())
+            continue;
 
-        asyncwork_t *work = pend_head;
-        if (!work)
-            break;
-        pend_head = work->next;
+        work = pop_work();
+        if (work) {
+            run_work_locked(work, slot);
+            continue;
+        }
 
-        pthread_mutex_unlock(&work_lock);
-        work->work_cb(work->cb_arg);
-        pthread_mutex_lock(&work_lock);
+        // finish all queued work before exiting
+        if (work_terminate)
+            break;
 
-        append_work(&done_head, work);
+        pthread_cond_wait(&work_cond, &work_lock);
     }
     pthread_mutex_unlock(&work_lock);
 
     return NULL;
 }
 
-void Com_QueueAsyncWork(asyncwork_t *work)
+static void work_init(void)
 {
-    if (!work_initialized) {
-        pthread_mutex_init(&work_lock, NULL);
-        pthread_cond_init(&work_cond, NULL);
-        if (pthread_create(&work_thread, NULL, work_func, NULL))
-            Com_Error(ERR_FATAL, "Couldn't create async work thread");
-        work_initialized = true;
+    int i, count;
+
+    com_async_workers = Cvar_Get("com_async_workers", "0", 0);
+
+    // leave one core for the main thread by default
+    count = com_async_workers->integer;
+    if (count <= 0)
+        count = Sys_GetNumCPUs() - 1;
+    count = Q_clip(count, 1, MAX_ASYNC_WORKERS);
+
+    pthread_mutex_init(&work_lock, NULL);
+    pthread_cond_init(&work_cond, NULL);
+    pthread_cond_init(&done_cond, NULL);
+
+    for (i = 0; i < NUM_PRIOS; i++)
+        queue_init(&pend_queues[i]);
+    queue_init(&wait_queue);
+    queue_init(&done_queue);
+
+    for (i = 0; i < count; i++) {
+        if (pthread_create(&work_threads[i], NULL, work_func, (void *)(intptr_t)i)) {
+            if (!i)
+                Com_Error(ERR_FATAL, "Couldn't create async work thread");
+            break;
+        }
     }
 
+    num_workers = i;
+    work_initialized = true;
+
+    Com_DPrintf("Started %d async worker thread%s\n", num_workers, num_workers == 1 ? "" : "s");
+}
+
+asynchandle_t Com_QueueAsyncWork(asyncwork_t *work)
+{
+    asyncwork_t *copy;
+    asynchandle_t handle;
+
+    if (!work_initialized)
+        work_init();
+
+    copy = Z_CopyStruct(work);
+
     pthread_mutex_lock(&work_lock);
-    append_work(&pend_head, Z_CopyStruct(work));
+    if (!++last_handle)
+        last_handle = 1;
+    handle = copy->handle = last_handle;
+
+    if (is_pending(copy->depends))
+        queue_append(&wait_queue, copy);
+    else
+        queue_append(&pend_queues[PRIO_INDEX(copy->prio)], copy);
     pthread_mutex_unlock(&work_lock);
 
     pthread_cond_signal(&work_cond);
+
+    return handle;
+}
+
+// returns true if work callback hasn't finished yet
+bool Com_AsyncWorkPending(asynchandle_t handle)
+{
+    bool ret;
+
+    if (!work_initialized)
+        return false;
+
+    pthread_mutex_lock(&work_lock);
+    ret = is_pending(handle);
+    pthread_mutex_unlock(&work_lock);
+
+    return ret;
+}
+
+// blocks until work callback has finished, running it on the calling thread
+// if it wasn't picked up by a worker yet. done callback is not called here.
+void Com_WaitAsyncWork(asynchandle_t handle)
+{
+    asyncwork_t *work;
+
+    if (!work_initialized || !handle)
+        return;
+
+    pthread_mutex_lock(&work_lock);
+    while (is_pending(handle)) {
+        for (int i = 0; i < NUM_PRIOS; i++) {
+            if ((work = queue_remove(&pend_queues[i], handle))) {
+                run_work_locked(work, MAIN_SLOT);
+                break;
+            }
+        }
+        if (!work)
+            pthread_cond_wait(&done_cond, &work_lock);
+    }
+    pthread_mutex_unlock(&work_lock);
+}
+
+void Com_ParallelFor(void (*func)(void *, int), void *arg, int count)
+{
+    parallel_t par;
+
+    if (count <= 0)
+        return;
+
+    if (!work_initialized)
+        work_init();
+
+    if (count == 1) {
+        func(arg, 0);
+        return;
+    }
+
+    par.func = func;
+    par.arg = arg;
+    par.count = count;
+    par.chunk = max(1, count / ((num_workers + 1) * 4));
+    par.next = 0;
+    par.done = 0;
+
+    pthread_mutex_lock(&work_lock);
+    Q_assert(!parallel);
+    parallel = &par;
+    pthread_cond_broadcast(&work_cond);
+
+    while (run_parallel())
+        ;
+    while (par.done < par.count)
+        pthread_cond_wait(&done_cond, &work_lock);
+
+    parallel = NULL;
+    pthread_mutex_unlock(&work_lock);
+}
+
+int Com_AsyncWorkerCount(void)
+{
+    if (!work_initialized)
+        work_init();
+
+    return num_workers;
 }
 
 void Com_CompleteAsyncWork(void)
@@ -86,16 +375,17 @@ void Com_CompleteAsyncWork(void)
         return;
     if (pthread_mutex_trylock(&work_lock))
         return;
-    if (q_unlikely(done_head)) {
-        for (work = done_head; work; work = next) {
-            next = work->next;
-            if (work->done_cb)
-                work->done_cb(work->cb_arg);
-            Z_Free(work);
-        }
-        done_head = NULL;
-    }
+    work = done_queue.head;
+    queue_init(&done_queue);
     pthread_mutex_unlock(&work_lock);
+
+    // done callbacks may queue more work
+    for (; work; work = next) {
+        next = work->next;
+        if (work->done_cb)
+            work->done_cb(work->cb_arg);
+        Z_Free(work);
+    }
 }
 
 void Com_ShutdownAsyncWork(void)
@@ -107,12 +397,18 @@ void Com_ShutdownAsyncWork(void)
     work_terminate = true;
     pthread_mutex_unlock(&work_lock);
 
-    pthread_cond_signal(&work_cond);
+    pthread_cond_broadcast(&work_cond);
 
-    Q_assert(!pthread_join(work_thread, NULL));
+    for (int i = 0; i < num_workers; i++)
+        Q_assert(!pthread_join(work_threads[i], NULL));
     Com_CompleteAsyncWork();
 
+    Q_assert(!wait_queue.head);
+
     pthread_mutex_destroy(&work_lock);
     pthread_cond_destroy(&work_cond);
+    pthread_cond_destroy(&done_cond);
     work_initialized = false;
+    work_terminate = false;
+    num_workers = 0;
 }
@@ -32,10 +32,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/mdfour.h"
 #include "common/utils.h"
 #include "system/hunk.h"
+#include "system/system.h"
 
 extern mtexinfo_t nulltexinfo;
 
 static cvar_t *map_visibility_patch;
+static cvar_t *map_pvs_cache;
 
 /*
 ===============================================================================
@@ -92,6 +94,7 @@ LOAD(Visibility)
     bsp->vis = ALLOC(count);
     bsp->vis->numclusters = numclusters;
     bsp->visrowsize = (numclusters + 7) >> 3;
+    bsp->pvs_stride = ALIGN(bsp->visrowsize, 8);
     Q_assert(bsp->visrowsize <= VIS_MAX_BYTES);
 
     for (i = 0; i < numclusters; i++) {
@@ -995,6 +998,12 @@ static int BSP_ValidateAreaPortals(bsp_t *bsp)
     return Q_ERR_SUCCESS;
 }
 
+static bool BSP_PvsInCache(const bsp_t *bsp, const byte *matrix)
+{
+    const byte *base = bsp->pvs_cache;
+    return base && matrix >= base && matrix < base + bsp->pvs_cache_size;
+}
+
 void BSP_Free(bsp_t *bsp)
 {
     if (!bsp) {
@@ -1002,12 +1011,13 @@ void BSP_Free(bsp_t *bsp)
     }
     Q_assert(bsp->refcount > 0);
     if (--bsp->refcount == 0) {
-		if (bsp->pvs2_matrix)
-		{
-			// free the PVS2 matrix separately - it's not part of the hunk
+		// PVS matrices are not part of the hunk
+		if (!BSP_PvsInCache(bsp, bsp->pvs_matrix))
+			Z_Free(bsp->pvs_matrix);
+		if (!BSP_PvsInCache(bsp, bsp->pvs2_matrix))
 			Z_Free(bsp->pvs2_matrix);
-			bsp->pvs2_matrix = NULL;
-		}
+		Sys_UnmapFile(bsp->pvs_cache, bsp->pvs_cache_size);
+        Z_Free(bsp->brushplanes);
 
         Hunk_Free(&bsp->hunk);
         List_Remove(&bsp->entry);
@@ -1015,13 +1025,58 @@ void BSP_Free(bsp_t *bsp)
     }
 }
 
+/*
+==================
+BSP_BuildBrushPlanes
+
+Copies brush side planes into groups of BRUSH_SIDE_GROUP for the vectorized
+brush clipping code. Unused lanes of the last group are zero.
+==================
+*/
+static void BSP_BuildBrushPlanes(bsp_t *bsp)
+{
+    mbrush_t        *brush;
+    mbrushside_t    *side;
+    cplane_t        *plane;
+    float           *out;
+    size_t          numgroups;
+    int             i, j;
+
+    numgroups = 0;
+    for (i = 0, brush = bsp->brushes; i < bsp->numbrushes; i++, brush++)
+        numgroups += (brush->numsides + BRUSH_SIDE_GROUP - 1) / BRUSH_SIDE_GROUP;
+
+    if (!numgroups)
+        return;
+
+    out = bsp->brushplanes = Z_TagMallocz(numgroups * BRUSH_SIDE_FLOATS * sizeof(float), TAG_CMODEL);
+
+    for (i = 0, brush = bsp->brushes; i < bsp->numbrushes; i++, brush++) {
+        if (!brush->numsides)
+            continue;
+
+        brush->sideplanes = out;
+        for (j = 0, side = brush->firstbrushside; j < brush->numsides; j++, side++) {
+            plane = side->plane;
+            out[0 * BRUSH_SIDE_GROUP + j % BRUSH_SIDE_GROUP] = plane->normal[0];
+            out[1 * BRUSH_SIDE_GROUP + j % BRUSH_SIDE_GROUP] = plane->normal[1];
+            out[2 * BRUSH_SIDE_GROUP + j % BRUSH_SIDE_GROUP] = plane->normal[2];
+            out[3 * BRUSH_SIDE_GROUP + j % BRUSH_SIDE_GROUP] = plane->dist;
+            if (j % BRUSH_SIDE_GROUP == BRUSH_SIDE_GROUP - 1)
+                out += BRUSH_SIDE_FLOATS;
+        }
+        if (j % BRUSH_SIDE_GROUP)
+            out += BRUSH_SIDE_FLOATS;
+    }
+}
+
 static void BSP_BuildPvsMatrix(bsp_t *bsp)
 {
 	if (!bsp->vis)
 		return;
 
 	// a typical map with 2K clusters will take half a megabyte of memory for the matrix
-	size_t matrix_size = bsp->visrowsize * bsp->vis->numclusters;
+	size_t matrix_size = bsp->pvs_stride * bsp->vis->numclusters;
 
 	// allocate the matrix but don't set it in the BSP structure yet: 
 	// we want BSP_CluterVis to use the old PVS data here, and not the new empty matrix
@@ -1029,7 +1084,7 @@ static void BSP_BuildPvsMatrix(bsp_t *bsp)
 	
 	for (int cluster = 0; cluster < bsp->vis->numclusters; cluster++)
 	{
-		BSP_ClusterVis(bsp, pvs_matrix + bsp->visrowsize * cluster, cluster, DVIS_PVS);
+		BSP_ClusterVis(bsp, pvs_matrix + bsp->pvs_stride * cluster, cluster, DVIS_PVS);
 	}
 
 	bsp->pvs_matrix = pvs_matrix;
@@ -1043,7 +1098,7 @@ byte* BSP_GetPvs(bsp_t *bsp, int cluster)
 	if (cluster < 0 || cluster >= bsp->vis->numclusters)
 		return NULL;
 
-	return bsp->pvs_matrix + bsp->visrowsize * cluster;
+	return bsp->pvs_matrix + bsp->pvs_stride * cluster;
 }
 
 byte* BSP_GetPvs2(bsp_t *bsp, int cluster)
@@ -1054,9 +1109,41 @@ byte* BSP_GetPvs2(bsp_t *bsp, int cluster)
 	if (cluster < 0 || cluster >= bsp->vis->numclusters)
 		return NULL;
 
-	return bsp->pvs2_matrix + bsp->visrowsize * cluster;
+	return bsp->pvs2_matrix + bsp->pvs_stride * cluster;
 }
 
+/*
+===============================================================================
+
+                    PVS MATRIX CACHE
+
+The first- and second-order PVS matrices are cached in `maps/pvs/<mapname>.bin`.
+Cache files found in the game directory are mapped into memory copy-on-write,
+so that a map restart doesn't need to decompress or patch the PVS again. Rows
+are stored with `pvs_stride` size, keeping them 64-bit aligned. Headerless
+files written by older versions, containing both matrices with `visrowsize`
+rows, are still accepted.
+
+===============================================================================
+*/
+
+#define PVS_CACHE_IDENT     MakeLittleLong('Q', 'P', 'V', 'S')
+#define PVS_CACHE_VERSION   1
+
+#define PVS_CACHE_PATCHED   BIT(0)  // patched for vkpt, followed by PVS2 matrix
+#define PVS_CACHE_VISPATCH  BIT(1)  // built with map_visibility_patch
+
+typedef struct {
+    uint32_t    ident;
+    uint32_t    version;
+    uint32_t    bsp_checksum;
+    uint32_t    numclusters;
+    uint32_t    stride;
+    uint32_t    flags;
+    uint32_t    data_checksum;
+    uint32_t    reserved;       // keeps matrices 64-bit aligned
+} pvs_cache_header_t;
+
 // Converts `maps/<name>.bsp` into `maps/pvs/<name>.bin`
 static bool BSP_GetPatchedPVSFileName(const char* map_path, char pvs_path[MAX_QPATH])
 {
@@ -1079,14 +1166,67 @@ static bool BSP_GetPatchedPVSFileName(const char* map_path, char pvs_path[MAX_QP
 	return true;
 }
 
-// Loads the first- and second-order PVS matrices from a file called `maps/pvs/<mapname>.bin`
-static bool BSP_LoadPatchedPVS(bsp_t *bsp)
+static bool BSP_ValidatePvsCache(const bsp_t *bsp, const byte *data, size_t len)
 {
-	char pvs_path[MAX_QPATH];
+    const pvs_cache_header_t *header = (const pvs_cache_header_t *)data;
+    size_t matrix_size = bsp->pvs_stride * bsp->vis->numclusters;
+    uint32_t vispatch = map_visibility_patch->integer ? PVS_CACHE_VISPATCH : 0;
+
+    if (len < sizeof(*header))
+        return false;
+    if (header->ident != PVS_CACHE_IDENT || header->version != PVS_CACHE_VERSION)
+        return false;
+    if (header->bsp_checksum != bsp->checksum || header->numclusters != bsp->vis->numclusters)
+        return false;
+    if (header->stride != bsp->pvs_stride || (header->flags & PVS_CACHE_VISPATCH) != vispatch)
+        return false;
+    if (len != sizeof(*header) + matrix_size * (header->flags & PVS_CACHE_PATCHED ? 2 : 1))
+        return false;
+
+    return Com_BlockChecksum(data + sizeof(*header), len - sizeof(*header)) == header->data_checksum;
+}
 
-	if (!BSP_GetPatchedPVSFileName(bsp->name, pvs_path))
-		return false;
+static void BSP_CopyPvsRows(const bsp_t *bsp, byte *dst, const byte *src, size_t src_stride)
+{
+    for (int cluster = 0; cluster < bsp->vis->numclusters; cluster++)
+        memcpy(dst + bsp->pvs_stride * cluster, src + src_stride * cluster, bsp->visrowsize);
+}
 
+// Maps the cache file from the game directory if it exists and is up to date
+static bool BSP_MapPvsCache(bsp_t *bsp, const char *pvs_path)
+{
+    char path[MAX_OSPATH];
+    size_t len;
+    byte *data;
+
+    if (Q_concat(path, sizeof(path), fs_gamedir, "/", pvs_path) >= sizeof(path))
+        return false;
+
+    data = Sys_MapFile(path, &len, true);
+    if (!data)
+        return false;
+
+    if (!BSP_ValidatePvsCache(bsp, data, len)) {
+        Sys_UnmapFile(data, len);
+        return false;
+    }
+
+    const pvs_cache_header_t *header = (const pvs_cache_header_t *)data;
+
+    bsp->pvs_cache = data;
+    bsp->pvs_cache_size = len;
+    bsp->pvs_matrix = data + sizeof(*header);
+    if (header->flags & PVS_CACHE_PATCHED) {
+        bsp->pvs2_matrix = bsp->pvs_matrix + bsp->pvs_stride * bsp->vis->numclusters;
+        bsp->pvs_patched = true;
+    }
+
+    return true;
+}
+
+// Loads the PVS matrices through the filesystem, accepting the headerless format too
+static bool BSP_ReadPvsCache(bsp_t *bsp, const char *pvs_path)
+{
 	unsigned char* filebuf = 0;
 	int filelen = 0;
 	filelen = FS_LoadFile(pvs_path, (void**)&filebuf);
@@ -1094,25 +1234,88 @@ static bool BSP_LoadPatchedPVS(bsp_t *bsp)
 	if (filebuf == 0)
 		return false;
 
-	size_t matrix_size = bsp->visrowsize * bsp->vis->numclusters;
-	if (filelen != matrix_size * 2)
+	size_t matrix_size = bsp->pvs_stride * bsp->vis->numclusters;
+	size_t packed_size = bsp->visrowsize * bsp->vis->numclusters;
+	bool ret = true;
+
+	if (BSP_ValidatePvsCache(bsp, filebuf, filelen))
 	{
-		FS_FreeFile(filebuf);
-		return false;
-	}
+		const pvs_cache_header_t *header = (const pvs_cache_header_t *)filebuf;
 
-	bsp->pvs_matrix = Z_Malloc(matrix_size);
-	memcpy(bsp->pvs_matrix, filebuf, matrix_size);
+		bsp->pvs_matrix = Z_Malloc(matrix_size);
+		memcpy(bsp->pvs_matrix, filebuf + sizeof(*header), matrix_size);
 
-	bsp->pvs2_matrix = Z_Malloc(matrix_size);
-	memcpy(bsp->pvs2_matrix, filebuf + matrix_size, matrix_size);
+		if (header->flags & PVS_CACHE_PATCHED)
+		{
+			bsp->pvs2_matrix = Z_Malloc(matrix_size);
+			memcpy(bsp->pvs2_matrix, filebuf + sizeof(*header) + matrix_size, matrix_size);
+			bsp->pvs_patched = true;
+		}
+	}
+	else if (filelen == packed_size * 2)
+	{
+		bsp->pvs_matrix = Z_Mallocz(matrix_size);
+		BSP_CopyPvsRows(bsp, bsp->pvs_matrix, filebuf, bsp->visrowsize);
+
+		bsp->pvs2_matrix = Z_Mallocz(matrix_size);
+		BSP_CopyPvsRows(bsp, bsp->pvs2_matrix, filebuf + packed_size, bsp->visrowsize);
+		bsp->pvs_patched = true;
+	}
+	else
+	{
+		ret = false;
+	}
 
 	FS_FreeFile(filebuf);
+	return ret;
+}
+
+static bool BSP_LoadPvsCache(bsp_t *bsp)
+{
+	char pvs_path[MAX_QPATH];
+
+	if (!bsp->vis)
+		return false;
+
+	if (!BSP_GetPatchedPVSFileName(bsp->name, pvs_path))
+		return false;
+
+	if (BSP_MapPvsCache(bsp, pvs_path))
+		return true;
+
+	if (!BSP_ReadPvsCache(bsp, pvs_path))
+		return false;
+
+	// rewrite it into the game directory so it can be mapped next time
+	if (map_pvs_cache->integer)
+		BSP_SavePvsCache(bsp);
+
 	return true;
 }
 
-// Saves the first- and second-order PVS matrices to a file called `maps/pvs/<mapname>.bin`
-bool BSP_SavePatchedPVS(bsp_t *bsp)
+// Copies the matrices out of the mapped cache file, so that it can be overwritten
+static void BSP_DetachPvsCache(bsp_t *bsp)
+{
+	size_t matrix_size;
+
+	if (!bsp->pvs_cache)
+		return;
+
+	matrix_size = bsp->pvs_stride * bsp->vis->numclusters;
+
+	if (BSP_PvsInCache(bsp, bsp->pvs_matrix))
+		bsp->pvs_matrix = memcpy(Z_Malloc(matrix_size), bsp->pvs_matrix, matrix_size);
+	if (BSP_PvsInCache(bsp, bsp->pvs2_matrix))
+		bsp->pvs2_matrix = memcpy(Z_Malloc(matrix_size), bsp->pvs2_matrix, matrix_size);
+
+	Sys_UnmapFile(bsp->pvs_cache, bsp->pvs_cache_size);
+	bsp->pvs_cache = NULL;
+	bsp->pvs_cache_size = 0;
+}
+
+// Saves the PVS matrices, and the PVS2 matrix if the PVS has been patched,
+// to a file called `maps/pvs/<mapname>.bin`
+bool BSP_SavePvsCache(bsp_t *bsp)
 {
 	char pvs_path[MAX_QPATH];
 
@@ -1122,16 +1325,34 @@ bool BSP_SavePatchedPVS(bsp_t *bsp)
 	if (!bsp->pvs_matrix)
 		return false;
 
-	if (!bsp->pvs2_matrix)
+	if (bsp->pvs_patched && !bsp->pvs2_matrix)
 		return false;
 
-	size_t matrix_size = bsp->visrowsize * bsp->vis->numclusters;
-	unsigned char* filebuf = Z_Malloc(matrix_size * 2);
+	BSP_DetachPvsCache(bsp);
 
-	memcpy(filebuf, bsp->pvs_matrix, matrix_size);
-	memcpy(filebuf + matrix_size, bsp->pvs2_matrix, matrix_size);
+	size_t matrix_size = bsp->pvs_stride * bsp->vis->numclusters;
+	size_t data_size = matrix_size * (bsp->pvs_patched ? 2 : 1);
+	unsigned char* filebuf = Z_Malloc(sizeof(pvs_cache_header_t) + data_size);
+	pvs_cache_header_t *header = (pvs_cache_header_t *)filebuf;
 
-	int err = FS_WriteFile(pvs_path, filebuf, matrix_size * 2);
+	memcpy(filebuf + sizeof(*header), bsp->pvs_matrix, matrix_size);
+	if (bsp->pvs_patched)
+		memcpy(filebuf + sizeof(*header) + matrix_size, bsp->pvs2_matrix, matrix_size);
+
+	header->ident = PVS_CACHE_IDENT;
+	header->version = PVS_CACHE_VERSION;
+	header->bsp_checksum = bsp->checksum;
+	header->numclusters = bsp->vis->numclusters;
+	header->stride = bsp->pvs_stride;
+	header->flags = 0;
+	if (bsp->pvs_patched)
+		header->flags |= PVS_CACHE_PATCHED;
+	if (map_visibility_patch->integer)
+		header->flags |= PVS_CACHE_VISPATCH;
+	header->data_checksum = Com_BlockChecksum(filebuf + sizeof(*header), data_size);
+	header->reserved = 0;
+
+	int err = FS_WriteFile(pvs_path, filebuf, sizeof(*header) + data_size);
 
 	Z_Free(filebuf);
 
@@ -1141,6 +1362,13 @@ bool BSP_SavePatchedPVS(bsp_t *bsp)
 		return false;
 }
 
+// Saves the first- and second-order PVS matrices after they have been patched
+bool BSP_SavePatchedPVS(bsp_t *bsp)
+{
+	bsp->pvs_patched = true;
+	return BSP_SavePvsCache(bsp);
+}
+
 #if USE_CLIENT
 
 int BSP_LoadMaterials(bsp_t *bsp)
@@ -1471,13 +1699,14 @@ int BSP_Load(const char *name, bsp_t **bsp_p)
         goto fail1;
     }
 
-	if (!BSP_LoadPatchedPVS(bsp))
+    BSP_BuildBrushPlanes(bsp);
+
+	if (!BSP_LoadPvsCache(bsp))
 	{
 		BSP_BuildPvsMatrix(bsp);
-	}
-	else
-	{
-		bsp->pvs_patched = true;
+
+		if (map_pvs_cache->integer)
+			BSP_SavePvsCache(bsp);
 	}
 
 #if USE_REF
@@ -1775,6 +2004,7 @@ mmodel_t *BSP_InlineModel(bsp_t *bsp, const char *name)
 void BSP_Init(void)
 {
     map_visibility_patch = Cvar_Get("map_visibility_patch", "1", 0);
+    map_pvs_cache = Cvar_Get("map_pvs_cache", "1", 0);
 
     Cmd_AddCommand("bsplist", BSP_List_f);
 
@@ -29,6 +29,16 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/zone.h"
 #include "system/hunk.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_BRUSH_SIMD  1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define USE_BRUSH_SIMD  1
+#else
+#define USE_BRUSH_SIMD  0
+#endif
+
 mtexinfo_t nulltexinfo;
 
 static mleaf_t      nullleaf;
@@ -246,6 +256,7 @@ static mnode_t  *box_headnode;
 static mbrush_t box_brush;
 static mbrush_t *box_leafbrush;
 static mbrushside_t box_brushsides[6];
+static float    box_sideplanes[BRUSH_SIDE_FLOATS * 2];
 static mleaf_t  box_leaf;
 static mleaf_t  box_emptyleaf;
 
@@ -270,6 +281,7 @@ static void CM_InitBoxHull(void)
     box_brush.numsides = 6;
     box_brush.firstbrushside = &box_brushsides[0];
     box_brush.contents = CONTENTS_MONSTER;
+    box_brush.sideplanes = box_sideplanes;
 
     box_leaf.contents = CONTENTS_MONSTER;
     box_leaf.firstleafbrush = &box_leafbrush;
@@ -304,6 +316,15 @@ static void CM_InitBoxHull(void)
         p->signbits = 1 << (i >> 1);
         p->normal[i >> 1] = -1;
     }
+
+    for (i = 0; i < 6; i++) {
+        float *g = &box_sideplanes[i / BRUSH_SIDE_GROUP * BRUSH_SIDE_FLOATS + i % BRUSH_SIDE_GROUP];
+
+        p = box_brushsides[i].plane;
+        g[0 * BRUSH_SIDE_GROUP] = p->normal[0];
+        g[1 * BRUSH_SIDE_GROUP] = p->normal[1];
+        g[2 * BRUSH_SIDE_GROUP] = p->normal[2];
+    }
 }
 
 /*
@@ -329,6 +350,14 @@ mnode_t *CM_HeadnodeForBox(const vec3_t mins, const vec3_t maxs)
     box_planes[10].dist = mins[2];
     box_planes[11].dist = -mins[2];
 
+    // update SoA copy of brush side distances
+    box_sideplanes[0 * BRUSH_SIDE_FLOATS + 3 * BRUSH_SIDE_GROUP + 0] = box_planes[0].dist;
+    box_sideplanes[0 * BRUSH_SIDE_FLOATS + 3 * BRUSH_SIDE_GROUP + 1] = box_planes[3].dist;
+    box_sideplanes[0 * BRUSH_SIDE_FLOATS + 3 * BRUSH_SIDE_GROUP + 2] = box_planes[4].dist;
+    box_sideplanes[0 * BRUSH_SIDE_FLOATS + 3 * BRUSH_SIDE_GROUP + 3] = box_planes[7].dist;
+    box_sideplanes[1 * BRUSH_SIDE_FLOATS + 3 * BRUSH_SIDE_GROUP + 0] = box_planes[8].dist;
+    box_sideplanes[1 * BRUSH_SIDE_FLOATS + 3 * BRUSH_SIDE_GROUP + 1] = box_planes[11].dist;
+
     return box_headnode;
 }
 
@@ -347,33 +376,36 @@ CM_BoxLeafnums
 Fills in a list of all the leafs touched
 =============
 */
-static int          leaf_count, leaf_maxcount;
-static mleaf_t      **leaf_list;
-static const vec_t  *leaf_mins, *leaf_maxs;
-static mnode_t      *leaf_topnode;
-
-static void CM_BoxLeafs_r(mnode_t *node)
+typedef struct {
+    int             count, maxcount;
+    mleaf_t         **list;
+    const vec_t     *mins, *maxs;
+    mnode_t         *topnode;
+} boxleafs_t;
+
+// state is kept on stack, server frames are built on multiple threads
+static void CM_BoxLeafs_r(boxleafs_t *bl, mnode_t *node)
 {
     int     s;
 
     while (node->plane) {
-        s = BoxOnPlaneSideFast(leaf_mins, leaf_maxs, node->plane);
+        s = BoxOnPlaneSideFast(bl->mins, bl->maxs, node->plane);
         if (s == BOX_INFRONT) {
             node = node->children[0];
         } else if (s == BOX_BEHIND) {
             node = node->children[1];
         } else {
             // go down both
-            if (!leaf_topnode) {
-                leaf_topnode = node;
+            if (!bl->topnode) {
+                bl->topnode = node;
             }
-            CM_BoxLeafs_r(node->children[0]);
+            CM_BoxLeafs_r(bl, node->children[0]);
             node = node->children[1];
         }
     }
 
-    if (leaf_count < leaf_maxcount) {
-        leaf_list[leaf_count++] = (mleaf_t *)node;
+    if (bl->count < bl->maxcount) {
+        bl->list[bl->count++] = (mleaf_t *)node;
     }
 }
 
@@ -381,20 +413,22 @@ static int CM_BoxLeafs_headnode(const vec3_t mins, const vec3_t maxs,
                                 mleaf_t **list, int listsize,
                                 mnode_t *headnode, mnode_t **topnode)
 {
-    leaf_list = list;
-    leaf_count = 0;
-    leaf_maxcount = listsize;
-    leaf_mins = mins;
-    leaf_maxs = maxs;
+    boxleafs_t  bl;
+
+    bl.list = list;
+    bl.count = 0;
+    bl.maxcount = listsize;
+    bl.mins = mins;
+    bl.maxs = maxs;
 
-    leaf_topnode = NULL;
+    bl.topnode = NULL;
 
-    CM_BoxLeafs_r(headnode);
+    CM_BoxLeafs_r(&bl, headnode);
 
     if (topnode)
-        *topnode = leaf_topnode;
+        *topnode = bl.topnode;
 
-    return leaf_count;
+    return bl.count;
 }
 
 int CM_BoxLeafs(cm_t *cm, const vec3_t mins, const vec3_t maxs,
@@ -465,6 +499,223 @@ static trace_t  *trace_trace;
 static int      trace_contents;
 static bool     trace_ispoint;      // optimized case
 
+/*
+================
+CM_FinishClip
+
+Applies result of clipping against a single brush to the trace
+================
+*/
+static void CM_FinishClip(trace_t *trace, mbrush_t *brush, bool startout, bool getout,
+                          float enterfrac, float leavefrac, cplane_t *clipplane,
+                          mbrushside_t *leadside)
+{
+    if (!startout) {
+        // original point was inside brush
+        trace->startsolid = true;
+        if (!getout) {
+            trace->allsolid = true;
+            if (!map_allsolid_bug->integer) {
+                // original Q2 didn't set these
+                trace->fraction = 0;
+                trace->contents = brush->contents;
+            }
+        }
+        return;
+    }
+    if (enterfrac < leavefrac) {
+        if (enterfrac > -1 && enterfrac < trace->fraction) {
+            if (enterfrac < 0)
+                enterfrac = 0;
+            trace->fraction = enterfrac;
+            trace->plane = *clipplane;
+            trace->surface = &(leadside->texinfo->c);
+            trace->contents = brush->contents;
+        }
+    }
+}
+
+#if USE_BRUSH_SIMD
+
+/*
+===============================================================================
+
+Vectorized versions of CM_ClipBoxToBrush and CM_TestBoxInBrush. Plane
+distances are evaluated for BRUSH_SIDE_GROUP sides at once, using the same
+sequence of single precision operations as the scalar code. Everything that
+depends on side order is then done per side, so results are bit-identical.
+
+===============================================================================
+*/
+
+#if defined(__aarch64__)
+
+typedef float32x4_t     simd4f_t;
+
+#define simd_load(p)        vld1q_f32(p)
+#define simd_store(p, v)    vst1q_f32(p, v)
+#define simd_splat(x)       vdupq_n_f32(x)
+#define simd_add(a, b)      vaddq_f32(a, b)
+#define simd_sub(a, b)      vsubq_f32(a, b)
+#define simd_mul(a, b)      vmulq_f32(a, b)
+#define simd_gt(a, b)       vreinterpretq_f32_u32(vcgtq_f32(a, b))
+#define simd_ge(a, b)       vreinterpretq_f32_u32(vcgeq_f32(a, b))
+#define simd_lt(a, b)       vreinterpretq_f32_u32(vcltq_f32(a, b))
+#define simd_select(m, a, b) vbslq_f32(vreinterpretq_u32_f32(m), a, b)
+
+static inline int simd_mask(simd4f_t m)
+{
+    static const int32_t shifts[4] = { 0, 1, 2, 3 };
+    uint32x4_t bits = vshrq_n_u32(vreinterpretq_u32_f32(m), 31);
+    return vaddvq_u32(vshlq_u32(bits, vld1q_s32(shifts)));
+}
+
+#else
+
+typedef __m128          simd4f_t;
+
+#define simd_load(p)        _mm_loadu_ps(p)
+#define simd_store(p, v)    _mm_storeu_ps(p, v)
+#define simd_splat(x)       _mm_set1_ps(x)
+#define simd_add(a, b)      _mm_add_ps(a, b)
+#define simd_sub(a, b)      _mm_sub_ps(a, b)
+#define simd_mul(a, b)      _mm_mul_ps(a, b)
+#define simd_gt(a, b)       _mm_cmpgt_ps(a, b)
+#define simd_ge(a, b)       _mm_cmpge_ps(a, b)
+#define simd_lt(a, b)       _mm_cmplt_ps(a, b)
+#define simd_select(m, a, b) _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+#define simd_mask(m)        _mm_movemask_ps(m)
+
+#endif
+
+// DotProduct(p, normal) - dist
+#define simd_plane_diff(px, py, pz, nx, ny, nz, dist) \
+    simd_sub(simd_add(simd_add(simd_mul(px, nx), simd_mul(py, ny)), simd_mul(pz, nz)), dist)
+
+// plane->dist - DotProduct(trace_offsets[plane->signbits], plane->normal)
+static inline simd4f_t CM_PushPlanes(simd4f_t nx, simd4f_t ny, simd4f_t nz, simd4f_t dist)
+{
+    const simd4f_t  zero = simd_splat(0);
+    simd4f_t        ox, oy, oz;
+
+    // signbits are set for negative normal components
+    ox = simd_select(simd_lt(nx, zero), simd_splat(trace_offsets[7][0]), simd_splat(trace_offsets[0][0]));
+    oy = simd_select(simd_lt(ny, zero), simd_splat(trace_offsets[7][1]), simd_splat(trace_offsets[0][1]));
+    oz = simd_select(simd_lt(nz, zero), simd_splat(trace_offsets[7][2]), simd_splat(trace_offsets[0][2]));
+
+    return simd_sub(dist, simd_add(simd_add(simd_mul(ox, nx), simd_mul(oy, ny)), simd_mul(oz, nz)));
+}
+
+static void CM_ClipBoxToBrush_SIMD(const vec3_t p1, const vec3_t p2, trace_t *trace, mbrush_t *brush)
+{
+    const float     *g = brush->sideplanes;
+    const simd4f_t  zero = simd_splat(0);
+    simd4f_t        p1x = simd_splat(p1[0]), p1y = simd_splat(p1[1]), p1z = simd_splat(p1[2]);
+    simd4f_t        p2x = simd_splat(p2[0]), p2y = simd_splat(p2[1]), p2z = simd_splat(p2[2]);
+    simd4f_t        nx, ny, nz, dist, v1, v2;
+    float           d1[BRUSH_SIDE_GROUP], d2[BRUSH_SIDE_GROUP];
+    int             i, j, valid, out1, out2;
+    cplane_t        *clipplane;
+    float           enterfrac, leavefrac;
+    bool            getout, startout;
+    float           f;
+    mbrushside_t    *side, *leadside;
+
+    enterfrac = -1;
+    leavefrac = 1;
+    clipplane = NULL;
+
+    getout = false;
+    startout = false;
+    leadside = NULL;
+
+    for (i = 0; i < brush->numsides; i += BRUSH_SIDE_GROUP, g += BRUSH_SIDE_FLOATS) {
+        nx = simd_load(g + 0 * BRUSH_SIDE_GROUP);
+        ny = simd_load(g + 1 * BRUSH_SIDE_GROUP);
+        nz = simd_load(g + 2 * BRUSH_SIDE_GROUP);
+        dist = simd_load(g + 3 * BRUSH_SIDE_GROUP);
+
+        if (!trace_ispoint)
+            dist = CM_PushPlanes(nx, ny, nz, dist);
+
+        v1 = simd_plane_diff(p1x, p1y, p1z, nx, ny, nz, dist);
+        v2 = simd_plane_diff(p2x, p2y, p2z, nx, ny, nz, dist);
+
+        valid = BIT(min(brush->numsides - i, BRUSH_SIDE_GROUP)) - 1;
+        out1 = simd_mask(simd_gt(v1, zero)) & valid;
+        out2 = simd_mask(simd_gt(v2, zero)) & valid;
+
+        // if completely in front of face, no intersection
+        if (out1 & simd_mask(simd_ge(v2, v1)))
+            return;
+
+        if (out2)
+            getout = true;  // endpoint is not in solid
+        if (out1)
+            startout = true;
+
+        if (!(out1 | out2))
+            continue;
+
+        simd_store(d1, v1);
+        simd_store(d2, v2);
+
+        // crosses face
+        for (j = 0; j < BRUSH_SIDE_GROUP; j++) {
+            if (!((out1 | out2) & BIT(j)))
+                continue;
+
+            if (d1[j] > d2[j]) {
+                // enter
+                f = (d1[j] - DIST_EPSILON) / (d1[j] - d2[j]);
+                if (f > enterfrac) {
+                    side = brush->firstbrushside + i + j;
+                    enterfrac = f;
+                    clipplane = side->plane;
+                    leadside = side;
+                }
+            } else {
+                // leave
+                f = (d1[j] + DIST_EPSILON) / (d1[j] - d2[j]);
+                if (f < leavefrac)
+                    leavefrac = f;
+            }
+        }
+    }
+
+    CM_FinishClip(trace, brush, startout, getout, enterfrac, leavefrac, clipplane, leadside);
+}
+
+static void CM_TestBoxInBrush_SIMD(const vec3_t p1, trace_t *trace, mbrush_t *brush)
+{
+    const float     *g = brush->sideplanes;
+    const simd4f_t  zero = simd_splat(0);
+    simd4f_t        p1x = simd_splat(p1[0]), p1y = simd_splat(p1[1]), p1z = simd_splat(p1[2]);
+    simd4f_t        nx, ny, nz, dist, v1;
+    int             i, valid;
+
+    for (i = 0; i < brush->numsides; i += BRUSH_SIDE_GROUP, g += BRUSH_SIDE_FLOATS) {
+        nx = simd_load(g + 0 * BRUSH_SIDE_GROUP);
+        ny = simd_load(g + 1 * BRUSH_SIDE_GROUP);
+        nz = simd_load(g + 2 * BRUSH_SIDE_GROUP);
+        dist = CM_PushPlanes(nx, ny, nz, simd_load(g + 3 * BRUSH_SIDE_GROUP));
+
+        v1 = simd_plane_diff(p1x, p1y, p1z, nx, ny, nz, dist);
+
+        // if completely in front of face, no intersection
+        valid = BIT(min(brush->numsides - i, BRUSH_SIDE_GROUP)) - 1;
+        if (simd_mask(simd_gt(v1, zero)) & valid)
+            return;
+    }
+
+    // inside this brush
+    trace->startsolid = trace->allsolid = true;
+    trace->fraction = 0;
+    trace->contents = brush->contents;
+}
+
+#endif // USE_BRUSH_SIMD
+
 /*
 ================
 CM_ClipBoxToBrush
@@ -484,6 +735,13 @@ static void CM_ClipBoxToBrush(const vec3_t p1, const vec3_t p2, trace_t *trace,
     if (!brush->numsides)
         return;
 
+#if USE_BRUSH_SIMD
+    if (brush->sideplanes) {
+        CM_ClipBoxToBrush_SIMD(p1, p2, trace, brush);
+        return;
+    }
+#endif
+
     enterfrac = -1;
     leavefrac = 1;
     clipplane = NULL;
@@ -539,29 +797,7 @@ static void CM_ClipBoxToBrush(const vec3_t p1, const vec3_t p2, trace_t *trace,
         }
     }
 
-    if (!startout) {
-        // original point was inside brush
-        trace->startsolid = true;
-        if (!getout) {
-            trace->allsolid = true;
-            if (!map_allsolid_bug->integer) {
-                // original Q2 didn't set these
-                trace->fraction = 0;
-                trace->contents = brush->contents;
-            }
-        }
-        return;
-    }
-    if (enterfrac < leavefrac) {
-        if (enterfrac > -1 && enterfrac < trace->fraction) {
-            if (enterfrac < 0)
-                enterfrac = 0;
-            trace->fraction = enterfrac;
-            trace->plane = *clipplane;
-            trace->surface = &(leadside->texinfo->c);
-            trace->contents = brush->contents;
-        }
-    }
+    CM_FinishClip(trace, brush, startout, getout, enterfrac, leavefrac, clipplane, leadside);
 }
 
 /*
@@ -580,6 +816,13 @@ static void CM_TestBoxInBrush(const vec3_t p1, trace_t *trace, mbrush_t *brush)
     if (!brush->numsides)
         return;
 
+#if USE_BRUSH_SIMD
+    if (brush->sideplanes) {
+        CM_TestBoxInBrush_SIMD(p1, trace, brush);
+        return;
+    }
+#endif
+
     side = brush->firstbrushside;
     for (i = 0; i < brush->numsides; i++, side++) {
         plane = side->plane;
@@ -978,6 +1221,32 @@ bool CM_AreasConnected(cm_t *cm, int area1, int area2)
     return false;
 }
 
+/*
+=================
+CM_AreaFloodnum
+
+Returns flood number of the area. Two areas are connected if and only if
+their flood numbers are equal and positive. Returns -1 if area checking is
+disabled and every area is connected, 0 for invalid areas.
+=================
+*/
+int CM_AreaFloodnum(cm_t *cm, int area)
+{
+    bsp_t *cache = cm->cache;
+
+    if (!cache) {
+        return 0;
+    }
+    if (map_noareas->integer) {
+        return -1;
+    }
+    if (area < 1 || area >= cache->numareas) {
+        return 0;
+    }
+
+    return cm->floodnums[area];
+}
+
 /*
 =================
 CM_WriteAreaBits
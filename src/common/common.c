@@ -520,6 +520,9 @@ void Com_Error(error_type_t code, const char *fmt, ...)
     // fix up drity message buffers
     MSG_Init();
 
+    // don't leave packets queued by an aborted frame
+    NET_FlushSendBatch();
+
     // abort any console redirects
     Com_AbortRedirect();
 
@@ -0,0 +1,319 @@
+/*
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "shared/shared.h"
+#include "common/common.h"
+#include "common/demoidx.h"
+#include "common/files.h"
+#include "common/intreadwrite.h"
+#include "common/protocol.h"
+
+#if USE_ZLIB
+#include <zlib.h>
+#endif
+
+/*
+Seek index file layout, all values little endian:
+
+header:
+    uint32  ident
+    uint32  version
+    int64   demo file size
+    int64   demo modification time
+    uint32  number of snapshots
+
+followed by snapshots, grouped by segment and sorted by frame number:
+    int64   segment
+    int32   frame number
+    int64   demo file position
+    uint32  message length
+    uint32  stored length, message is deflated if less than message length
+    byte    data[stored length]
+*/
+
+#define IDX_IDENT       MakeLittleLong('D','I','D','X')
+#define IDX_VERSION     1
+
+#define IDX_HEADERSIZE  28
+#define IDX_ENTRYSIZE   28
+
+#define IDX_EXTENSION   ".idx"
+
+#define MIN_SNAPSHOTS   64
+
+typedef struct {
+    int64_t     segment;
+    int         framenum;
+    int64_t     filepos;
+    uint32_t    msglen;
+    uint32_t    complen;
+    const byte  *data;
+} idxentry_t;
+
+// demo file must be a real file, demos in packs are never indexed
+static bool get_demo_stamp(const char *demopath, int64_t *size, uint64_t *mtime)
+{
+    qhandle_t f;
+
+    *size = FS_OpenFile(demopath, &f, FS_MODE_READ | FS_TYPE_REAL);
+    if (!f)
+        return false;
+    FS_CloseFile(f);
+
+    return FS_LastModified(demopath, mtime) == Q_ERR_SUCCESS;
+}
+
+static bool get_index_path(char *buffer, size_t size, const char *demopath)
+{
+    return Q_concat(buffer, size, demopath, IDX_EXTENSION) < size;
+}
+
+// returns number of entries if header is valid and matches the demo
+static int check_header(const byte *buf, size_t len, int64_t size, uint64_t mtime)
+{
+    if (len < IDX_HEADERSIZE)
+        return -1;
+    if (RL32(buf) != IDX_IDENT || RL32(buf + 4) != IDX_VERSION)
+        return -1;
+    if (RL64(buf + 8) != size || RL64(buf + 16) != mtime)
+        return -1;
+
+    return min(RL32(buf + 24), INT_MAX);
+}
+
+static const byte *read_entry(const byte *p, const byte *end, idxentry_t *e)
+{
+    if (end - p < IDX_ENTRYSIZE)
+        return NULL;
+
+    e->segment = RL64(p);
+    e->framenum = RL32(p + 8);
+    e->filepos = RL64(p + 12);
+    e->msglen = RL32(p + 20);
+    e->complen = RL32(p + 24);
+    e->data = p + IDX_ENTRYSIZE;
+
+    if (e->msglen > MAX_MSGLEN || e->complen > e->msglen)
+        return NULL;
+    if (end - e->data < e->complen)
+        return NULL;
+
+    return e->data + e->complen;
+}
+
+static demosnap_t *unpack_entry(const idxentry_t *e, memtag_t tag)
+{
+    demosnap_t *snap = Z_TagMalloc(sizeof(*snap) + e->msglen - 1, tag);
+
+    snap->framenum = e->framenum;
+    snap->filepos = e->filepos;
+    snap->msglen = e->msglen;
+
+    if (e->complen == e->msglen) {
+        memcpy(snap->data, e->data, e->msglen);
+        return snap;
+    }
+
+#if USE_ZLIB
+    uLongf len = e->msglen;
+    if (uncompress(snap->data, &len, e->data, e->complen) == Z_OK && len == e->msglen)
+        return snap;
+#endif
+
+    Z_Free(snap);
+    return NULL;
+}
+
+/*
+=================
+Com_LoadDemoIndex
+=================
+*/
+int Com_LoadDemoIndex(const char *demopath, int64_t segment,
+                      demosnap_t ***snapshots, memtag_t tag)
+{
+    char path[MAX_OSPATH];
+    demosnap_t **list = NULL, *snap;
+    const byte *p, *end;
+    byte *buf;
+    idxentry_t e;
+    int64_t size;
+    uint64_t mtime;
+    int i, count, ret, num = 0;
+
+    *snapshots = NULL;
+
+    if (!get_index_path(path, sizeof(path), demopath))
+        return 0;
+
+    if (!get_demo_stamp(demopath, &size, &mtime))
+        return 0;
+
+    ret = FS_LoadFile(path, (void **)&buf);
+    if (!buf)
+        return 0;
+
+    count = check_header(buf, ret, size, mtime);
+    if (count < 0) {
+        Com_DPrintf("%s is stale\n", path);
+        goto done;
+    }
+
+    p = buf + IDX_HEADERSIZE;
+    end = buf + ret;
+    for (i = 0; i < count; i++) {
+        p = read_entry(p, end, &e);
+        if (!p)
+            goto fail;
+        if (e.segment != segment)
+            continue;
+        if (num && e.framenum <= list[num - 1]->framenum)
+            goto fail;
+
+        snap = unpack_entry(&e, tag);
+        if (!snap)
+            goto fail;
+
+        list = Z_Realloc(list, sizeof(list[0]) * ALIGN(num + 1, MIN_SNAPSHOTS));
+        list[num++] = snap;
+    }
+
+    Com_DPrintf("Loaded %d snapshots from %s\n", num, path);
+    *snapshots = list;
+    goto done;
+
+fail:
+    Com_WPrintf("%s is corrupted\n", path);
+    for (i = 0; i < num; i++)
+        Z_Free(list[i]);
+    Z_Free(list);
+    num = 0;
+
+done:
+    FS_FreeFile(buf);
+    return num;
+}
+
+static void write_entry(qhandle_t f, const idxentry_t *e)
+{
+    byte header[IDX_ENTRYSIZE];
+
+    WL64(header, e->segment);
+    WL32(header + 8, e->framenum);
+    WL64(header + 12, e->filepos);
+    WL32(header + 20, e->msglen);
+    WL32(header + 24, e->complen);
+
+    FS_Write(header, sizeof(header), f);
+    FS_Write(e->data, e->complen, f);
+}
+
+/*
+=================
+Com_SaveDemoIndex
+=================
+*/
+void Com_SaveDemoIndex(const char *demopath, int64_t segment,
+                       demosnap_t **snapshots, int numsnapshots)
+{
+    char path[MAX_OSPATH];
+    byte header[IDX_HEADERSIZE];
+    const byte *p, *end = NULL;
+    byte *buf, *temp = NULL;
+    idxentry_t e;
+    qhandle_t f;
+    int64_t size;
+    uint64_t mtime;
+    int i, count, other, ret;
+
+    if (!get_index_path(path, sizeof(path), demopath))
+        return;
+
+    if (!get_demo_stamp(demopath, &size, &mtime))
+        return;
+
+    // keep other segments of an up to date index
+    ret = FS_LoadFile(path, (void **)&buf);
+    count = -1;
+    if (buf) {
+        count = check_header(buf, ret, size, mtime);
+        end = buf + ret;
+    }
+
+    other = 0;
+    for (i = 0, p = buf + IDX_HEADERSIZE; i < count; i++) {
+        p = read_entry(p, end, &e);
+        if (!p) {
+            count = i;
+            break;
+        }
+        if (e.segment != segment)
+            other++;
+    }
+
+    FS_OpenFile(path, &f, FS_MODE_WRITE);
+    if (!f)
+        goto done;
+
+    WL32(header, IDX_IDENT);
+    WL32(header + 4, IDX_VERSION);
+    WL64(header + 8, size);
+    WL64(header + 16, mtime);
+    WL32(header + 24, other + numsnapshots);
+    FS_Write(header, sizeof(header), f);
+
+    for (i = 0, p = buf + IDX_HEADERSIZE; i < count; i++) {
+        p = read_entry(p, end, &e);
+        if (e.segment != segment)
+            write_entry(f, &e);
+    }
+
+#if USE_ZLIB
+    temp = FS_AllocTempMem(compressBound(MAX_MSGLEN));
+#endif
+
+    for (i = 0; i < numsnapshots; i++) {
+        demosnap_t *snap = snapshots[i];
+
+        e.segment = segment;
+        e.framenum = snap->framenum;
+        e.filepos = snap->filepos;
+        e.msglen = snap->msglen;
+        e.complen = snap->msglen;
+        e.data = snap->data;
+
+#if USE_ZLIB
+        uLongf len = compressBound(snap->msglen);
+        if (compress2(temp, &len, snap->data, snap->msglen, Z_BEST_SPEED) == Z_OK && len < snap->msglen) {
+            e.complen = len;
+            e.data = temp;
+        }
+#endif
+
+        write_entry(f, &e);
+    }
+
+    FS_FreeTempMem(temp);
+
+    ret = FS_CloseFile(f);
+    if (ret)
+        Com_EPrintf("Couldn't write %s: %s\n", path, Q_ErrorString(ret));
+    else
+        Com_DPrintf("Wrote %d snapshots to %s\n", numsnapshots, path);
+
+done:
+    FS_FreeFile(buf);
+}
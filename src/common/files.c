@@ -139,6 +139,9 @@ typedef struct {
     filetype_t  type;       // FS_PAK or FS_ZIP
     unsigned    refcount;   // for tracking pack users
     FILE        *fp;
+    byte        *data;      // read-only mapping of entire file, or NULL
+    size_t      size;       // size of mapping
+    list_t      entry;      // link in fs_mapped_packs
     unsigned    num_files;
     unsigned    hash_size;
     packfile_t  *files;
@@ -151,9 +154,27 @@ typedef struct searchpath_s {
     struct searchpath_s *next;
     pack_t      *pack;        // only one of filename / pack will be used
     unsigned    mode;
+    bool        indexed;      // all files are in fs_index
     char        filename[1];
 } searchpath_t;
 
+// entry of the global file index, one per file in each pack and indexed
+// directory tree
+typedef struct fsindex_s {
+    struct fsindex_s *next;
+    searchpath_t    *search;
+    packfile_t      *entry;     // NULL for files in directory tree
+    const char      *name;
+    unsigned        hash;
+    unsigned        namelen;
+} fsindex_t;
+
+typedef struct fsindexblock_s {
+    struct fsindexblock_s *next;
+    int             count;
+    fsindex_t       nodes[1];
+} fsindexblock_t;
+
 typedef struct {
     filetype_t  type;
     unsigned    mode;
@@ -163,6 +184,7 @@ typedef struct {
 #endif
     packfile_t  *entry;     // pack entry this handle is tied to
     pack_t      *pack;      // points to the pack entry is from
+    const byte  *data;      // entry data if pack is mapped
     int         error;      // stream error indicator from read/write operation
     int64_t     position;   // reading position for FS_PAK/FS_ZIP
     int64_t     length;     // total cached file length
@@ -191,23 +213,42 @@ static int          fs_num_files;
 
 static bool         fs_non_uniq_open;
 
+static list_t       fs_mapped_packs;
+
+static fsindex_t        **fs_index;
+static unsigned         fs_index_size;
+static fsindexblock_t   *fs_index_blocks;
+static unsigned         fs_index_nodes;
+static bool             fs_index_valid;
+
 #if USE_DEBUG
 static int          fs_count_read;
 static int          fs_count_open;
 static int          fs_count_strcmp;
 static int          fs_count_strlwr;
+static int          fs_count_index;
+static int          fs_count_negative;
+static int          fs_count_stale;
 #define FS_COUNT_READ       fs_count_read++
 #define FS_COUNT_OPEN       fs_count_open++
 #define FS_COUNT_STRCMP     fs_count_strcmp++
 #define FS_COUNT_STRLWR     fs_count_strlwr++
+#define FS_COUNT_INDEX      fs_count_index++
+#define FS_COUNT_NEGATIVE   fs_count_negative++
+#define FS_COUNT_STALE      fs_count_stale++
 #else
 #define FS_COUNT_READ       (void)0
 #define FS_COUNT_OPEN       (void)0
 #define FS_COUNT_STRCMP     (void)0
 #define FS_COUNT_STRLWR     (void)0
+#define FS_COUNT_INDEX      (void)0
+#define FS_COUNT_NEGATIVE   (void)0
+#define FS_COUNT_STALE      (void)0
 #endif
 
 static cvar_t       *fs_autoexec;
+static cvar_t       *fs_mmap;
+static cvar_t       *fs_index_enable;
 
 #if USE_DEBUG
 static cvar_t       *fs_debug;
@@ -543,7 +584,7 @@ static int seek_pak_file(file_t *file, int64_t offset, int whence)
     if (entry->filepos > INT64_MAX - offset)
         return Q_ERR(EOVERFLOW);
 
-    if (os_fseek(file->fp, entry->filepos + offset, SEEK_SET))
+    if (!file->data && os_fseek(file->fp, entry->filepos + offset, SEEK_SET))
         return Q_ERRNO;
 
     file->position = offset;
@@ -587,6 +628,187 @@ int FS_Seek(qhandle_t f, int64_t offset, int whence)
     }
 }
 
+/*
+============================================================================
+
+FILE INDEX
+
+All files from every pack and directory tree in the search path are hashed
+into a single table, so that open_file_read() can find all places a file
+exists at with one probe. Directory trees are listed once when the index
+is built, files created later through this module are added as they are
+written. A file missing from the index for a directory tree is assumed not
+to exist there, so failed lookups don't cost any syscalls.
+
+Files created behind the back of the filesystem require `fs_restart'.
+
+============================================================================
+*/
+
+static fsindexblock_t *alloc_index_block(int count)
+{
+    fsindexblock_t *block;
+
+    block = FS_Malloc(sizeof(*block) + sizeof(block->nodes[0]) * (count - 1));
+    block->count = count;
+    block->next = fs_index_blocks;
+    fs_index_blocks = block;
+
+    return block;
+}
+
+static void link_index_node(fsindex_t *node, searchpath_t *search,
+                            packfile_t *entry, const char *name)
+{
+    unsigned hash = FS_HashPath(name, 0);
+
+    node->search = search;
+    node->entry = entry;
+    node->name = name;
+    node->hash = hash;
+    node->namelen = strlen(name);
+    node->next = fs_index[hash & (fs_index_size - 1)];
+    fs_index[hash & (fs_index_size - 1)] = node;
+    fs_index_nodes++;
+}
+
+static void free_index(void)
+{
+    fsindexblock_t *block, *next;
+    int i;
+
+    for (block = fs_index_blocks; block; block = next) {
+        next = block->next;
+        for (i = 0; i < block->count; i++) {
+            if (!block->nodes[i].entry) {
+                Z_Free((char *)block->nodes[i].name);
+            }
+        }
+        Z_Free(block);
+    }
+
+    Z_Free(fs_index);
+    fs_index = NULL;
+    fs_index_size = 0;
+    fs_index_blocks = NULL;
+    fs_index_nodes = 0;
+    fs_index_valid = false;
+}
+
+static void build_index(void)
+{
+    searchpath_t    *search;
+    listfiles_t     *lists;
+    fsindexblock_t  *block;
+    pack_t          *pack;
+    unsigned        i, n, count, total;
+
+    free_index();
+
+    for (n = 0, search = fs_searchpaths; search; search = search->next) {
+        n++;
+    }
+
+    // list directory trees first to find out total number of files
+    lists = FS_Mallocz(sizeof(lists[0]) * (n + 1));
+    total = 0;
+    for (n = 0, search = fs_searchpaths; search; search = search->next, n++) {
+        if (search->pack) {
+            total += search->pack->num_files;
+            continue;
+        }
+        lists[n].flags = FS_SEARCH_RECURSIVE | FS_SEARCH_SAVEPATH;
+        lists[n].baselen = strlen(search->filename) + 1;
+        Sys_ListFiles_r(&lists[n], search->filename, 0);
+        search->indexed = lists[n].count < MAX_LISTED_FILES;
+        total += lists[n].count;
+    }
+
+    fs_index_size = 1024;
+    while (fs_index_size < total) {
+        fs_index_size <<= 1;
+    }
+    fs_index = FS_Mallocz(sizeof(fs_index[0]) * fs_index_size);
+
+    for (n = 0, search = fs_searchpaths; search; search = search->next, n++) {
+        if (search->pack) {
+            pack = search->pack;
+            count = pack->num_files;
+        } else {
+            pack = NULL;
+            count = lists[n].count;
+        }
+        if (!count) {
+            continue;
+        }
+        block = alloc_index_block(count);
+        for (i = 0; i < count; i++) {
+            if (pack) {
+                link_index_node(&block->nodes[i], search, &pack->files[i],
+                                pack->names + pack->files[i].nameofs);
+            } else {
+                // index takes ownership of the name
+                link_index_node(&block->nodes[i], search, NULL, lists[n].files[i]);
+            }
+        }
+        Z_Free(lists[n].files);
+    }
+
+    Z_Free(lists);
+
+    fs_index_valid = true;
+    FS_DPrintf("%s: %u files, %u buckets\n", __func__, fs_index_nodes, fs_index_size);
+}
+
+static void invalidate_index(void)
+{
+    if (fs_index_valid) {
+        free_index();
+    }
+}
+
+static fsindex_t *find_index_node(searchpath_t *search, const char *name, unsigned hash)
+{
+    fsindex_t *node;
+
+    for (node = fs_index[hash & (fs_index_size - 1)]; node; node = node->next) {
+        if (node->search == search && node->hash == hash && !strcmp(node->name, name)) {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+// adds newly created file to the index, expects full system path
+static void index_created_file(const char *path)
+{
+    searchpath_t    *search;
+    const char      *name;
+    size_t          len;
+
+    if (!fs_index_valid) {
+        return;
+    }
+
+    for (search = fs_searchpaths; search; search = search->next) {
+        if (search->pack || !search->indexed) {
+            continue;
+        }
+        len = strlen(search->filename);
+        if (strncmp(path, search->filename, len) || path[len] != '/') {
+            continue;
+        }
+
+        name = path + len + 1;
+        if (!*name || find_index_node(search, name, FS_HashPath(name, 0))) {
+            continue;
+        }
+
+        link_index_node(&alloc_index_block(1)->nodes[0], search, NULL, FS_CopyString(name));
+    }
+}
+
 /*
 ============
 FS_CreatePath
@@ -637,6 +859,7 @@ int FS_CreatePath(char *path)
         }
     }
 
+    index_created_file(path);
     return Q_ERR_SUCCESS;
 }
 
@@ -661,9 +884,10 @@ int FS_CloseFile(qhandle_t f)
         break;
     case FS_PAK:
         if (IS_UNIQUE(file)) {
-            fclose(file->fp);
+            if (file->fp)
+                fclose(file->fp);
             pack_put(file->pack);
-        } else {
+        } else if (!file->data) {
             fs_non_uniq_open = false;
         }
         break;
@@ -927,14 +1151,8 @@ fail:
 
 #if USE_ZLIB
 
-static int check_header_coherency(FILE *fp, packfile_t *entry)
+static int check_entry_coherency(const packfile_t *entry)
 {
-    unsigned ofs, flags, comp_mtd, comp_len, file_len, name_size, xtra_size;
-    byte header[ZIP_SIZELOCALHEADER];
-
-    if (entry->coherent)
-        return Q_ERR_SUCCESS;
-
     if (entry->filelen < 0 || entry->complen < 0 || entry->filepos < 0)
         return Q_ERR_NOT_COHERENT;
     if (entry->compmtd == 0 && entry->filelen != entry->complen)
@@ -942,10 +1160,13 @@ static int check_header_coherency(FILE *fp, packfile_t *entry)
     if (entry->compmtd != 0 && entry->compmtd != Z_DEFLATED)
         return Q_ERR_BAD_COMPRESSION;
 
-    if (os_fseek(fp, entry->filepos, SEEK_SET))
-        return Q_ERRNO;
-    if (!fread(header, sizeof(header), 1, fp))
-        return FS_ERR_READ(fp);
+    return Q_ERR_SUCCESS;
+}
+
+// validates local file header and returns position of file data
+static int check_local_header(const packfile_t *entry, const byte *header, int64_t *pos)
+{
+    unsigned ofs, flags, comp_mtd, comp_len, file_len, name_size, xtra_size;
 
     // check the magic
     if (RL32(&header[0]) != ZIP_LOCALHEADERMAGIC)
@@ -974,11 +1195,58 @@ static int check_header_coherency(FILE *fp, packfile_t *entry)
     if (entry->filepos > INT64_MAX - ofs)
         return Q_ERR(EOVERFLOW);
 
-    entry->filepos += ofs;
+    *pos = entry->filepos + ofs;
+    return Q_ERR_SUCCESS;
+}
+
+static int check_header_coherency(FILE *fp, packfile_t *entry)
+{
+    byte header[ZIP_SIZELOCALHEADER];
+    int64_t pos;
+    int ret;
+
+    if (entry->coherent)
+        return Q_ERR_SUCCESS;
+
+    ret = check_entry_coherency(entry);
+    if (ret)
+        return ret;
+
+    if (os_fseek(fp, entry->filepos, SEEK_SET))
+        return Q_ERRNO;
+    if (!fread(header, sizeof(header), 1, fp))
+        return FS_ERR_READ(fp);
+
+    ret = check_local_header(entry, header, &pos);
+    if (ret)
+        return ret;
+
+    entry->filepos = pos;
     entry->coherent = true;
     return Q_ERR_SUCCESS;
 }
 
+// mapped packs may be read from several threads at once,
+// so the entry is never modified and header is checked on each open
+static int check_mapped_coherency(const pack_t *pack, const packfile_t *entry, int64_t *pos)
+{
+    int ret;
+
+    if (entry->coherent) {
+        *pos = entry->filepos;
+        return Q_ERR_SUCCESS;
+    }
+
+    ret = check_entry_coherency(entry);
+    if (ret)
+        return ret;
+
+    if (entry->filepos > (int64_t)pack->size - ZIP_SIZELOCALHEADER)
+        return Q_ERR_NOT_COHERENT;
+
+    return check_local_header(entry, pack->data + entry->filepos, pos);
+}
+
 static voidpf FS_zalloc(voidpf opaque, uInt items, uInt size)
 {
     return FS_Malloc(items * size);
@@ -1026,7 +1294,8 @@ static void close_zip_file(file_t *file)
     inflateEnd(&s->stream);
     Z_Free(s);
 
-    fclose(file->fp);
+    if (file->fp)
+        fclose(file->fp);
 }
 
 static int read_zip_file(file_t *file, void *buf, size_t len)
@@ -1050,19 +1319,27 @@ static int read_zip_file(file_t *file, void *buf, size_t len)
                 break;
             }
 
-            // fill in the temp buffer
-            block = min(s->rest_in, ZIP_BUFSIZE);
-            result = fread(s->buffer, 1, block, file->fp);
-            if (result != block) {
-                file->error = FS_ERR_READ(file->fp);
-                if (!result) {
-                    break;
+            if (file->data) {
+                // inflate straight from the mapping
+                block = min(s->rest_in, UINT_MAX);
+                z->next_in = (Bytef *)file->data + file->entry->complen - s->rest_in;
+                z->avail_in = block;
+                s->rest_in -= block;
+            } else {
+                // fill in the temp buffer
+                block = min(s->rest_in, ZIP_BUFSIZE);
+                result = fread(s->buffer, 1, block, file->fp);
+                if (result != block) {
+                    file->error = FS_ERR_READ(file->fp);
+                    if (!result) {
+                        break;
+                    }
                 }
-            }
 
-            s->rest_in -= result;
-            z->next_in = s->buffer;
-            z->avail_in = result;
+                s->rest_in -= result;
+                z->next_in = s->buffer;
+                z->avail_in = result;
+            }
         }
 
         ret = inflate(z, Z_SYNC_FLUSH);
@@ -1099,7 +1376,7 @@ static int seek_zip_file(file_t *file, int64_t offset, int whence)
         return offset;
 
     if (offset < file->position) {
-        if (os_fseek(file->fp, entry->filepos, SEEK_SET))
+        if (!file->data && os_fseek(file->fp, entry->filepos, SEEK_SET))
             return Q_ERRNO;
 
         inflateReset(z);
@@ -1126,52 +1403,81 @@ static int seek_zip_file(file_t *file, int64_t offset, int whence)
 }
 
 #define entry_compmtd(entry)  ((entry)->compmtd)
+#define entry_complen(entry)  ((entry)->complen)
 #else
 #define entry_compmtd(entry)  0
+#define entry_complen(entry)  ((entry)->filelen)
 #endif
 
 // open a new file on the pakfile
 static int64_t open_from_pack(file_t *file, pack_t *pack, packfile_t *entry)
 {
-    FILE *fp;
+    FILE *fp = NULL;
+    int64_t pos = entry->filepos;
+    bool shared;
     int ret;
 
-    if (IS_UNIQUE(file)) {
-        fp = fopen(pack->filename, "rb");
-        if (!fp) {
-            ret = Q_ERRNO;
+    // non-unique handles share pack file pointer and zip stream,
+    // mapped packs only need the latter for compressed entries
+    shared = !IS_UNIQUE(file);
+    if (shared && pack->data) {
+        shared = entry_compmtd(entry) && !(file->mode & FS_FLAG_DEFLATE);
+    }
+
+    if (shared && fs_non_uniq_open) {
+        ret = Q_ERR(EBUSY);
+        goto fail1;
+    }
+
+    if (pack->data) {
+#if USE_ZLIB
+        if (pack->type == FS_ZIP) {
+            ret = check_mapped_coherency(pack, entry, &pos);
+            if (ret) {
+                goto fail1;
+            }
+        }
+#endif
+        if (pos > (int64_t)pack->size - entry_complen(entry)) {
+            ret = Q_ERR_UNEXPECTED_EOF;
             goto fail1;
         }
     } else {
-        if (fs_non_uniq_open) {
-            ret = Q_ERR(EBUSY);
-            goto fail1;
+        if (IS_UNIQUE(file)) {
+            fp = fopen(pack->filename, "rb");
+            if (!fp) {
+                ret = Q_ERRNO;
+                goto fail1;
+            }
+        } else {
+            fp = pack->fp;
+            clearerr(fp);
         }
-        fp = pack->fp;
-        clearerr(fp);
-    }
 
 #if USE_ZLIB
-    if (pack->type == FS_ZIP) {
-        ret = check_header_coherency(fp, entry);
-        if (ret) {
-            goto fail2;
+        if (pack->type == FS_ZIP) {
+            ret = check_header_coherency(fp, entry);
+            if (ret) {
+                goto fail2;
+            }
+            pos = entry->filepos;
         }
-    }
 #endif
+    }
 
     if ((file->mode & FS_FLAG_DEFLATE) && !entry_compmtd(entry)) {
         ret = Q_ERR_BAD_COMPRESSION;
         goto fail2;
     }
 
-    if (os_fseek(fp, entry->filepos, SEEK_SET)) {
+    if (fp && os_fseek(fp, pos, SEEK_SET)) {
         ret = Q_ERRNO;
         goto fail2;
     }
 
     file->type = pack->type;
     file->fp = fp;
+    file->data = pack->data ? pack->data + pos : NULL;
     file->entry = entry;
     file->pack = pack;
     file->error = Q_ERR_SUCCESS;
@@ -1196,7 +1502,7 @@ static int64_t open_from_pack(file_t *file, pack_t *pack, packfile_t *entry)
     if (IS_UNIQUE(file)) {
         // reference source pak
         pack_get(pack);
-    } else {
+    } else if (shared) {
         fs_non_uniq_open = true;
     }
 
@@ -1206,7 +1512,7 @@ static int64_t open_from_pack(file_t *file, pack_t *pack, packfile_t *entry)
     return file->length;
 
 fail2:
-    if (IS_UNIQUE(file)) {
+    if (fp && IS_UNIQUE(file)) {
         fclose(fp);
     }
 fail1:
@@ -1361,6 +1667,76 @@ int FS_LastModified(char const * file, uint64_t * last_modified)
     return Q_ERR_INVALID_PATH;
 }
 
+#define MAX_INDEX_HITS  32
+
+typedef struct {
+    fsindex_t   *nodes[MAX_INDEX_HITS];
+    int         count;
+} indexhits_t;
+
+// finds all places the file exists at according to the index,
+// returns false if index can't be used for this lookup
+static bool lookup_index(indexhits_t *hits, const char *normalized,
+                         size_t namelen, unsigned hash)
+{
+    fsindex_t   *node;
+    const char  *s;
+    int         depth;
+
+    hits->count = 0;
+
+    if (!fs_index_enable->integer) {
+        return false;
+    }
+
+    // dotfiles and too deep paths are never listed
+    if (*normalized == '.') {
+        return false;
+    }
+    for (s = normalized, depth = 0; *s; s++) {
+        if (*s == '/') {
+            if (s[1] == '.' || ++depth > MAX_LISTED_DEPTH) {
+                return false;
+            }
+        }
+    }
+
+    if (!fs_index_valid) {
+        build_index();
+    }
+
+    FS_COUNT_INDEX;
+
+    for (node = fs_index[hash & (fs_index_size - 1)]; node; node = node->next) {
+        if (node->hash != hash || node->namelen != namelen) {
+            continue;
+        }
+        FS_COUNT_STRCMP;
+        if (FS_pathcmp(node->name, normalized)) {
+            continue;
+        }
+        if (hits->count == MAX_INDEX_HITS) {
+            return false;
+        }
+        hits->nodes[hits->count++] = node;
+    }
+
+    return true;
+}
+
+static fsindex_t *find_index_hit(const indexhits_t *hits, const searchpath_t *search)
+{
+    int i;
+
+    for (i = 0; i < hits->count; i++) {
+        if (hits->nodes[i]->search == search) {
+            return hits->nodes[i];
+        }
+    }
+
+    return NULL;
+}
+
 // Finds the file in the search path.
 // Fills file_t and returns file length.
 // Used for streaming data out of either a pak file or a seperate file.
@@ -1371,6 +1747,9 @@ static int64_t open_file_read(file_t *file, const char *normalized, size_t namel
     pack_t          *pak;
     unsigned        hash;
     packfile_t      *entry;
+    fsindex_t       *node;
+    indexhits_t     hits;
+    bool            indexed;
     int64_t         ret;
     int             valid;
 
@@ -1381,6 +1760,8 @@ static int64_t open_file_read(file_t *file, const char *normalized, size_t namel
 
     hash = FS_HashPath(normalized, 0);
 
+    indexed = lookup_index(&hits, normalized, namelen, hash);
+
     valid = PATH_NOT_CHECKED;
 
 // search through the path, one element at a time
@@ -1401,6 +1782,13 @@ static int64_t open_file_read(file_t *file, const char *normalized, size_t namel
                 continue;
             }
             pak = search->pack;
+            if (indexed) {
+                node = find_index_hit(&hits, search);
+                if (node) {
+                    return open_from_pack(file, pak, node->entry);
+                }
+                continue;
+            }
             // look through all the pak file elements
             entry = pak->file_hash[hash & (pak->hash_size - 1)];
             for (; entry; entry = entry->hash_next) {
@@ -1426,6 +1814,11 @@ static int64_t open_file_read(file_t *file, const char *normalized, size_t namel
             if (valid == PATH_INVALID) {
                 continue;
             }
+            // don't touch the disk if index says there is no such file
+            if (indexed && search->indexed && !find_index_hit(&hits, search)) {
+                FS_COUNT_NEGATIVE;
+                continue;
+            }
             // check a file in the directory tree
             if (Q_concat(fullpath, sizeof(fullpath), search->filename,
                          "/", normalized) >= sizeof(fullpath)) {
@@ -1447,6 +1840,9 @@ static int64_t open_file_read(file_t *file, const char *normalized, size_t namel
                     return ret;
             }
 #endif
+            if (indexed && search->indexed) {
+                FS_COUNT_STALE;
+            }
         }
     }
 
@@ -1499,6 +1895,12 @@ static int read_pak_file(file_t *file, void *buf, size_t len)
         return 0;
     }
 
+    if (file->data) {
+        memcpy(buf, file->data + file->position, len);
+        file->position += len;
+        return len;
+    }
+
     result = fread(buf, 1, len, file->fp);
     if (result != len) {
         file->error = FS_ERR_READ(file->fp);
@@ -1850,6 +2252,9 @@ FS_LoadFile
 
 opens non-unique file handle as an optimization
 a NULL buffer will just return the file length without loading
+
+with FS_FLAG_MAPPED, uncompressed pack entries may be returned as a
+pointer into the pack mapping, which is read-only and not NUL terminated
 ============
 */
 int FS_LoadFileEx(const char *path, void **buffer, unsigned flags, memtag_t tag)
@@ -1895,6 +2300,14 @@ int FS_LoadFileEx(const char *path, void **buffer, unsigned flags, memtag_t tag)
         goto done;
     }
 
+    // hand out stored data directly from the mapping
+    if ((flags & FS_FLAG_MAPPED) && file->type == FS_PAK && file->data &&
+        !((uintptr_t)file->data & 3)) {
+        *buffer = (void *)file->data;
+        pack_get(file->pack);
+        goto done;
+    }
+
     // allocate chunk of memory, +1 for NUL
     buf = Z_TagMalloc(len + 1, tag);
 
@@ -1914,6 +2327,31 @@ done:
     return len;
 }
 
+/*
+============
+FS_FreeFile
+
+Frees buffer returned by FS_LoadFile, which may point into a mapped pack.
+============
+*/
+void FS_FreeFile(void *buf)
+{
+    pack_t *pack;
+
+    if (!buf) {
+        return;
+    }
+
+    LIST_FOR_EACH(pack_t, pack, &fs_mapped_packs, entry) {
+        if ((byte *)buf >= pack->data && (byte *)buf < pack->data + pack->size) {
+            pack_put(pack);
+            return;
+        }
+    }
+
+    Z_Free(buf);
+}
+
 static int write_and_close(const void *data, size_t len, qhandle_t f)
 {
     int ret1 = FS_Write(data, len, f);
@@ -2006,6 +2444,7 @@ int FS_RenameFile(const char *from, const char *to)
     if (rename(frompath, topath))
         return Q_ERRNO;
 
+    index_created_file(topath);
     return Q_ERR_SUCCESS;
 }
 
@@ -2035,6 +2474,10 @@ int FS_FPrintf(qhandle_t f, const char *format, ...)
 
 static void pack_free(pack_t *pack)
 {
+    if (pack->data) {
+        List_Remove(&pack->entry);
+        Sys_UnmapFile(pack->data, pack->size);
+    }
     fclose(pack->fp);
     Z_Free(pack->names);
     Z_Free(pack->file_hash);
@@ -2072,6 +2515,8 @@ static pack_t *pack_alloc(FILE *fp, filetype_t type, const char *name,
     pack->type = type;
     pack->refcount = 0;
     pack->fp = fp;
+    pack->data = NULL;
+    pack->size = 0;
     pack->num_files = num_files;
     pack->files = FS_Malloc(num_files * sizeof(pack->files[0]));
     pack->hash_size = 0;
@@ -2082,6 +2527,23 @@ static pack_t *pack_alloc(FILE *fp, filetype_t type, const char *name,
     return pack;
 }
 
+// maps entire pack file so that entries can be read without seeking
+// through shared file pointer, and stored ones without copying
+static void pack_map(pack_t *pack)
+{
+    if (!fs_mmap->integer) {
+        return;
+    }
+
+    pack->data = Sys_MapFile(pack->filename, &pack->size, false);
+    if (!pack->data) {
+        FS_DPrintf("%s: couldn't map %s\n", __func__, pack->filename);
+        return;
+    }
+
+    List_Append(&fs_mapped_packs, &pack->entry);
+}
+
 // allocates hash table and inserts all filenames into it
 static void pack_calc_hashes(pack_t *pack)
 {
@@ -2192,9 +2654,11 @@ static pack_t *load_pak_file(const char *packfile)
     }
 
     pack_calc_hashes(pack);
+    pack_map(pack);
 
-    FS_DPrintf("%s: %u files, %u hash\n",
-               packfile, pack->num_files, pack->hash_size);
+    FS_DPrintf("%s: %u files, %u hash%s\n",
+               packfile, pack->num_files, pack->hash_size,
+               pack->data ? ", mapped" : "");
 
     FS_FreeTempMem(info);
     return pack;
@@ -2510,10 +2974,12 @@ static pack_t *load_zip_file(const char *packfile)
     pack->names = Z_Realloc(pack->names, names_len);
 
     pack_calc_hashes(pack);
+    pack_map(pack);
 
-    FS_DPrintf("%s: %u files, %u skipped, %u hash%s\n",
+    FS_DPrintf("%s: %u files, %u skipped, %u hash%s%s\n",
                packfile, pack->num_files, (int)(num_files_cd - num_files),
-               pack->hash_size, zip64 ? ", zip64" : "");
+               pack->hash_size, zip64 ? ", zip64" : "",
+               pack->data ? ", mapped" : "");
 
     return pack;
 
@@ -2617,6 +3083,7 @@ static void q_printf(2, 3) add_game_dir(unsigned mode, const char *fmt, ...)
         }
         search = FS_Malloc(sizeof(*search));
         search->mode = mode;
+        search->indexed = false;
         search->filename[0] = 0;
         search->pack = pack_get(pack);
         search->next = fs_searchpaths;
@@ -2631,10 +3098,13 @@ static void q_printf(2, 3) add_game_dir(unsigned mode, const char *fmt, ...)
 	// the directory has priority over the pak files
 	search = FS_Malloc(sizeof(*search) + len);
 	search->mode = mode;
+	search->indexed = false;
 	search->pack = NULL;
 	memcpy(search->filename, fs_gamedir, len + 1);
 	search->next = fs_searchpaths;
 	fs_searchpaths = search;
+
+	invalidate_index();
 }
 
 /*
@@ -3270,6 +3740,13 @@ static void FS_Stats_f(void)
     int i;
     int len, maxLen = 0;
     int totalHashSize, totalLen;
+    int numMapped = 0;
+    size_t sizeMapped = 0;
+
+    LIST_FOR_EACH(pack_t, pack, &fs_mapped_packs, entry) {
+        sizeMapped += pack->size;
+        numMapped++;
+    }
 
     totalHashSize = totalLen = 0;
     for (path = fs_searchpaths; path; path = path->next) {
@@ -3300,6 +3777,12 @@ static void FS_Stats_f(void)
     Com_Printf("Total path comparsions: %d\n", fs_count_strcmp);
     Com_Printf("Total calls to open_from_disk: %d\n", fs_count_open);
     Com_Printf("Total mixed-case reopens: %d\n", fs_count_strlwr);
+    Com_Printf("Total index lookups: %d\n", fs_count_index);
+    Com_Printf("Total misses resolved by index: %d\n", fs_count_negative);
+    Com_Printf("Total stale index hits: %d\n", fs_count_stale);
+    Com_Printf("Index: %u files, %u buckets%s\n", fs_index_nodes, fs_index_size,
+               fs_index_valid ? "" : " (not built)");
+    Com_Printf("Mapped packs: %d (%zu MB)\n", numMapped, sizeMapped >> 20);
 
     if (!totalHashSize) {
         Com_Printf("No stats to display\n");
@@ -3469,6 +3952,7 @@ update:
 
 static void free_search_path(searchpath_t *path)
 {
+    invalidate_index();
     pack_put(path->pack);
     Z_Free(path);
 }
@@ -3777,10 +4261,13 @@ void FS_Init(void)
 
     List_Init(&fs_hard_links);
     List_Init(&fs_soft_links);
+    List_Init(&fs_mapped_packs);
 
     Cmd_Register(c_fs);
 
     fs_autoexec = Cvar_Get("fs_autoexec", "1", 0);
+    fs_mmap = Cvar_Get("fs_mmap", "1", 0);
+    fs_index_enable = Cvar_Get("fs_index", "1", 0);
 
 #if USE_DEBUG
     fs_debug = Cvar_Get("fs_debug", "0", 0);
@@ -79,7 +79,7 @@ void MSG_BeginWriting(void)
 {
     msg_write.cursize = 0;
     msg_write.bits_buf = 0;
-    msg_write.bits_left = 32;
+    msg_write.bits_left = 64;
     msg_write.overflowed = false;
 }
 
@@ -304,6 +304,11 @@ int MSG_WriteDeltaUsercmd(const usercmd_t *from, const usercmd_t *cmd, int versi
 /*
 =============
 MSG_WriteBits
+
+Bits are collected into a 64-bit accumulator that is stored to the message
+in one piece when full. Stream is little endian, so this produces the same
+bytes as writing them one at a time. Nothing else may be written to the
+message until MSG_FlushBits is called.
 =============
 */
 void MSG_WriteBits(int value, int bits)
@@ -314,15 +319,15 @@ void MSG_WriteBits(int value, int bits)
         bits = -bits;
     }
 
-    uint32_t bits_buf  = msg_write.bits_buf;
+    uint64_t bits_buf  = msg_write.bits_buf;
     uint32_t bits_left = msg_write.bits_left;
-    uint32_t v = value & ((1U << bits) - 1);
+    uint64_t v = value & ((1U << bits) - 1);
 
-    bits_buf |= v << (32 - bits_left);
+    bits_buf |= v << (64 - bits_left);
     if (bits >= bits_left) {
-        MSG_WriteLong(bits_buf);
+        WL64(SZ_GetSpace(&msg_write, 8), bits_buf);
         bits_buf   = v >> bits_left;
-        bits_left += 32;
+        bits_left += 64;
     }
     bits_left -= bits;
 
@@ -337,17 +342,21 @@ MSG_FlushBits
 */
 void MSG_FlushBits(void)
 {
-    uint32_t bits_buf  = msg_write.bits_buf;
+    uint64_t bits_buf  = msg_write.bits_buf;
     uint32_t bits_left = msg_write.bits_left;
 
-    while (bits_left < 32) {
-        MSG_WriteByte(bits_buf & 255);
-        bits_buf >>= 8;
-        bits_left += 8;
+    if (bits_left < 64) {
+        size_t i, len = (64 - bits_left + 7) >> 3;
+        byte *data = SZ_GetSpace(&msg_write, len);
+
+        for (i = 0; i < len; i++) {
+            data[i] = bits_buf & 255;
+            bits_buf >>= 8;
+        }
     }
 
     msg_write.bits_buf  = 0;
-    msg_write.bits_left = 32;
+    msg_write.bits_left = 64;
 }
 
 /*
@@ -1680,6 +1689,14 @@ void MSG_ReadDeltaUsercmd_Hacked(const usercmd_t *from, usercmd_t *to)
     to->lightlevel = MSG_ReadByte();
 }
 
+/*
+=============
+MSG_ReadBits
+
+Bytes are consumed from the message only as far as needed. While at least
+8 bytes are left, they are fetched at once with a single bounds check.
+=============
+*/
 int MSG_ReadBits(int bits)
 {
     bool sgn = false;
@@ -1691,18 +1708,28 @@ int MSG_ReadBits(int bits)
         sgn = true;
     }
 
-    uint32_t bits_buf  = msg_read.bits_buf;
+    uint64_t bits_buf  = msg_read.bits_buf;
     uint32_t bits_left = msg_read.bits_left;
 
-    while (bits > bits_left) {
-        bits_buf  |= (uint32_t)MSG_ReadByte() << bits_left;
-        bits_left += 8;
+    if (bits > bits_left && msg_read.readcount <= msg_read.cursize &&
+        msg_read.cursize - msg_read.readcount >= 8) {
+        uint32_t count = (bits - bits_left + 7) >> 3;
+
+        bits_buf  |= RL64(msg_read.data + msg_read.readcount) << bits_left;
+        bits_left += count << 3;
+        msg_read.readcount += count;
+    } else {
+        while (bits > bits_left) {
+            bits_buf  |= (uint64_t)(uint32_t)MSG_ReadByte() << bits_left;
+            bits_left += 8;
+        }
     }
 
     uint32_t value = bits_buf & ((1U << bits) - 1);
 
-    msg_read.bits_buf  = bits_buf >> bits;
-    msg_read.bits_left = bits_left - bits;
+    bits_left -= bits;
+    msg_read.bits_buf  = (bits_buf >> bits) & ((1U << bits_left) - 1);
+    msg_read.bits_left = bits_left;
 
     if (sgn) {
         return (int32_t)(value << (32 - bits)) >> (32 - bits);
@@ -468,6 +468,74 @@ static size_t NetchanNew_TransmitNextFragment(netchan_t *chan)
     return send.cursize;
 }
 
+#if USE_CLIENT
+/*
+===============
+NetchanNew_TransmitLoop
+
+Loopback queue never drops or reorders packets, so the message is written
+straight into it, unfragmented and without any reliable bookkeeping.
+Receiver sees it as an ordinary unreliable packet. Returns 0 if the queue
+can't take it, normal path is used then.
+================
+*/
+static size_t NetchanNew_TransmitLoop(netchan_t *chan, size_t length, const void *data)
+{
+    sizebuf_t   send;
+    byte        *buf;
+    size_t      maxlen;
+    int         w1, w2;
+
+    if (chan->reliable_length || chan->fragment_pending) {
+        return 0;
+    }
+
+    maxlen = PACKET_HEADER + chan->message.cursize + length;
+    if (maxlen > MAX_MSGLEN) {
+        return 0;
+    }
+
+    buf = NET_BeginLoopPacket(chan->sock, maxlen);
+    if (!buf) {
+        return 0;
+    }
+
+    w1 = chan->outgoing_sequence & NEW_MASK;
+
+    w2 = chan->incoming_sequence & NEW_MASK;
+    if (chan->incoming_reliable_sequence)
+        w2 |= REL_BIT;
+
+    SZ_TagInit(&send, buf, maxlen, "nc_send_loop");
+
+    SZ_WriteLong(&send, w1);
+    SZ_WriteLong(&send, w2);
+
+    // send the qport if we are a client
+    if (chan->sock == NS_CLIENT && chan->qport) {
+        SZ_WriteByte(&send, chan->qport);
+    }
+
+    SZ_Write(&send, chan->message.data, chan->message.cursize);
+    SZ_Write(&send, data, length);
+
+    SHOWPACKET("send %4zu : s=%d ack=%d rack=%d loop\n",
+               send.cursize,
+               chan->outgoing_sequence,
+               chan->incoming_sequence,
+               chan->incoming_reliable_sequence);
+
+    NET_EndLoopPacket(chan->sock, send.cursize, &chan->remote_address);
+
+    chan->message.cursize = 0;
+    chan->outgoing_sequence++;
+    chan->reliable_ack_pending = false;
+    chan->last_sent = com_localTime;
+
+    return send.cursize;
+}
+#endif
+
 /*
 ===============
 NetchanNew_Transmit
@@ -491,6 +559,15 @@ static size_t NetchanNew_Transmit(netchan_t *chan, size_t length, const void *da
         return NetchanNew_TransmitNextFragment(chan);
     }
 
+#if USE_CLIENT
+    if (NET_IsLocalAddress(&chan->remote_address)) {
+        size_t ret = NetchanNew_TransmitLoop(chan, length, data);
+        if (ret) {
+            return ret;
+        }
+    }
+#endif
+
     send_reliable = false;
 
 // if the remote side dropped the last reliable message, resend it
@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 //
 
 #include "shared/shared.h"
+#include "shared/atomic.h"
 #include "common/common.h"
 #include "common/cvar.h"
 #include "common/fifo.h"
@@ -65,22 +66,35 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #endif // __linux__
 #endif // !_WIN32
 
+// batched UDP I/O with recvmmsg/sendmmsg
+#if defined(__linux__) && defined(_GNU_SOURCE)
+#define USE_MMSG    1
+#else
+#define USE_MMSG    0
+#endif
+
 // prevents infinite retry loops caused by broken TCP/IP stacks
 #define MAX_ERROR_RETRIES   64
 
 #if USE_CLIENT
 
-#define MAX_LOOPBACK    4
+#define MAX_LOOPBACK    16  // must be power of two
+#define LOOPBACK_MASK   (MAX_LOOPBACK - 1)
 
+// Loopback queues have a single producer and a single consumer, so they
+// only need atomic indices. Packets are parsed straight from the queue.
+// The slot just before `get' may still be parsed, so it is never reused
+// until `get' moves on.
 typedef struct {
-    byte    data[MAX_PACKETLEN];
+    byte    *data;
     size_t  datalen;
+    size_t  maxlen;
 } loopmsg_t;
 
 typedef struct {
-    loopmsg_t       msgs[MAX_LOOPBACK];
-    unsigned long   get;
-    unsigned long   send;
+    loopmsg_t   msgs[MAX_LOOPBACK];
+    atomic_int  get;    // advanced by receiver only
+    atomic_int  send;   // advanced by sender only
 } loopback_t;
 
 static loopback_t   loopbacks[NS_COUNT];
@@ -106,6 +120,10 @@ static cvar_t   *net_log_flush;
 
 static cvar_t   *net_enable_ipv6;
 
+#if USE_MMSG
+static cvar_t   *net_batch;
+#endif
+
 #if USE_ICMP
 static cvar_t   *net_ignore_icmp;
 #endif
@@ -145,6 +163,28 @@ static uint64_t     net_bytes_rcvd;
 static uint64_t     net_bytes_sent;
 static uint64_t     net_packets_rcvd;
 static uint64_t     net_packets_sent;
+static uint64_t     net_recv_calls;
+static uint64_t     net_send_calls;
+
+#if USE_MMSG
+
+#define NET_BATCH_SIZE  64
+
+typedef struct {
+    struct pollfd           *sock;
+    int                     count;
+    struct mmsghdr          msgs[NET_BATCH_SIZE];
+    struct iovec            iovecs[NET_BATCH_SIZE];
+    struct sockaddr_storage addrs[NET_BATCH_SIZE];
+    netadr_t                adrs[NET_BATCH_SIZE];
+    byte                    data[NET_BATCH_SIZE][MAX_PACKETLEN];
+} netbatch_t;
+
+static netbatch_t   net_recv_batch;
+static netbatch_t   net_send_queues[2];     // IPv4 and IPv6
+static bool         net_send_batching;
+
+#endif // USE_MMSG
 
 //=============================================================================
 
@@ -511,6 +551,10 @@ static void NET_Stats_f(void)
                net_packets_sent, net_packets_sent / diff);
     Com_Printf("Packets rcvd: %"PRIu64" (%"PRIu64" packets/sec)\n",
                net_packets_rcvd, net_packets_rcvd / diff);
+    Com_Printf("Send syscalls: %"PRIu64" (%.2f packets/call)\n",
+               net_send_calls, net_packets_sent / (double)max(net_send_calls, 1));
+    Com_Printf("Recv syscalls: %"PRIu64" (%.2f packets/call)\n",
+               net_recv_calls, net_packets_rcvd / (double)max(net_recv_calls, 1));
 #if USE_ICMP
     Com_Printf("Total errors: %"PRIu64"/%"PRIu64"/%"PRIu64" (send/recv/icmp)\n",
                net_send_errors, net_recv_errors, net_icmp_errors);
@@ -540,18 +584,14 @@ static void NET_GetLoopPackets(netsrc_t sock, void (*packet_cb)(void))
 {
     loopback_t *loop;
     loopmsg_t *loopmsg;
+    int get;
 
     loop = &loopbacks[sock];
 
-    if (loop->send - loop->get > MAX_LOOPBACK - 1) {
-        loop->get = loop->send - MAX_LOOPBACK + 1;
-    }
-
-    while (loop->get < loop->send) {
-        loopmsg = &loop->msgs[loop->get & (MAX_LOOPBACK - 1)];
-        loop->get++;
-
-        memcpy(msg_read_buffer, loopmsg->data, loopmsg->datalen);
+    // re-read index every time, packet handler may recurse
+    while ((get = atomic_load(&loop->get)) != atomic_load(&loop->send)) {
+        loopmsg = &loop->msgs[get];
+        atomic_store(&loop->get, (get + 1) & LOOPBACK_MASK);
 
         NET_LogPacket(&net_from, "LP recv", loopmsg->data, loopmsg->datalen);
 
@@ -559,40 +599,103 @@ static void NET_GetLoopPackets(netsrc_t sock, void (*packet_cb)(void))
             net_rate_rcvd += loopmsg->datalen;
         }
 
-        SZ_Init(&msg_read, msg_read_buffer, sizeof(msg_read_buffer));
+        SZ_Init(&msg_read, loopmsg->data, loopmsg->maxlen);
         msg_read.cursize = loopmsg->datalen;
 
         (*packet_cb)();
     }
 }
 
-static bool NET_SendLoopPacket(netsrc_t sock, const void *data,
-                               size_t len, const netadr_t *to)
+static byte *loop_reserve(netsrc_t sock, size_t len)
 {
     loopback_t *loop;
     loopmsg_t *msg;
+    int send;
 
-    if (net_dropsim->integer > 0 && (Q_rand() % 100) < net_dropsim->integer) {
-        return false;
+    loop = &loopbacks[sock ^ 1];
+    send = atomic_load(&loop->send);
+
+    // keep one slot for the packet being parsed
+    if (((send - atomic_load(&loop->get)) & LOOPBACK_MASK) >= MAX_LOOPBACK - 2) {
+        return NULL;
     }
 
-    loop = &loopbacks[sock ^ 1];
+    msg = &loop->msgs[send];
+    if (msg->maxlen < len) {
+        msg->maxlen = ALIGN(len, MAX_PACKETLEN);
+        msg->data = Z_Realloc(msg->data, msg->maxlen);
+    }
+
+    return msg->data;
+}
+
+/*
+=============
+NET_BeginLoopPacket
+
+Returns buffer for a packet of up to `len' bytes to be written directly
+into the loopback queue of the other side, or NULL if it is full or
+packet loss is being simulated. Commit with NET_EndLoopPacket.
+=============
+*/
+byte *NET_BeginLoopPacket(netsrc_t sock, size_t len)
+{
+    if (net_dropsim->integer > 0) {
+        return NULL;
+    }
+
+    return loop_reserve(sock, len);
+}
 
-    msg = &loop->msgs[loop->send & (MAX_LOOPBACK - 1)];
-    loop->send++;
+void NET_EndLoopPacket(netsrc_t sock, size_t len, const netadr_t *to)
+{
+    loopback_t *loop = &loopbacks[sock ^ 1];
+    int send = atomic_load(&loop->send);
+    loopmsg_t *msg = &loop->msgs[send];
 
-    memcpy(msg->data, data, len);
+    Q_assert(len <= msg->maxlen);
     msg->datalen = len;
 
-    NET_LogPacket(to, "LP send", data, len);
+    NET_LogPacket(to, "LP send", msg->data, len);
 
     if (sock == NS_CLIENT) {
         net_rate_sent += len;
     }
 
+    atomic_store(&loop->send, (send + 1) & LOOPBACK_MASK);
+}
+
+static bool NET_SendLoopPacket(netsrc_t sock, const void *data,
+                               size_t len, const netadr_t *to)
+{
+    byte *buf;
+
+    if (net_dropsim->integer > 0 && (Q_rand() % 100) < net_dropsim->integer) {
+        return false;
+    }
+
+    buf = loop_reserve(sock, len);
+    if (!buf) {
+        return false;
+    }
+
+    memcpy(buf, data, len);
+    NET_EndLoopPacket(sock, len, to);
     return true;
 }
 
+static void NET_FreeLoopPackets(void)
+{
+    int i, j;
+
+    for (i = 0; i < NS_COUNT; i++) {
+        for (j = 0; j < MAX_LOOPBACK; j++) {
+            Z_Freep((void **)&loopbacks[i].msgs[j].data);
+            loopbacks[i].msgs[j].maxlen = 0;
+        }
+    }
+}
+
 #endif // USE_CLIENT
 
 //=============================================================================
@@ -746,51 +849,136 @@ int NET_Sleep1(int msec, struct pollfd *e)
 
 //=============================================================================
 
-static void NET_GetUdpPackets(struct pollfd *sock, void (*packet_cb)(void))
+// returns false when there are no more packets to read
+static bool NET_GetUdpPacket(struct pollfd *sock, void (*packet_cb)(void))
 {
     int ret;
 
-    if (!sock)
-        return;
+    ret = os_udp_recv(sock->fd, msg_read_buffer, MAX_PACKETLEN, &net_from);
+    net_recv_calls++;
 
-    Q_assert(!(sock->revents & POLLNVAL));
+    if (ret == NET_AGAIN) {
+        sock->revents = 0;
+        return false;
+    }
 
-    if (!(sock->revents & (POLLIN | POLLERR)))
-        return;
+    if (ret == NET_ERROR) {
+        Com_DPrintf("%s: %s from %s\n", __func__,
+                    NET_ErrorString(), NET_AdrToString(&net_from));
+        net_recv_errors++;
+        return false;
+    }
+
+    NET_LogPacket(&net_from, "UDP recv", msg_read_buffer, ret);
+
+    net_rate_rcvd += ret;
+    net_bytes_rcvd += ret;
+    net_packets_rcvd++;
+
+    SZ_Init(&msg_read, msg_read_buffer, sizeof(msg_read_buffer));
+    msg_read.cursize = ret;
+
+    (*packet_cb)();
+    return true;
+}
+
+#if USE_MMSG
+
+static void NET_InitBatch(netbatch_t *b)
+{
+    struct mmsghdr *m;
+    int i;
+
+    for (i = 0, m = b->msgs; i < NET_BATCH_SIZE; i++, m++) {
+        b->iovecs[i].iov_base = b->data[i];
+        b->iovecs[i].iov_len = MAX_PACKETLEN;
+        memset(m, 0, sizeof(*m));
+        m->msg_hdr.msg_name = &b->addrs[i];
+        m->msg_hdr.msg_namelen = sizeof(b->addrs[i]);
+        m->msg_hdr.msg_iov = &b->iovecs[i];
+        m->msg_hdr.msg_iovlen = 1;
+    }
+}
+
+static void NET_GetUdpPacketsBatch(struct pollfd *sock, void (*packet_cb)(void))
+{
+    netbatch_t *b = &net_recv_batch;
+    int i, ret;
 
     while (1) {
-        ret = os_udp_recv(sock->fd, msg_read_buffer, MAX_PACKETLEN, &net_from);
+        NET_InitBatch(b);
+
+        ret = os_udp_recv_batch(sock->fd, b->msgs, NET_BATCH_SIZE);
+        net_recv_calls++;
+
         if (ret == NET_AGAIN) {
             sock->revents = 0;
             break;
         }
 
+        // read a single packet to process the error queue
         if (ret == NET_ERROR) {
-            Com_DPrintf("%s: %s from %s\n", __func__,
-                        NET_ErrorString(), NET_AdrToString(&net_from));
-            net_recv_errors++;
+            if (!NET_GetUdpPacket(sock, packet_cb))
+                break;
+            continue;
+        }
+
+        for (i = 0; i < ret; i++) {
+            size_t len = b->msgs[i].msg_len;
+
+            NET_SockadrToNetadr(&b->addrs[i], &net_from);
+
+            NET_LogPacket(&net_from, "UDP recv", b->data[i], len);
+
+            net_rate_rcvd += len;
+            net_bytes_rcvd += len;
+            net_packets_rcvd++;
+
+            // packet handlers expect to find data in msg_read_buffer
+            memcpy(msg_read_buffer, b->data[i], len);
+            SZ_Init(&msg_read, msg_read_buffer, sizeof(msg_read_buffer));
+            msg_read.cursize = len;
+
+            (*packet_cb)();
+        }
+
+        // short read means socket buffer was drained
+        if (ret < NET_BATCH_SIZE) {
+            sock->revents = 0;
             break;
         }
+    }
+}
 
-        NET_LogPacket(&net_from, "UDP recv", msg_read_buffer, ret);
+#endif // USE_MMSG
 
-        net_rate_rcvd += ret;
-        net_bytes_rcvd += ret;
-        net_packets_rcvd++;
+static void NET_GetUdpPackets(struct pollfd *sock, void (*packet_cb)(void))
+{
+    if (!sock)
+        return;
 
-        SZ_Init(&msg_read, msg_read_buffer, sizeof(msg_read_buffer));
-        msg_read.cursize = ret;
+    Q_assert(!(sock->revents & POLLNVAL));
 
-        (*packet_cb)();
+    if (!(sock->revents & (POLLIN | POLLERR)))
+        return;
+
+#if USE_MMSG
+    if (net_batch->integer) {
+        NET_GetUdpPacketsBatch(sock, packet_cb);
+        return;
     }
+#endif
+
+    while (NET_GetUdpPacket(sock, packet_cb))
+        ;
 }
 
 /*
 =============
 NET_GetPackets
 
-Fills msg_read_buffer with packet contents,
-net_from variable receives source address.
+Fills msg_read_buffer with packet contents (loopback packets are read
+in place), net_from variable receives source address.
 =============
 */
 void NET_GetPackets(netsrc_t sock, void (*packet_cb)(void))
@@ -810,16 +998,155 @@ void NET_GetPackets(netsrc_t sock, void (*packet_cb)(void))
     NET_GetUdpPackets(udp6_sockets[sock], packet_cb);
 }
 
+static bool NET_SendUdpPacket(struct pollfd *s, const void *data,
+                              size_t len, const netadr_t *to)
+{
+    int ret;
+
+    ret = os_udp_send(s->fd, data, len, to);
+    net_send_calls++;
+
+    if (ret == NET_AGAIN)
+        return false;
+
+    if (ret == NET_ERROR) {
+        Com_DPrintf("%s: %s to %s\n", __func__,
+                    NET_ErrorString(), NET_AdrToString(to));
+        net_send_errors++;
+        return false;
+    }
+
+    if (ret < len)
+        Com_WPrintf("%s: short send to %s\n", __func__,
+                    NET_AdrToString(to));
+
+    NET_LogPacket(to, "UDP send", data, ret);
+
+    net_rate_sent += ret;
+    net_bytes_sent += ret;
+    net_packets_sent++;
+
+    return true;
+}
+
+#if USE_MMSG
+
+static void NET_FlushSendQueue(netbatch_t *q)
+{
+    int i, j, ret, count = q->count;
+
+    q->count = 0;
+
+    for (i = 0; i < count; ) {
+        ret = os_udp_send_batch(q->sock->fd, q->msgs + i, count - i);
+        net_send_calls++;
+
+        // socket buffer is full, drop the rest like NET_SendPacket would
+        if (ret == NET_AGAIN) {
+            Com_DPrintf("%s: dropped %d packets, socket buffer full\n",
+                        __func__, count - i);
+            net_send_errors += count - i;
+            break;
+        }
+
+        // resend failed packet alone to process the error queue
+        if (ret == NET_ERROR) {
+            NET_SendUdpPacket(q->sock, q->data[i], q->iovecs[i].iov_len, &q->adrs[i]);
+            i++;
+            continue;
+        }
+
+        for (j = i; j < i + ret; j++) {
+            size_t len = q->msgs[j].msg_len;
+
+            if (len < q->iovecs[j].iov_len)
+                Com_WPrintf("%s: short send to %s\n", __func__,
+                            NET_AdrToString(&q->adrs[j]));
+
+            NET_LogPacket(&q->adrs[j], "UDP send", q->data[j], len);
+
+            net_rate_sent += len;
+            net_bytes_sent += len;
+            net_packets_sent++;
+        }
+
+        i += ret;
+    }
+}
+
+static bool NET_QueueUdpPacket(struct pollfd *s, const void *data,
+                               size_t len, const netadr_t *to)
+{
+    netbatch_t *q = &net_send_queues[to->type == NA_IP6];
+    struct mmsghdr *m;
+
+    if (q->sock != s || q->count == NET_BATCH_SIZE)
+        NET_FlushSendQueue(q);
+
+    if (!q->count) {
+        NET_InitBatch(q);
+        q->sock = s;
+    }
+
+    m = &q->msgs[q->count];
+    m->msg_hdr.msg_namelen = NET_NetadrToSockadr(to, &q->addrs[q->count]);
+    q->iovecs[q->count].iov_len = len;
+    q->adrs[q->count] = *to;
+    memcpy(q->data[q->count], data, len);
+    q->count++;
+
+    return true;
+}
+
+#endif // USE_MMSG
+
+/*
+=============
+NET_BeginSendBatch
+
+Queues UDP packets sent until NET_FlushSendBatch is called and
+then writes them out with as few system calls as possible.
+Com_Error flushes the batch, so it doesn't outlive an aborted frame.
+=============
+*/
+void NET_BeginSendBatch(void)
+{
+#if USE_MMSG
+    net_send_batching = net_batch->integer;
+#endif
+}
+
+/*
+=============
+NET_FlushSendBatch
+
+Sends queued packets and stops batching. Packets that couldn't be sent
+are counted as send errors in net_stats.
+=============
+*/
+void NET_FlushSendBatch(void)
+{
+#if USE_MMSG
+    int i;
+
+    net_send_batching = false;
+
+    for (i = 0; i < q_countof(net_send_queues); i++)
+        NET_FlushSendQueue(&net_send_queues[i]);
+#endif
+}
+
 /*
 =============
 NET_SendPacket
 
+While batching, UDP packets are only queued and true is returned,
+failures are counted when the batch is flushed.
 =============
 */
 bool NET_SendPacket(netsrc_t sock, const void *data,
                     size_t len, const netadr_t *to)
 {
-    int ret;
     struct pollfd *s;
 
     if (len == 0)
@@ -852,34 +1179,27 @@ bool NET_SendPacket(netsrc_t sock, const void *data,
     if (!s)
         return false;
 
-    ret = os_udp_send(s->fd, data, len, to);
-    if (ret == NET_AGAIN)
-        return false;
-
-    if (ret == NET_ERROR) {
-        Com_DPrintf("%s: %s to %s\n", __func__,
-                    NET_ErrorString(), NET_AdrToString(to));
-        net_send_errors++;
-        return false;
-    }
-
-    if (ret < len)
-        Com_WPrintf("%s: short send to %s\n", __func__,
-                    NET_AdrToString(to));
-
-    NET_LogPacket(to, "UDP send", data, ret);
-
-    net_rate_sent += ret;
-    net_bytes_sent += ret;
-    net_packets_sent++;
+#if USE_MMSG
+    if (net_send_batching)
+        return NET_QueueUdpPacket(s, data, len, to);
+#endif
 
-    return true;
+    return NET_SendUdpPacket(s, data, len, to);
 }
 
 //=============================================================================
 
 static void NET_CloseSocket(struct pollfd *s)
 {
+#if USE_MMSG
+    int i;
+
+    // don't lose packets queued for this socket
+    for (i = 0; i < q_countof(net_send_queues); i++)
+        if (net_send_queues[i].count && net_send_queues[i].sock == s)
+            NET_FlushSendQueue(&net_send_queues[i]);
+#endif
+
     os_closesocket(s->fd);
     NET_FreePollFd(s);
 }
@@ -1771,6 +2091,134 @@ static void NET_Dns_f(void)
     freeaddrinfo(res);
 }
 
+#if USE_MMSG
+
+static void NET_BenchSend(struct pollfd *tx, netbatch_t *b, int count,
+                          bool batch, uint64_t *calls)
+{
+    int i, ret;
+
+    if (!batch) {
+        for (i = 0; i < count; i++, (*calls)++)
+            os_udp_send(tx->fd, b->data[i], b->iovecs[i].iov_len, &b->adrs[i]);
+        return;
+    }
+
+    for (i = 0; i < count; i += max(ret, 1), (*calls)++)
+        ret = os_udp_send_batch(tx->fd, b->msgs + i, count - i);
+}
+
+static int NET_BenchRecv(struct pollfd *rx, netbatch_t *b,
+                         bool batch, uint64_t *calls)
+{
+    netadr_t from;
+    int ret, total = 0;
+
+    while (1) {
+        if (batch) {
+            NET_InitBatch(b);
+            ret = os_udp_recv_batch(rx->fd, b->msgs, NET_BATCH_SIZE);
+        } else {
+            ret = os_udp_recv(rx->fd, b->data[0], MAX_PACKETLEN, &from);
+        }
+        (*calls)++;
+
+        if (ret < 0)
+            break;
+
+        if (!batch) {
+            total++;
+            continue;
+        }
+
+        total += ret;
+        if (ret < NET_BATCH_SIZE)
+            break;
+    }
+
+    return total;
+}
+
+/*
+====================
+NET_BatchBench_f
+
+Sends fake client frames between two loopback sockets,
+once with a system call per packet and once batched.
+====================
+*/
+static void NET_BatchBench_f(void)
+{
+    static const char *const modes[2] = { "single", "batched" };
+    struct pollfd *tx, *rx;
+    netbatch_t *sbuf, *rbuf;
+    netadr_t adr;
+    int i, j, n, mode, clients, frames, size, rcvd;
+    uint64_t sends, recvs;
+    unsigned start, msec;
+
+    if (Cmd_Argc() > 4) {
+        Com_Printf("Usage: %s [clients] [frames] [size]\n", Cmd_Argv(0));
+        return;
+    }
+
+    clients = Cmd_Argc() > 1 ? Q_clip(Q_atoi(Cmd_Argv(1)), 1, MAX_CLIENTS) : 64;
+    frames = Cmd_Argc() > 2 ? max(Q_atoi(Cmd_Argv(2)), 1) : 1000;
+    size = Cmd_Argc() > 3 ? Q_clip(Q_atoi(Cmd_Argv(3)), 1, MAX_PACKETLEN) : 1000;
+
+    rx = UDP_OpenSocket("127.0.0.1", PORT_ANY, AF_INET);
+    tx = UDP_OpenSocket("127.0.0.1", PORT_ANY, AF_INET);
+    if (!rx || !tx || os_getsockname(rx->fd, &adr)) {
+        Com_Printf("Couldn't open loopback sockets\n");
+        goto close;
+    }
+
+    // don't drop packets while a whole batch is in flight
+    os_setsockopt(rx->fd, SOL_SOCKET, SO_RCVBUF, NET_BATCH_SIZE * MAX_PACKETLEN * 2);
+
+    sbuf = Z_Malloc(sizeof(*sbuf));
+    rbuf = Z_Malloc(sizeof(*rbuf));
+
+    NET_InitBatch(sbuf);
+    for (i = 0; i < NET_BATCH_SIZE; i++) {
+        sbuf->msgs[i].msg_hdr.msg_namelen = NET_NetadrToSockadr(&adr, &sbuf->addrs[i]);
+        sbuf->iovecs[i].iov_len = size;
+        sbuf->adrs[i] = adr;
+        memset(sbuf->data[i], i, size);
+    }
+
+    Com_Printf("Sending %d frames to %d clients, %d bytes per packet\n",
+               frames, clients, size);
+
+    for (mode = 0; mode < 2; mode++) {
+        sends = recvs = rcvd = 0;
+        start = Sys_Milliseconds();
+
+        for (i = 0; i < frames; i++) {
+            for (j = 0; j < clients; j += n) {
+                n = min(clients - j, NET_BATCH_SIZE);
+                NET_BenchSend(tx, sbuf, n, mode, &sends);
+                rcvd += NET_BenchRecv(rx, rbuf, mode, &recvs);
+            }
+        }
+
+        msec = Sys_Milliseconds() - start;
+        Com_Printf("%-8s: %u msec, %"PRIu64" send calls, %"PRIu64" recv calls, %d/%d packets received\n",
+                   modes[mode], msec, sends, recvs, rcvd, frames * clients);
+    }
+
+    Z_Free(sbuf);
+    Z_Free(rbuf);
+
+close:
+    if (rx)
+        NET_CloseSocket(rx);
+    if (tx)
+        NET_CloseSocket(tx);
+}
+
+#endif // USE_MMSG
+
 /*
 ====================
 NET_Restart_f
@@ -1854,6 +2302,10 @@ void NET_Init(void)
     net_ignore_icmp = Cvar_Get("net_ignore_icmp", "0", 0);
 #endif
 
+#if USE_MMSG
+    net_batch = Cvar_Get("net_batch", "1", 0);
+#endif
+
 #if USE_DEBUG
     net_log_enable_changed(net_log_enable);
 #endif
@@ -1864,6 +2316,9 @@ void NET_Init(void)
     Cmd_AddCommand("net_stats", NET_Stats_f);
     Cmd_AddCommand("showip", NET_ShowIP_f);
     Cmd_AddCommand("dns", NET_Dns_f);
+#if USE_MMSG
+    Cmd_AddCommand("net_batchbench", NET_BatchBench_f);
+#endif
 
     Cmd_AddMacro("net_uprate", NET_UpRate_m);
     Cmd_AddMacro("net_dnrate", NET_DnRate_m);
@@ -1876,6 +2331,8 @@ NET_Shutdown
 */
 void NET_Shutdown(void)
 {
+    NET_FlushSendBatch();
+
 #if USE_DEBUG
     logfile_close();
 #endif
@@ -1884,9 +2341,16 @@ void NET_Shutdown(void)
     NET_Config(NET_NONE);
     os_net_shutdown();
 
+#if USE_CLIENT
+    NET_FreeLoopPackets();
+#endif
+
     Cmd_RemoveCommand("net_restart");
     Cmd_RemoveCommand("net_stats");
     Cmd_RemoveCommand("showip");
     Cmd_RemoveCommand("dns");
+#if USE_MMSG
+    Cmd_RemoveCommand("net_batchbench");
+#endif
 }
 
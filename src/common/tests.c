@@ -21,12 +21,16 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/cmd.h"
 #include "common/common.h"
 #include "common/files.h"
+#include "common/intreadwrite.h"
 #include "common/mdfour.h"
+#include "common/msg.h"
 #include "common/tests.h"
 #include "refresh/refresh.h"
 #include "system/system.h"
 #include "client/sound/sound.h"
 
+#if USE_TESTS
+
 // test error shutdown procedures
 static void Com_Error_f(void)
 {
@@ -641,6 +645,332 @@ static void Com_MdfourTest_f(void)
     Com_Printf("%d failures, %d strings tested\n", errors, tests);
 }
 
+#if USE_CLIENT
+
+/*
+Bit stream tests. MSG_WriteBits and MSG_ReadBits are checked against
+a straightforward implementation that moves data one word or byte at
+a time, which is how the wire format was originally defined.
+*/
+
+typedef struct {
+    byte        *data;
+    size_t      size;
+    size_t      pos;
+    uint32_t    bits_buf;
+    uint32_t    bits_left;
+} refbits_t;
+
+static void ref_write_bits(refbits_t *r, int value, int bits)
+{
+    uint32_t v;
+
+    if (bits < 0)
+        bits = -bits;
+
+    v = value & ((1U << bits) - 1);
+    r->bits_buf |= v << (32 - r->bits_left);
+    if (bits >= r->bits_left) {
+        WL32(r->data + r->pos, r->bits_buf);
+        r->pos += 4;
+        r->bits_buf = v >> r->bits_left;
+        r->bits_left += 32;
+    }
+    r->bits_left -= bits;
+}
+
+static void ref_flush_bits(refbits_t *r)
+{
+    while (r->bits_left < 32) {
+        r->data[r->pos++] = r->bits_buf & 255;
+        r->bits_buf >>= 8;
+        r->bits_left += 8;
+    }
+    r->bits_buf = 0;
+    r->bits_left = 32;
+}
+
+static int ref_read_byte(refbits_t *r)
+{
+    if (r->pos >= r->size) {
+        r->pos = r->size + 1;
+        return -1;
+    }
+    return r->data[r->pos++];
+}
+
+static int ref_read_bits(refbits_t *r, int bits)
+{
+    bool sgn = false;
+    uint32_t value;
+
+    if (bits < 0) {
+        bits = -bits;
+        sgn = true;
+    }
+
+    while (bits > r->bits_left) {
+        r->bits_buf |= (uint32_t)ref_read_byte(r) << r->bits_left;
+        r->bits_left += 8;
+    }
+
+    value = r->bits_buf & ((1U << bits) - 1);
+    r->bits_buf >>= bits;
+    r->bits_left -= bits;
+
+    if (sgn)
+        return (int32_t)(value << (32 - bits)) >> (32 - bits);
+
+    return value;
+}
+
+#define MAX_BITS_FIELDS     256
+
+typedef struct {
+    int     value;
+    int     bits;
+} bitsfield_t;
+
+static int random_fields(bitsfield_t *fields)
+{
+    int i, count = 1 + Q_rand_uniform(MAX_BITS_FIELDS);
+
+    for (i = 0; i < count; i++) {
+        fields[i].value = Q_rand();
+        fields[i].bits = 1 + Q_rand_uniform(25);
+        if (Q_rand() & 1)
+            fields[i].bits = -fields[i].bits;
+    }
+
+    return count;
+}
+
+static int expected_value(const bitsfield_t *f)
+{
+    int bits = abs(f->bits);
+    uint32_t v = f->value & ((1U << bits) - 1);
+
+    if (f->bits < 0)
+        return (int32_t)(v << (32 - bits)) >> (32 - bits);
+
+    return v;
+}
+
+static bool test_bits_stream(byte *buf1, byte *buf2, size_t size)
+{
+    bitsfield_t fields[MAX_BITS_FIELDS];
+    refbits_t r = { .data = buf2, .size = size, .bits_left = 32 };
+    int i, count, v1, v2;
+    size_t len;
+
+    count = random_fields(fields);
+
+    // write both streams, they must be identical
+    SZ_TagInit(&msg_write, buf1, size, "bitstest");
+    MSG_BeginWriting();
+    for (i = 0; i < count; i++) {
+        MSG_WriteBits(fields[i].value, fields[i].bits);
+        ref_write_bits(&r, fields[i].value, fields[i].bits);
+    }
+    MSG_FlushBits();
+    ref_flush_bits(&r);
+
+    if (msg_write.cursize != r.pos || memcmp(buf1, buf2, r.pos)) {
+        Com_EPrintf("%d fields written as %zu bytes, expected %zu\n",
+                    count, msg_write.cursize, r.pos);
+        return false;
+    }
+
+    // read back, sometimes from a truncated message
+    len = r.pos;
+    if (!(Q_rand() & 3))
+        len = Q_rand_uniform(len + 1);
+
+    SZ_Init(&msg_read, buf1, len);
+    msg_read.cursize = len;
+    r.size = len;
+    r.pos = 0;
+    r.bits_buf = 0;
+    r.bits_left = 0;
+
+    for (i = 0; i < count; i++) {
+        v1 = MSG_ReadBits(fields[i].bits);
+        v2 = ref_read_bits(&r, fields[i].bits);
+        if (v1 != v2 || msg_read.readcount != r.pos) {
+            Com_EPrintf("Field %d of %d (%d bits): read %d at %zu, expected %d at %zu\n",
+                        i, count, fields[i].bits, v1, msg_read.readcount, v2, r.pos);
+            return false;
+        }
+        if (len == msg_write.cursize && v1 != expected_value(&fields[i])) {
+            Com_EPrintf("Field %d of %d (%d bits): read %d, written %d\n",
+                        i, count, fields[i].bits, v1, expected_value(&fields[i]));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#define MAX_BITS_CMDS   32
+
+static void random_usercmd(usercmd_t *cmd, const usercmd_t *from)
+{
+    memset(cmd, 0, sizeof(*cmd));
+
+    // keep some fields unchanged to exercise delta compression
+    for (int i = 0; i < 3; i++) {
+        if (Q_rand() & 1)
+            cmd->angles[i] = from->angles[i] + (int)Q_rand_uniform(256) - 128;
+        else
+            cmd->angles[i] = Q_rand();
+    }
+    cmd->forwardmove = (Q_rand() & 1) ? from->forwardmove : (int)Q_rand_uniform(1024) - 512;
+    cmd->sidemove = (Q_rand() & 1) ? from->sidemove : (int)Q_rand_uniform(1024) - 512;
+    cmd->upmove = (Q_rand() & 1) ? from->upmove : (int)Q_rand_uniform(1024) - 512;
+    cmd->buttons = (Q_rand() & 3) | ((Q_rand() & 1) ? BUTTON_ANY : 0);
+    cmd->msec = (Q_rand() & 1) ? from->msec : Q_rand() & 255;
+}
+
+static bool usercmd_equal(const usercmd_t *a, const usercmd_t *b)
+{
+    return a->angles[0] == b->angles[0] && a->angles[1] == b->angles[1] &&
+        a->angles[2] == b->angles[2] && a->forwardmove == b->forwardmove &&
+        a->sidemove == b->sidemove && a->upmove == b->upmove &&
+        a->buttons == b->buttons && a->msec == b->msec;
+}
+
+static bool test_usercmd_stream(byte *buf, size_t size)
+{
+    usercmd_t cmds[MAX_BITS_CMDS], in;
+    const usercmd_t *from;
+    int i, count = 1 + Q_rand_uniform(MAX_BITS_CMDS);
+
+    SZ_TagInit(&msg_write, buf, size, "bitstest");
+    MSG_BeginWriting();
+    MSG_WriteBits(count, 6);
+    for (i = 0, from = NULL; i < count; i++) {
+        random_usercmd(&cmds[i], i ? &cmds[i - 1] : &(usercmd_t){ 0 });
+        MSG_WriteDeltaUsercmd_Enhanced(from, &cmds[i]);
+        from = &cmds[i];
+    }
+    MSG_FlushBits();
+    MSG_WriteByte(0x55);    // must follow bit stream
+
+    SZ_Init(&msg_read, buf, size);
+    msg_read.cursize = msg_write.cursize;
+    if (MSG_ReadBits(6) != count) {
+        Com_EPrintf("Bad usercmd count\n");
+        return false;
+    }
+    for (i = 0, from = NULL; i < count; i++) {
+        MSG_ReadDeltaUsercmd_Enhanced(from, &in);
+        if (!usercmd_equal(&in, &cmds[i])) {
+            Com_EPrintf("Usercmd %d of %d mismatch\n", i, count);
+            return false;
+        }
+        from = &cmds[i];
+    }
+    if (MSG_ReadByte() != 0x55 || msg_read.readcount != msg_read.cursize) {
+        Com_EPrintf("Bit stream of %d usercmds not byte aligned\n", count);
+        return false;
+    }
+
+    return true;
+}
+
+static void Com_BitsTest_f(void)
+{
+    sizebuf_t oldwrite = msg_write, oldread = msg_read;
+    byte *buf1, *buf2;
+    int i, count, errors = 0;
+
+    count = Cmd_Argc() > 1 ? Q_atoi(Cmd_Argv(1)) : 10000;
+    buf1 = Z_Malloc(MAX_MSGLEN);
+    buf2 = Z_Malloc(MAX_MSGLEN);
+
+    for (i = 0; i < count; i++) {
+        if (!test_bits_stream(buf1, buf2, MAX_MSGLEN))
+            errors++;
+        if (!test_usercmd_stream(buf1, MAX_MSGLEN))
+            errors++;
+    }
+
+    Z_Free(buf1);
+    Z_Free(buf2);
+    msg_write = oldwrite;
+    msg_read = oldread;
+
+    Com_Printf("%d failures, %d streams tested\n", errors, count);
+}
+
+static void Com_BitsBench_f(void)
+{
+    sizebuf_t oldwrite = msg_write, oldread = msg_read;
+    bitsfield_t fields[MAX_BITS_FIELDS];
+    refbits_t r = { 0 };
+    uint64_t start, t_ref, t_msg;
+    unsigned sum = 0;
+    byte *buf;
+    int i, j, count, numfields;
+
+    count = Cmd_Argc() > 1 ? Q_atoi(Cmd_Argv(1)) : 100000;
+    buf = Z_Malloc(MAX_MSGLEN);
+
+    // enough for a full clc_move with several frames of usercmds
+    numfields = MAX_BITS_FIELDS;
+    for (i = 0; i < numfields; i++) {
+        fields[i].value = Q_rand();
+        fields[i].bits = (i & 3) ? -(int)(1 + Q_rand_uniform(16)) : 1;
+    }
+
+    start = Sys_Microseconds();
+    for (i = 0; i < count; i++) {
+        r.data = buf;
+        r.size = MAX_MSGLEN;
+        r.pos = 0;
+        r.bits_buf = 0;
+        r.bits_left = 32;
+        for (j = 0; j < numfields; j++)
+            ref_write_bits(&r, fields[j].value, fields[j].bits);
+        ref_flush_bits(&r);
+
+        r.size = r.pos;
+        r.pos = 0;
+        r.bits_buf = 0;
+        r.bits_left = 0;
+        for (j = 0; j < numfields; j++)
+            sum += ref_read_bits(&r, fields[j].bits);
+    }
+    t_ref = Sys_Microseconds() - start;
+
+    SZ_TagInit(&msg_write, buf, MAX_MSGLEN, "bitsbench");
+    SZ_Init(&msg_read, buf, MAX_MSGLEN);
+
+    start = Sys_Microseconds();
+    for (i = 0; i < count; i++) {
+        MSG_BeginWriting();
+        for (j = 0; j < numfields; j++)
+            MSG_WriteBits(fields[j].value, fields[j].bits);
+        MSG_FlushBits();
+
+        msg_read.cursize = msg_write.cursize;
+        MSG_BeginReading();
+        for (j = 0; j < numfields; j++)
+            sum -= MSG_ReadBits(fields[j].bits);
+    }
+    t_msg = Sys_Microseconds() - start;
+
+    Z_Free(buf);
+    msg_write = oldwrite;
+    msg_read = oldread;
+
+    Com_Printf("%d frames of %d fields (%s)\n", count, numfields, sum ? "MISMATCH" : "ok");
+    Com_Printf("reference: %.3f us per frame\n", (double)t_ref / count);
+    Com_Printf("msg:       %.3f us per frame\n", (double)t_msg / count);
+}
+
+#endif // USE_CLIENT
+
 typedef struct {
     const char *ext;
     const char *name;
@@ -699,5 +1029,10 @@ void TST_Init(void)
 #endif
     Cmd_AddCommand("mdfourtest", Com_MdfourTest_f);
     Cmd_AddCommand("extcmptest", Com_ExtCmpTest_f);
+#if USE_CLIENT
+    Cmd_AddCommand("bitstest", Com_BitsTest_f);
+    Cmd_AddCommand("bitsbench", Com_BitsBench_f);
+#endif
 }
 
+#endif // USE_TESTS
@@ -20,28 +20,81 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "shared/list.h"
 #include "common/common.h"
 #include "common/zone.h"
+#include "system/pthread.h"
 
-#define Z_MAGIC     0x1d0d
+/*
+Small blocks are carved out of per-tag slabs, one list of slabs per size
+class. Larger blocks come from libc and are linked into per-tag list. This
+makes Z_FreeTags proportional to the number of slabs and large blocks of
+that tag only. All functions are thread safe.
+*/
+
+#define Z_MAGIC         0x1d0d
+#define Z_MAGIC_SLAB    0x1d0e
+
+#define Z_SLAB_SIZE     0x4000
+#define Z_SLAB_MAX      512     // largest block size (with header) in slabs
+#define Z_NUM_CLASSES   12
+
+typedef struct ztag_s   ztag_t;
+typedef struct zslab_s  zslab_t;
 
 typedef struct {
     uint16_t        magic;
     uint16_t        tag;        // for group free
-    size_t          size;
-    list_t          entry;
+    uint32_t        size;       // including header
+    union {
+        ztag_t      *owner;     // large blocks
+        zslab_t     *slab;      // slab blocks
+        uint64_t    pad;
+    };
 } zhead_t;
 
+// large block
+typedef struct {
+    list_t          entry;
+    zhead_t         z;
+} zheap_t;
+
+struct zslab_s {
+    list_t          entry;      // slabs with free blocks are at list head
+    ztag_t          *owner;
+    zhead_t         *free;
+    uint32_t        next;       // offset of the first never used block
+    uint16_t        used;
+    uint16_t        cls;
+};
+
+struct ztag_s {
+    ztag_t          *next;      // game tags
+    memtag_t        tag;
+    list_t          heap;
+    list_t          slabs[Z_NUM_CLASSES];
+    size_t          count;
+    size_t          bytes;
+    size_t          peak;
+    size_t          slab_bytes; // memory taken by slabs
+    size_t          slab_used;  // memory taken by live blocks in slabs
+};
+
 typedef struct {
     zhead_t     z;
-    char        data[2];
+    char        data[16];
 } zstatic_t;
 
-typedef struct {
-    size_t      count;
-    size_t      bytes;
-} zstats_t;
+#define Z_HEAP(z)       ((zheap_t *)((byte *)(z) - q_offsetof(zheap_t, z)))
+#define Z_SLAB_START    ALIGN(sizeof(zslab_t), 16)
+
+static const uint16_t z_classes[Z_NUM_CLASSES] = {
+    32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512
+};
 
-static list_t       z_chain;
-static zstats_t     z_stats[TAG_MAX];
+// maps block size in 16 byte units to size class
+static byte         z_classmap[Z_SLAB_MAX / 16 + 1];
+
+static ztag_t       z_tags[TAG_MAX];
+static ztag_t       *z_gametags;
+static pthread_mutex_t  z_lock = PTHREAD_MUTEX_INITIALIZER;
 
 #define S(d) \
     { .z = { .magic = Z_MAGIC, .tag = TAG_STATIC, .size = sizeof(zstatic_t) }, .data = d }
@@ -67,43 +120,178 @@ static const char *const z_tagnames[TAG_MAX] = {
     "cmodel"
 };
 
-#define TAG_INDEX(tag)  ((tag) < TAG_MAX ? (tag) : TAG_FREE)
+static void Z_InitTag(ztag_t *t, memtag_t tag)
+{
+    int i;
+
+    t->tag = tag;
+    List_Init(&t->heap);
+    for (i = 0; i < Z_NUM_CLASSES; i++)
+        List_Init(&t->slabs[i]);
+}
+
+// game DLL tags are few and created on demand
+static ztag_t *Z_FindTag(memtag_t tag, bool create)
+{
+    ztag_t *t;
+
+    if (tag < TAG_MAX)
+        return &z_tags[tag];
+
+    for (t = z_gametags; t; t = t->next)
+        if (t->tag == tag)
+            return t;
+
+    if (!create)
+        return NULL;
+
+    t = calloc(1, sizeof(*t));
+    if (!t)
+        return NULL;
+
+    Z_InitTag(t, tag);
+    t->next = z_gametags;
+    z_gametags = t;
+    return t;
+}
 
-static inline void Z_CountFree(const zhead_t *z)
+static inline void Z_CountFree(ztag_t *t, const zhead_t *z)
 {
-    zstats_t *s = &z_stats[TAG_INDEX(z->tag)];
-    s->count--;
-    s->bytes -= z->size;
+    t->count--;
+    t->bytes -= z->size;
 }
 
-static inline void Z_CountAlloc(const zhead_t *z)
+static inline void Z_CountAlloc(ztag_t *t, const zhead_t *z)
 {
-    zstats_t *s = &z_stats[TAG_INDEX(z->tag)];
-    s->count++;
-    s->bytes += z->size;
+    t->count++;
+    t->bytes += z->size;
+    if (t->peak < t->bytes)
+        t->peak = t->bytes;
 }
 
+#define Z_IsValid(z) \
+    (((z)->magic == Z_MAGIC || (z)->magic == Z_MAGIC_SLAB) && (z)->tag != TAG_FREE)
+
+// must be called without lock held, Com_Error frees memory
 #define Z_Validate(z) \
-    Q_assert((z)->magic == Z_MAGIC && (z)->tag != TAG_FREE)
+    Q_assert(Z_IsValid(z))
 
-void Z_LeakTest(memtag_t tag)
+static inline bool Z_SlabHasSpace(const zslab_t *s)
+{
+    return s->free || s->next + z_classes[s->cls] <= Z_SLAB_SIZE;
+}
+
+static zhead_t *Z_SlabAlloc(ztag_t *t, int cls)
 {
+    list_t *list = &t->slabs[cls];
+    zslab_t *s = NULL;
     zhead_t *z;
+
+    if (!LIST_EMPTY(list))
+        s = LIST_FIRST(zslab_t, list, entry);
+
+    if (!s || !Z_SlabHasSpace(s)) {
+        s = malloc(Z_SLAB_SIZE);
+        if (!s)
+            return NULL;
+        s->owner = t;
+        s->free = NULL;
+        s->next = Z_SLAB_START;
+        s->used = 0;
+        s->cls = cls;
+        List_Insert(list, &s->entry);
+        t->slab_bytes += Z_SLAB_SIZE;
+    }
+
+    if (s->free) {
+        z = s->free;
+        s->free = *(zhead_t **)(z + 1);
+    } else {
+        z = (zhead_t *)((byte *)s + s->next);
+        s->next += z_classes[cls];
+    }
+
+    s->used++;
+    t->slab_used += z_classes[cls];
+
+    // full slabs go to list tail
+    if (!Z_SlabHasSpace(s)) {
+        List_Remove(&s->entry);
+        List_Append(list, &s->entry);
+    }
+
+    z->magic = Z_MAGIC_SLAB;
+    z->slab = s;
+    return z;
+}
+
+static void Z_SlabFree(zhead_t *z)
+{
+    zslab_t *s = z->slab;
+    ztag_t *t = s->owner;
+    list_t *list = &t->slabs[s->cls];
+    bool full = !Z_SlabHasSpace(s);
+
+    *(zhead_t **)(z + 1) = s->free;
+    s->free = z;
+    s->used--;
+    t->slab_used -= z_classes[s->cls];
+
+    // keep one slab around to avoid thrashing
+    if (!s->used && !LIST_SINGLE(list)) {
+        List_Remove(&s->entry);
+        t->slab_bytes -= Z_SLAB_SIZE;
+        free(s);
+    } else if (full) {
+        List_Remove(&s->entry);
+        List_Insert(list, &s->entry);
+    }
+}
+
+// must be called with lock held, after validating the block
+static void Z_FreeInternal(zhead_t *z)
+{
+    if (z->tag == TAG_STATIC) {
+        Z_CountFree(&z_tags[TAG_STATIC], z);
+        return;
+    }
+
+    z->tag = TAG_FREE;
+
+    if (z->magic == Z_MAGIC_SLAB) {
+        Z_CountFree(z->slab->owner, z);
+        Z_SlabFree(z);
+    } else {
+        zheap_t *h = Z_HEAP(z);
+        Z_CountFree(z->owner, z);
+        List_Remove(&h->entry);
+        z->magic = 0xdead;
+        free(h);
+    }
+}
+
+void Z_LeakTest(memtag_t tag)
+{
     size_t numLeaks = 0, numBytes = 0;
+    ztag_t *t;
 
-    LIST_FOR_EACH(zhead_t, z, &z_chain, entry) {
-        Z_Validate(z);
-        if (z->tag == tag || (tag == TAG_FREE && z->tag >= TAG_MAX)) {
-            numLeaks++;
-            numBytes += z->size;
+    pthread_mutex_lock(&z_lock);
+    if (tag == TAG_FREE) {
+        for (t = z_gametags; t; t = t->next) {
+            numLeaks += t->count;
+            numBytes += t->bytes;
         }
+    } else if ((t = Z_FindTag(tag, false))) {
+        numLeaks = t->count;
+        numBytes = t->bytes;
     }
+    pthread_mutex_unlock(&z_lock);
 
     if (numLeaks) {
         Com_WPrintf("************* Z_LeakTest *************\n"
                     "%s leaked %zu bytes of memory (%zu object%s)\n"
                     "**************************************\n",
-                    z_tagnames[TAG_INDEX(tag)],
+                    z_tagnames[tag < TAG_MAX ? tag : TAG_FREE],
                     numBytes, numLeaks, numLeaks == 1 ? "" : "s");
     }
 }
@@ -115,24 +303,15 @@ Z_Free
 */
 void Z_Free(void *ptr)
 {
-    zhead_t *z;
-
     if (!ptr) {
         return;
     }
 
-    z = (zhead_t *)ptr - 1;
+    Z_Validate((zhead_t *)ptr - 1);
 
-    Z_Validate(z);
-
-    Z_CountFree(z);
-
-    if (z->tag != TAG_STATIC) {
-        List_Remove(&z->entry);
-        z->magic = 0xdead;
-        z->tag = TAG_FREE;
-        free(z);
-    }
+    pthread_mutex_lock(&z_lock);
+    Z_FreeInternal((zhead_t *)ptr - 1);
+    pthread_mutex_unlock(&z_lock);
 }
 
 /*
@@ -157,6 +336,9 @@ Z_Realloc
 void *Z_Realloc(void *ptr, size_t size)
 {
     zhead_t *z;
+    zheap_t *h;
+    ztag_t *t;
+    void *copy;
 
     if (!ptr) {
         return Z_Malloc(size);
@@ -172,27 +354,60 @@ void *Z_Realloc(void *ptr, size_t size)
     Z_Validate(z);
 
     Q_assert(size <= INT_MAX);
+    Q_assert(z->tag != TAG_STATIC);
 
-    size += sizeof(*z);
-    if (z->size == size) {
-        return z + 1;
+    // slab blocks are moved when they outgrow their size class
+    if (z->magic == Z_MAGIC_SLAB) {
+        if (size + sizeof(*z) <= z_classes[z->slab->cls]) {
+            pthread_mutex_lock(&z_lock);
+            t = z->slab->owner;
+            Z_CountFree(t, z);
+            z->size = size + sizeof(*z);
+            Z_CountAlloc(t, z);
+            pthread_mutex_unlock(&z_lock);
+            return ptr;
+        }
+        copy = Z_TagMalloc(size, z->tag);
+        memcpy(copy, ptr, min(size, z->size - sizeof(*z)));
+        Z_Free(ptr);
+        return copy;
     }
 
-    Q_assert(z->tag != TAG_STATIC);
+    size += sizeof(*h);
+    if (z->size == size - q_offsetof(zheap_t, z)) {
+        return ptr;
+    }
 
-    Z_CountFree(z);
+    pthread_mutex_lock(&z_lock);
 
-    z = realloc(z, size);
-    if (!z) {
+    t = z->owner;
+    Z_CountFree(t, z);
+
+    h = realloc(Z_HEAP(z), size);
+    if (!h) {
+        pthread_mutex_unlock(&z_lock);
         Com_Error(ERR_FATAL, "%s: couldn't realloc %zu bytes", __func__, size);
     }
 
-    z->size = size;
-    List_Relink(&z->entry);
+    h->z.size = size - q_offsetof(zheap_t, z);
+    List_Relink(&h->entry);
 
-    Z_CountAlloc(z);
+    Z_CountAlloc(t, &h->z);
 
-    return z + 1;
+    pthread_mutex_unlock(&z_lock);
+
+    return &h->z + 1;
+}
+
+static void Z_PrintStats(const char *name, const ztag_t *t)
+{
+    int frag = 0;
+
+    if (t->slab_bytes)
+        frag = 100 - (int)(t->slab_used * 100 / t->slab_bytes);
+
+    Com_Printf("%9zu %9zu %6zu %7zu %3d%% %s\n", t->bytes, t->peak,
+               t->count, t->slab_bytes / 1024, frag, name);
 }
 
 /*
@@ -202,25 +417,40 @@ Z_Stats_f
 */
 void Z_Stats_f(void)
 {
-    size_t bytes = 0, count = 0;
-    zstats_t *s;
+    ztag_t total = { 0 }, game = { 0 };
+    const ztag_t *t;
     int i;
 
-    Com_Printf("    bytes blocks name\n"
-               "--------- ------ -------\n");
+    Com_Printf("    bytes      peak blocks slab KB frag name\n"
+               "--------- --------- ------ ------- ---- -------\n");
+
+    pthread_mutex_lock(&z_lock);
 
-    for (i = 0, s = z_stats; i < TAG_MAX; i++, s++) {
-        if (!s->count) {
+    for (t = z_gametags; t; t = t->next) {
+        game.count += t->count;
+        game.bytes += t->bytes;
+        game.peak += t->peak;
+        game.slab_bytes += t->slab_bytes;
+        game.slab_used += t->slab_used;
+    }
+
+    for (i = 0; i < TAG_MAX; i++) {
+        t = i ? &z_tags[i] : &game;
+        if (!t->peak) {
             continue;
         }
-        Com_Printf("%9zu %6zu %s\n", s->bytes, s->count, z_tagnames[i]);
-        bytes += s->bytes;
-        count += s->count;
+        Z_PrintStats(z_tagnames[i], t);
+        total.count += t->count;
+        total.bytes += t->bytes;
+        total.peak += t->peak;
+        total.slab_bytes += t->slab_bytes;
+        total.slab_used += t->slab_used;
     }
 
-    Com_Printf("--------- ------ -------\n"
-               "%9zu %6zu total\n",
-               bytes, count);
+    pthread_mutex_unlock(&z_lock);
+
+    Com_Printf("--------- --------- ------ ------- ---- -------\n");
+    Z_PrintStats("total", &total);
 }
 
 /*
@@ -230,13 +460,45 @@ Z_FreeTags
 */
 void Z_FreeTags(memtag_t tag)
 {
-    zhead_t *z, *n;
+    zslab_t *s, *sn;
+    zheap_t *h, *hn;
+    zhead_t *bad = NULL;
+    ztag_t *t;
+    int i;
+
+    pthread_mutex_lock(&z_lock);
+
+    t = Z_FindTag(tag, false);
+    if (!t || tag == TAG_STATIC) {
+        pthread_mutex_unlock(&z_lock);
+        return;
+    }
+
+    for (i = 0; i < Z_NUM_CLASSES; i++) {
+        LIST_FOR_EACH_SAFE(zslab_t, s, sn, &t->slabs[i], entry) {
+            free(s);
+        }
+        List_Init(&t->slabs[i]);
+    }
 
-    LIST_FOR_EACH_SAFE(zhead_t, z, n, &z_chain, entry) {
-        Z_Validate(z);
-        if (z->tag == tag) {
-            Z_Free(z + 1);
+    LIST_FOR_EACH_SAFE(zheap_t, h, hn, &t->heap, entry) {
+        if (!Z_IsValid(&h->z)) {
+            bad = &h->z;
+            break;
         }
+        List_Remove(&h->entry);
+        h->z.magic = 0xdead;
+        free(h);
+    }
+
+    t->count = t->bytes = 0;
+    t->slab_bytes = t->slab_used = 0;
+
+    pthread_mutex_unlock(&z_lock);
+
+    // report after unlocking, error shutdown frees memory
+    if (bad) {
+        Com_Error(ERR_FATAL, "%s: bad memory block %p", __func__, (void *)bad);
     }
 }
 
@@ -248,6 +510,8 @@ Z_TagMalloc
 static void *Z_TagMallocInternal(size_t size, memtag_t tag, bool init)
 {
     zhead_t *z;
+    zheap_t *h;
+    ztag_t *t;
 
     if (!size) {
         return NULL;
@@ -257,15 +521,39 @@ static void *Z_TagMallocInternal(size_t size, memtag_t tag, bool init)
     Q_assert(tag > TAG_FREE && tag <= UINT16_MAX);
 
     size += sizeof(*z);
-    z = init ? calloc(1, size) : malloc(size);
+
+    pthread_mutex_lock(&z_lock);
+
+    t = Z_FindTag(tag, true);
+    if (!t) {
+        z = NULL;
+    } else if (size <= Z_SLAB_MAX) {
+        z = Z_SlabAlloc(t, z_classmap[(size + 15) >> 4]);
+        if (z && init) {
+            memset(z + 1, 0, size - sizeof(*z));
+        }
+    } else {
+        size_t total = size + q_offsetof(zheap_t, z);
+        h = init ? calloc(1, total) : malloc(total);
+        if (h) {
+            List_Append(&t->heap, &h->entry);
+            h->z.magic = Z_MAGIC;
+            h->z.owner = t;
+        }
+        z = h ? &h->z : NULL;
+    }
+
     if (!z) {
+        pthread_mutex_unlock(&z_lock);
         Com_Error(ERR_FATAL, "%s: couldn't allocate %zu bytes", __func__, size);
     }
-    z->magic = Z_MAGIC;
+
     z->tag = tag;
     z->size = size;
 
-    List_Insert(&z_chain, &z->entry);
+    Z_CountAlloc(t, z);
+
+    pthread_mutex_unlock(&z_lock);
 
 #if USE_TESTS
     if (!init && z_perturb && z_perturb->integer) {
@@ -273,8 +561,6 @@ static void *Z_TagMallocInternal(size_t size, memtag_t tag, bool init)
     }
 #endif
 
-    Z_CountAlloc(z);
-
     return z + 1;
 }
 
@@ -305,7 +591,16 @@ Z_Init
 */
 void Z_Init(void)
 {
-    List_Init(&z_chain);
+    int i, cls;
+
+    for (i = 0; i < TAG_MAX; i++)
+        Z_InitTag(&z_tags[i], i);
+
+    for (i = 0, cls = 0; i <= Z_SLAB_MAX / 16; i++) {
+        while (z_classes[cls] < i * 16)
+            cls++;
+        z_classmap[i] = cls;
+    }
 }
 
 /*
@@ -349,6 +644,8 @@ char *Z_CvarCopyString(const char *in)
 
     // return static storage
     z = &z_static[i];
-    Z_CountAlloc(&z->z);
+    pthread_mutex_lock(&z_lock);
+    Z_CountAlloc(&z_tags[TAG_STATIC], &z->z);
+    pthread_mutex_unlock(&z_lock);
     return (char *)z->data;
 }
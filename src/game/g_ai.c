@@ -269,6 +269,12 @@ bool visible(edict_t *self, edict_t *other)
     spot1[2] += self->viewheight;
     VectorCopy(other->s.origin, spot2);
     spot2[2] += other->viewheight;
+
+    // cheap reject before tracing, can't see through solid world
+    // or closed area portals
+    if (!gi.inPVS(spot1, spot2))
+        return false;
+
     trace = gi.trace(spot1, vec3_origin, vec3_origin, spot2, self, MASK_OPAQUE);
 
     if (trace.fraction == 1.0f)
@@ -349,7 +355,7 @@ void FoundTarget(edict_t *self)
     self->monsterinfo.aiflags |= AI_COMBAT_POINT;
 
     // clear the targetname, that point is ours!
-    self->movetarget->targetname = NULL;
+    G_SetTargetname(self->movetarget, NULL);
     self->monsterinfo.pause_framenum = 0;
 
     // run for it
@@ -48,6 +48,29 @@ bool CanDamage(edict_t *targ, edict_t *inflictor)
     if (trace.fraction == 1.0f)
         return true;
 
+    // trace all corners at once if engine supports it
+    if (gix && gix->apiversion >= 2) {
+        vec3_t  starts[4], ends[4];
+        trace_t traces[4];
+        int     i;
+
+        for (i = 0; i < 4; i++) {
+            VectorCopy(inflictor->s.origin, starts[i]);
+            VectorCopy(targ->s.origin, ends[i]);
+            ends[i][0] += (i & 2) ? -15.0f : 15.0f;
+            ends[i][1] += (i & 1) ? -15.0f : 15.0f;
+        }
+
+        gix->TraceBatch(traces, (const vec3_t *)starts, (const vec3_t *)ends, 4,
+                        vec3_origin, vec3_origin, inflictor, MASK_SOLID);
+
+        for (i = 0; i < 4; i++)
+            if (traces[i].fraction == 1.0f)
+                return true;
+
+        return false;
+    }
+
     VectorCopy(targ->s.origin, dest);
     dest[0] += 15.0f;
     dest[1] += 15.0f;
@@ -429,6 +429,7 @@ typedef struct {
 extern  game_locals_t   game;
 extern  level_locals_t  level;
 extern  game_import_t   gi;
+extern  const game_import_ex_t  *gix;
 extern  game_export_t   globals;
 extern  spawn_temp_t    st;
 
@@ -598,6 +599,12 @@ const gitem_t *GetItemByIndex(int index);
 bool Add_Ammo(edict_t *ent, const gitem_t *item, int count);
 void Touch_Item(edict_t *ent, edict_t *other, cplane_t *plane, csurface_t *surf);
 
+//
+// g_spawn.c
+//
+void ED_InitSpawnHash(void);
+void ED_CallSpawn(edict_t *ent);
+
 //
 // g_utils.c
 //
@@ -613,6 +620,11 @@ void    G_InitEdict(edict_t *e);
 edict_t *G_Spawn(void);
 void    G_FreeEdict(edict_t *e);
 
+void    G_ClearTargetnames(void);
+void    G_LinkTargetname(edict_t *ent);
+void    G_UnlinkTargetname(edict_t *ent);
+void    G_SetTargetname(edict_t *ent, char *targetname);
+
 void    G_TouchTriggers(edict_t *ent);
 void    G_TouchSolids(edict_t *ent);
 
@@ -738,6 +750,12 @@ void ClientBeginServerFrame(edict_t *ent);
 void player_pain(edict_t *self, edict_t *other, float kick, int damage);
 void player_die(edict_t *self, edict_t *inflictor, edict_t *attacker, int damage, vec3_t point);
 
+//
+// g_save.c
+//
+void G_FreeSaveBuffers(void);
+void Svcmd_SaveBench_f(void);
+
 //
 // g_svcmds.c
 //
@@ -988,7 +1006,7 @@ struct edict_s {
 
     float       angle;          // set in qe3, -1 = up, -2 = down
     char        *target;
-    char        *targetname;
+    char        *targetname;    // use G_SetTargetname to change
     char        *killtarget;
     char        *team;
     char        *pathtarget;
@@ -1082,6 +1100,11 @@ struct edict_s {
 
     const gitem_t   *item;      // for bonus items
 
+    // targetname index chain, see G_LinkTargetname
+    edict_t     *targetname_next;
+    unsigned    targetname_hash;
+    bool        targetname_linked;
+
     // common data blocks
     moveinfo_t      moveinfo;
     monsterinfo_t   monsterinfo;
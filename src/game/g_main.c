@@ -22,6 +22,7 @@ game_locals_t   game;
 level_locals_t  level;
 game_import_t   gi;
 game_export_t   globals;
+const game_import_ex_t  *gix;   // NULL if engine has no extended API
 spawn_temp_t    st;
 
 int sm_meat_index;
@@ -100,6 +101,8 @@ void ShutdownGame(void)
 
     gi.FreeTags(TAG_LEVEL);
     gi.FreeTags(TAG_GAME);
+
+    G_FreeSaveBuffers();
 }
 
 /*
@@ -196,6 +199,7 @@ void InitGame(void)
 
     // items
     InitItems();
+    ED_InitSpawnHash();
 
     game.helpmessage1[0] = 0;
     game.helpmessage2[0] = 0;
@@ -250,6 +254,25 @@ q_exported game_export_t *GetGameAPI(game_import_t *import)
     return &globals;
 }
 
+/*
+=================
+GetExtendedGameAPI
+
+Called by newer engines after GetGameAPI. Imports must be checked against
+apiversion before use, older engines export shorter structure.
+=================
+*/
+q_exported const game_export_ex_t *GetExtendedGameAPI(const game_import_ex_t *import)
+{
+    static const game_export_ex_t globals_ex = {
+        .apiversion = GAME_API_VERSION_EX,
+    };
+
+    gix = import;
+
+    return &globals_ex;
+}
+
 #ifndef GAME_HARD_LINKED
 // this is only here so the functions in q_shared.c can link
 void Com_LPrintf(print_type_t type, const char *fmt, ...)
@@ -18,18 +18,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "g_local.h"
 #include "g_ptrs.h"
+#include "common/intreadwrite.h"
 
 #if USE_ZLIB
 #include <zlib.h>
-#else
-#define gzopen(name, mode)          fopen(name, mode)
-#define gzclose(file)               fclose(file)
-#define gzwrite(file, buf, len)     fwrite(buf, 1, len, file)
-#define gzread(file, buf, len)      fread(buf, 1, len, file)
-#define gzbuffer(file, size)        (void)0
-#define gzFile                      FILE *
 #endif
 
+#include <time.h>
+
 typedef struct {
     fieldtype_t type;
 #if USE_DEBUG
@@ -443,33 +439,95 @@ static const save_field_t gamefields[] = {
 
 //=========================================================
 
-static void write_data(void *buf, size_t len, gzFile f)
+/*
+Savegames are serialized into memory and then compressed in one pass.
+File layout, all values little endian:
+
+    uint32  SAVE_PACKED
+    uint32  uncompressed length
+    byte    zlib stream
+
+Uncompressed data starts with SAVE_MAGIC1 or SAVE_MAGIC2, followed by
+version and fields. Older gzip compressed and raw savegames are still
+accepted on load.
+*/
+
+#define SAVE_PACKED     MakeLittleLong('S','A','V','Z')
+#define SAVE_MAXSIZE    0x10000000
+
+typedef struct {
+    byte    *data;
+    size_t  size;       // allocated
+    size_t  len;        // written
+    size_t  pos;        // read position
+} savefile_t;
+
+// buffers are kept around between saves, since gi.error() may longjmp
+// out of the middle of reading or writing
+static savefile_t   save_buffer;
+static savefile_t   save_packed;
+
+static void reserve_data(savefile_t *f, size_t len)
 {
-    if (gzwrite(f, buf, len) != len) {
-        gzclose(f);
-        gi.error("%s: couldn't write %zu bytes", __func__, len);
-    }
+    byte *data;
+    size_t size;
+
+    if (len > SAVE_MAXSIZE)
+        gi.error("%s: savegame too large", __func__);
+
+    if (f->size >= len)
+        return;
+
+    for (size = max(f->size, 0x10000); size < len; size <<= 1)
+        ;
+
+    data = realloc(f->data, size);
+    if (!data)
+        gi.error("%s: couldn't allocate %zu bytes", __func__, size);
+    f->data = data;
+    f->size = size;
+}
+
+void G_FreeSaveBuffers(void)
+{
+    free(save_buffer.data);
+    free(save_packed.data);
+    memset(&save_buffer, 0, sizeof(save_buffer));
+    memset(&save_packed, 0, sizeof(save_packed));
 }
 
-static void write_short(gzFile f, int16_t v)
+static savefile_t *begin_write(void)
+{
+    save_buffer.len = save_buffer.pos = 0;
+    return &save_buffer;
+}
+
+static void write_data(void *buf, size_t len, savefile_t *f)
+{
+    reserve_data(f, f->len + len);
+    memcpy(f->data + f->len, buf, len);
+    f->len += len;
+}
+
+static void write_short(savefile_t *f, int16_t v)
 {
     v = LittleShort(v);
     write_data(&v, sizeof(v), f);
 }
 
-static void write_int(gzFile f, int32_t v)
+static void write_int(savefile_t *f, int32_t v)
 {
     v = LittleLong(v);
     write_data(&v, sizeof(v), f);
 }
 
-static void write_float(gzFile f, float v)
+static void write_float(savefile_t *f, float v)
 {
     v = LittleFloat(v);
     write_data(&v, sizeof(v), f);
 }
 
-static void write_string(gzFile f, char *s)
+static void write_string(savefile_t *f, char *s)
 {
     size_t len;
 
@@ -480,21 +538,20 @@ static void write_string(gzFile f, char *s)
 
     len = strlen(s);
     if (len >= 65536) {
-        gzclose(f);
         gi.error("%s: bad length", __func__);
     }
     write_int(f, len);
     write_data(s, len, f);
 }
 
-static void write_vector(gzFile f, vec_t *v)
+static void write_vector(savefile_t *f, vec_t *v)
 {
     write_float(f, v[0]);
     write_float(f, v[1]);
     write_float(f, v[2]);
 }
 
-static void write_index(gzFile f, void *p, size_t size, const void *start, int max_index)
+static void write_index(savefile_t *f, void *p, size_t size, const void *start, int max_index)
 {
     uintptr_t diff;
 
@@ -505,17 +562,15 @@ static void write_index(gzFile f, void *p, size_t size, const void *start, int m
 
     diff = (uintptr_t)p - (uintptr_t)start;
     if (diff > max_index * size) {
-        gzclose(f);
         gi.error("%s: pointer out of range: %p", __func__, p);
     }
     if (diff % size) {
-        gzclose(f);
         gi.error("%s: misaligned pointer: %p", __func__, p);
     }
     write_int(f, (int)(diff / size));
 }
 
-static void write_pointer(gzFile f, void *p, ptr_type_t type)
+static void write_pointer(savefile_t *f, void *p, ptr_type_t type)
 {
     const save_ptr_t *ptr;
     int i;
@@ -532,11 +587,10 @@ static void write_pointer(gzFile f, void *p, ptr_type_t type)
         }
     }
 
-    gzclose(f);
     gi.error("%s: unknown pointer: %p", __func__, p);
 }
 
-static void write_field(gzFile f, const save_field_t *field, void *base)
+static void write_field(savefile_t *f, const save_field_t *field, void *base)
 {
     void *p = (byte *)base + field->ofs;
     int i;
@@ -602,7 +656,7 @@ static void write_field(gzFile f, const save_field_t *field, void *base)
     }
 }
 
-static void write_fields(gzFile f, const save_field_t *fields, void *base)
+static void write_fields(savefile_t *f, const save_field_t *fields, void *base)
 {
     const save_field_t *field;
 
@@ -612,21 +666,22 @@ static void write_fields(gzFile f, const save_field_t *fields, void *base)
 }
 
 typedef struct game_read_context_s {
-    gzFile f;
+    savefile_t *f;
     bool frametime_is_float;
     const save_ptr_t* save_ptrs;
     int num_save_ptrs;
 } game_read_context_t;
 
-static void read_data(void *buf, size_t len, gzFile f)
+static void read_data(void *buf, size_t len, savefile_t *f)
 {
-    if (gzread(f, buf, len) != len) {
-        gzclose(f);
+    if (len > f->len - f->pos) {
         gi.error("%s: couldn't read %zu bytes", __func__, len);
     }
+    memcpy(buf, f->data + f->pos, len);
+    f->pos += len;
 }
 
-static int read_short(gzFile f)
+static int read_short(savefile_t *f)
 {
     int16_t v;
 
@@ -636,7 +691,7 @@ static int read_short(gzFile f)
     return v;
 }
 
-static int read_int(gzFile f)
+static int read_int(savefile_t *f)
 {
     int32_t v;
 
@@ -646,7 +701,7 @@ static int read_int(gzFile f)
     return v;
 }
 
-static float read_float(gzFile f)
+static float read_float(savefile_t *f)
 {
     float v;
 
@@ -656,7 +711,7 @@ static float read_float(gzFile f)
     return v;
 }
 
-static char *read_string(gzFile f)
+static char *read_string(savefile_t *f)
 {
     int len;
     char *s;
@@ -667,7 +722,6 @@ static char *read_string(gzFile f)
     }
 
     if (len < 0 || len >= 65536) {
-        gzclose(f);
         gi.error("%s: bad length", __func__);
     }
 
@@ -678,13 +732,12 @@ static char *read_string(gzFile f)
     return s;
 }
 
-static void read_zstring(gzFile f, char *s, size_t size)
+static void read_zstring(savefile_t *f, char *s, size_t size)
 {
     int len;
 
     len = read_int(f);
     if (len < 0 || len >= size) {
-        gzclose(f);
         gi.error("%s: bad length", __func__);
     }
 
@@ -692,14 +745,14 @@ static void read_zstring(gzFile f, char *s, size_t size)
     s[len] = 0;
 }
 
-static void read_vector(gzFile f, vec_t *v)
+static void read_vector(savefile_t *f, vec_t *v)
 {
     v[0] = read_float(f);
     v[1] = read_float(f);
     v[2] = read_float(f);
 }
 
-static void *read_index(gzFile f, size_t size, const void *start, int max_index)
+static void *read_index(savefile_t *f, size_t size, const void *start, int max_index)
 {
     int index;
     byte *p;
@@ -710,7 +763,6 @@ static void *read_index(gzFile f, size_t size, const void *start, int max_index)
     }
 
     if (index < 0 || index > max_index) {
-        gzclose(f);
         gi.error("%s: bad index", __func__);
     }
 
@@ -729,13 +781,11 @@ static void *read_pointer(game_read_context_t* ctx, ptr_type_t type)
     }
 
     if (index < 0 || index >= ctx->num_save_ptrs) {
-        gzclose(ctx->f);
         gi.error("%s: bad index", __func__);
     }
 
     ptr = &ctx->save_ptrs[index];
     if (ptr->type != type) {
-        gzclose(ctx->f);
         gi.error("%s: type mismatch", __func__);
     }
 
@@ -832,9 +882,142 @@ static void read_fields(game_read_context_t* ctx, const save_field_t *fields, vo
 static void check_gzip(int magic)
 {
 #if !USE_ZLIB
-    if ((magic & 0xe0ffffff) == 0x00088b1f)
-        gi.error("Savegame is compressed, but no gzip support linked in");
+    if ((magic & 0xe0ffffff) == 0x00088b1f || magic == SAVE_PACKED)
+        gi.error("Savegame is compressed, but no zlib support linked in");
+#endif
+}
+
+#if USE_ZLIB
+
+// compresses save_buffer into save_packed
+static void pack_savefile(int level)
+{
+    uLongf len = compressBound(save_buffer.len);
+
+    save_packed.len = save_packed.pos = 0;
+    reserve_data(&save_packed, len + 8);
+
+    WL32(save_packed.data, SAVE_PACKED);
+    WL32(save_packed.data + 4, save_buffer.len);
+    if (compress2(save_packed.data + 8, &len, save_buffer.data, save_buffer.len, level) != Z_OK)
+        gi.error("%s: couldn't compress savegame", __func__);
+
+    save_packed.len = len + 8;
+}
+
+// decompresses save_packed into save_buffer
+static void unpack_savefile(void)
+{
+    uLongf len = RL32(save_packed.data + 4);
+
+    save_buffer.len = save_buffer.pos = 0;
+    reserve_data(&save_buffer, len);
+
+    if (uncompress(save_buffer.data, &len, save_packed.data + 8, save_packed.len - 8) != Z_OK ||
+        len != RL32(save_packed.data + 4))
+        gi.error("%s: couldn't uncompress savegame", __func__);
+
+    save_buffer.len = len;
+}
+
+// decompresses gzip file written by older versions into save_buffer
+static void unpack_gzip(void)
+{
+    z_stream z;
+    int ret;
+
+    memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, MAX_WBITS + 16) != Z_OK)
+        gi.error("%s: inflateInit2 failed", __func__);
+
+    save_buffer.len = save_buffer.pos = 0;
+    reserve_data(&save_buffer, save_packed.len * 4);
+
+    z.next_in = save_packed.data;
+    z.avail_in = save_packed.len;
+    do {
+        if (save_buffer.len == save_buffer.size)
+            reserve_data(&save_buffer, save_buffer.size * 2);
+        z.next_out = save_buffer.data + save_buffer.len;
+        z.avail_out = save_buffer.size - save_buffer.len;
+        ret = inflate(&z, Z_NO_FLUSH);
+        save_buffer.len = save_buffer.size - z.avail_out;
+    } while (ret == Z_OK);
+
+    inflateEnd(&z);
+
+    if (ret != Z_STREAM_END)
+        gi.error("%s: couldn't uncompress savegame", __func__);
+}
+
+#endif
+
+static void write_savefile(const char *filename)
+{
+    const savefile_t *out = &save_buffer;
+    FILE *fp;
+
+#if USE_ZLIB
+    pack_savefile(Z_BEST_SPEED);
+    out = &save_packed;
 #endif
+
+    fp = fopen(filename, "wb");
+    if (!fp)
+        gi.error("Couldn't open %s", filename);
+
+    if (fwrite(out->data, 1, out->len, fp) != out->len) {
+        fclose(fp);
+        gi.error("Couldn't write %s", filename);
+    }
+
+    if (fclose(fp))
+        gi.error("Couldn't write %s", filename);
+}
+
+static savefile_t *read_savefile(const char *filename)
+{
+    FILE *fp;
+    long len;
+
+    fp = fopen(filename, "rb");
+    if (!fp)
+        gi.error("Couldn't open %s", filename);
+
+    if (fseek(fp, 0, SEEK_END) || (len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET)) {
+        fclose(fp);
+        gi.error("Couldn't read %s", filename);
+    }
+
+    if (len > SAVE_MAXSIZE) {
+        fclose(fp);
+        gi.error("%s is too large", filename);
+    }
+
+    save_packed.len = save_packed.pos = 0;
+    reserve_data(&save_packed, len);
+
+    if (fread(save_packed.data, 1, len, fp) != len) {
+        fclose(fp);
+        gi.error("Couldn't read %s", filename);
+    }
+    fclose(fp);
+
+    save_packed.len = len;
+
+#if USE_ZLIB
+    if (len >= 8 && RL32(save_packed.data) == SAVE_PACKED) {
+        unpack_savefile();
+        return &save_buffer;
+    }
+    if (len >= 2 && save_packed.data[0] == 0x1f && save_packed.data[1] == 0x8b) {
+        unpack_gzip();
+        return &save_buffer;
+    }
+#endif
+
+    // uncompressed
+    return &save_packed;
 }
 
 /*
@@ -853,15 +1036,13 @@ last save position.
 */
 void WriteGame(const char *filename, qboolean autosave)
 {
-    gzFile  f;
+    savefile_t *f;
     int     i;
 
     if (!autosave)
         SaveClientData();
 
-    f = gzopen(filename, "wb");
-    if (!f)
-        gi.error("Couldn't open %s", filename);
+    f = begin_write();
 
     write_int(f, SAVE_MAGIC1);
     write_int(f, SAVE_VERSION);
@@ -874,11 +1055,10 @@ void WriteGame(const char *filename, qboolean autosave)
         write_fields(f, clientfields, &game.clients[i]);
     }
 
-    if (gzclose(f))
-        gi.error("Couldn't write %s", filename);
+    write_savefile(filename);
 }
 
-static game_read_context_t make_read_context(gzFile f, int version)
+static game_read_context_t make_read_context(savefile_t *f, int version)
 {
     game_read_context_t ctx;
     ctx.f = f;
@@ -898,20 +1078,15 @@ static game_read_context_t make_read_context(gzFile f, int version)
 
 void ReadGame(const char *filename)
 {
-    gzFile  f;
+    savefile_t *f;
     int     i;
 
     gi.FreeTags(TAG_GAME);
 
-    f = gzopen(filename, "rb");
-    if (!f)
-        gi.error("Couldn't open %s", filename);
-
-    gzbuffer(f, 65536);
+    f = read_savefile(filename);
 
     i = read_int(f);
     if (i != SAVE_MAGIC1) {
-        gzclose(f);
         check_gzip(i);
         gi.error("Not a Q2PRO save game");
     }
@@ -919,7 +1094,6 @@ void ReadGame(const char *filename)
     i = read_int(f);
     if ((i != SAVE_VERSION)  && (i != 2)) {
         // Version 2 was written by Q2RTX 1.5.0, and the savegame code was crafted such to allow reading it
-        gzclose(f);
         gi.error("Savegame from different version (got %d, expected %d)", i, SAVE_VERSION);
     }
 
@@ -929,11 +1103,9 @@ void ReadGame(const char *filename)
 
     // should agree with server's version
     if (game.maxclients != (int)maxclients->value) {
-        gzclose(f);
         gi.error("Savegame has bad maxclients");
     }
     if (game.maxentities <= game.maxclients || game.maxentities > game.csr.max_edicts) {
-        gzclose(f);
         gi.error("Savegame has bad maxentities");
     }
 
@@ -945,8 +1117,6 @@ void ReadGame(const char *filename)
     for (i = 0; i < game.maxclients; i++) {
         read_fields(&ctx, clientfields, &game.clients[i]);
     }
-
-    gzclose(f);
 }
 
 //==========================================================
@@ -957,15 +1127,10 @@ WriteLevel
 
 =================
 */
-void WriteLevel(const char *filename)
+static void write_level(savefile_t *f)
 {
     int     i;
     edict_t *ent;
-    gzFile  f;
-
-    f = gzopen(filename, "wb");
-    if (!f)
-        gi.error("Couldn't open %s", filename);
 
     write_int(f, SAVE_MAGIC2);
     write_int(f, SAVE_VERSION);
@@ -982,9 +1147,12 @@ void WriteLevel(const char *filename)
         write_fields(f, entityfields, ent);
     }
     write_int(f, -1);
+}
 
-    if (gzclose(f))
-        gi.error("Couldn't write %s", filename);
+void WriteLevel(const char *filename)
+{
+    write_level(begin_write());
+    write_savefile(filename);
 }
 
 /*
@@ -1006,7 +1174,7 @@ No clients are connected yet.
 void ReadLevel(const char *filename)
 {
     int     entnum;
-    gzFile  f;
+    savefile_t *f;
     int     i;
     edict_t *ent;
 
@@ -1014,19 +1182,15 @@ void ReadLevel(const char *filename)
     // base state
     gi.FreeTags(TAG_LEVEL);
 
-    f = gzopen(filename, "rb");
-    if (!f)
-        gi.error("Couldn't open %s", filename);
-
-    gzbuffer(f, 65536);
+    f = read_savefile(filename);
 
     // wipe all the entities
     memset(g_edicts, 0, game.maxentities * sizeof(g_edicts[0]));
+    G_ClearTargetnames();
     globals.num_edicts = maxclients->value + 1;
 
     i = read_int(f);
     if (i != SAVE_MAGIC2) {
-        gzclose(f);
         check_gzip(i);
         gi.error("Not a Q2PRO save game");
     }
@@ -1034,7 +1198,6 @@ void ReadLevel(const char *filename)
     i = read_int(f);
     if ((i != SAVE_VERSION) && (i != 2)) {
         // Version 2 was written by Q2RTX 1.5.0, and the savegame code was crafted such to allow reading it
-        gzclose(f);
         gi.error("Savegame from different version (got %d, expected %d)", i, SAVE_VERSION);
     }
 
@@ -1049,7 +1212,6 @@ void ReadLevel(const char *filename)
         if (entnum == -1)
             break;
         if (entnum < 0 || entnum >= game.maxentities) {
-            gzclose(f);
             gi.error("%s: bad entity number", __func__);
         }
         if (entnum >= globals.num_edicts)
@@ -1059,14 +1221,13 @@ void ReadLevel(const char *filename)
         read_fields(&ctx, entityfields, ent);
         ent->inuse = true;
         ent->s.number = entnum;
+        G_LinkTargetname(ent);
 
         // let the server rebuild world links for this ent
         memset(&ent->area, 0, sizeof(ent->area));
         gi.linkentity(ent);
     }
 
-    gzclose(f);
-
     // mark all clients as unconnected
     for (i = 0; i < maxclients->value; i++) {
         ent = &g_edicts[i + 1];
@@ -1097,3 +1258,114 @@ void ReadLevel(const char *filename)
     }
 }
 
+//==========================================================
+
+static void free_strings(const save_field_t *fields, void *base)
+{
+    const save_field_t *field;
+    char **p;
+
+    for (field = fields; field->type; field++) {
+        if (field->type != F_LSTRING)
+            continue;
+        p = (char **)((byte *)base + field->ofs);
+        if (*p)
+            gi.TagFree(*p);
+    }
+}
+
+// parses level without touching game state, returns number of entities
+static int parse_level(savefile_t *f, level_locals_t *lev, edict_t *ent)
+{
+    game_read_context_t ctx;
+    int count = 0;
+
+    f->pos = 0;
+    if (read_int(f) != SAVE_MAGIC2 || read_int(f) != SAVE_VERSION)
+        gi.error("%s: bad header", __func__);
+
+    ctx = make_read_context(f, SAVE_VERSION);
+
+    memset(lev, 0, sizeof(*lev));
+    read_fields(&ctx, levelfields, lev);
+    free_strings(levelfields, lev);
+
+    while (read_int(f) != -1) {
+        memset(ent, 0, sizeof(*ent));
+        read_fields(&ctx, entityfields, ent);
+        free_strings(entityfields, ent);
+        count++;
+    }
+
+    return count;
+}
+
+static double bench_msec(clock_t start)
+{
+    return (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+/*
+=================
+Svcmd_SaveBench_f
+
+sv savebench [count]
+
+Times each stage of saving and loading the current level.
+=================
+*/
+void Svcmd_SaveBench_f(void)
+{
+    level_locals_t  *lev;
+    edict_t         *ent;
+    double          t_write = 0, t_pack = 0, t_unpack = 0, t_parse = 0;
+    size_t          packed = 0;
+    clock_t         start;
+    int             i, count, numents = 0;
+
+    if (!g_edicts || !level.mapname[0]) {
+        gi.cprintf(NULL, PRINT_HIGH, "No level loaded.\n");
+        return;
+    }
+
+    count = gi.argc() > 2 ? atoi(gi.argv(2)) : 10;
+    count = Q_clip(count, 1, 1000);
+
+    // scratch copies, parsing must not overwrite live state
+    lev = gi.TagMalloc(sizeof(*lev), TAG_GAME);
+    ent = gi.TagMalloc(sizeof(*ent), TAG_GAME);
+
+    for (i = 0; i < count; i++) {
+        start = clock();
+        write_level(begin_write());
+        t_write += bench_msec(start);
+
+#if USE_ZLIB
+        start = clock();
+        pack_savefile(Z_BEST_SPEED);
+        packed = save_packed.len;
+        t_pack += bench_msec(start);
+
+        start = clock();
+        unpack_savefile();
+        t_unpack += bench_msec(start);
+#else
+        packed = save_buffer.len;
+#endif
+
+        start = clock();
+        numents = parse_level(&save_buffer, lev, ent);
+        t_parse += bench_msec(start);
+    }
+
+    gi.TagFree(lev);
+    gi.TagFree(ent);
+
+    gi.cprintf(NULL, PRINT_HIGH, "%s: %d entities, %zu bytes, %zu packed\n",
+               level.mapname, numents, save_buffer.len, packed);
+    gi.cprintf(NULL, PRINT_HIGH, "average of %d runs, msec:\n", count);
+    gi.cprintf(NULL, PRINT_HIGH, "  serialize  %8.3f\n", t_write / count);
+    gi.cprintf(NULL, PRINT_HIGH, "  compress   %8.3f\n", t_pack / count);
+    gi.cprintf(NULL, PRINT_HIGH, "  uncompress %8.3f\n", t_unpack / count);
+    gi.cprintf(NULL, PRINT_HIGH, "  parse      %8.3f\n", t_parse / count);
+}
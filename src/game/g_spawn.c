@@ -335,40 +335,104 @@ static const spawn_field_t temp_fields[] = {
 
 /*
 ===============
-ED_CallSpawn
+ED_InitSpawnHash
 
-Finds the spawn function for the entity and calls it
+Builds a hash table of spawn functions for all classnames. Items are
+checked first, so they take priority over spawn functions of the same name.
 ===============
 */
-void ED_CallSpawn(edict_t *ent)
+#define SPAWN_HASH_SIZE     512
+
+typedef struct {
+    const char          *name;
+    const gitem_t       *item;
+    const spawn_func_t  *func;
+} spawn_hash_t;
+
+static spawn_hash_t spawn_hash[SPAWN_HASH_SIZE];
+static int          spawn_hash_count;
+
+static unsigned ED_HashClassname(const char *s)
+{
+    unsigned hash = 0;
+
+    while (*s)
+        hash = hash * 127 + *s++;
+
+    return hash & (SPAWN_HASH_SIZE - 1);
+}
+
+static spawn_hash_t *ED_FindSpawnHash(const char *classname)
+{
+    spawn_hash_t *h;
+    unsigned i;
+
+    for (i = ED_HashClassname(classname); ; i = (i + 1) & (SPAWN_HASH_SIZE - 1)) {
+        h = &spawn_hash[i];
+        if (!h->name || !strcmp(h->name, classname))
+            return h;
+    }
+}
+
+static void ED_AddSpawnHash(const char *classname, const gitem_t *item, const spawn_func_t *func)
+{
+    spawn_hash_t *h;
+
+    h = ED_FindSpawnHash(classname);
+    if (h->name)
+        return;     // first one wins
+
+    // keep load factor low, and make sure lookups always terminate
+    if (++spawn_hash_count > SPAWN_HASH_SIZE / 2)
+        gi.error("%s: too many spawn functions", __func__);
+
+    h->name = classname;
+    h->item = item;
+    h->func = func;
+}
+
+void ED_InitSpawnHash(void)
 {
     const spawn_func_t *s;
     const gitem_t *item;
     int     i;
 
+    memset(spawn_hash, 0, sizeof(spawn_hash));
+    spawn_hash_count = 0;
+
+    for (i = 0, item = itemlist; i < game.num_items; i++, item++) {
+        if (item->classname)
+            ED_AddSpawnHash(item->classname, item, NULL);
+    }
+
+    for (s = spawn_funcs; s->name; s++)
+        ED_AddSpawnHash(s->name, NULL, s);
+}
+
+/*
+===============
+ED_CallSpawn
+
+Finds the spawn function for the entity and calls it
+===============
+*/
+void ED_CallSpawn(edict_t *ent)
+{
+    const spawn_hash_t *h;
+
     if (!ent->classname) {
         gi.dprintf("ED_CallSpawn: NULL classname\n");
         return;
     }
 
-    // check item spawn functions
-    for (i = 0, item = itemlist; i < game.num_items; i++, item++) {
-        if (!item->classname)
-            continue;
-        if (!strcmp(item->classname, ent->classname)) {
-            // found it
-            SpawnItem(ent, item);
-            return;
-        }
+    h = ED_FindSpawnHash(ent->classname);
+    if (h->item) {
+        SpawnItem(ent, h->item);
+        return;
     }
-
-    // check normal spawn functions
-    for (s = spawn_funcs; s->name; s++) {
-        if (!strcmp(s->name, ent->classname)) {
-            // found it
-            s->spawn(ent);
-            return;
-        }
+    if (h->func) {
+        h->func->spawn(ent);
+        return;
     }
     gi.dprintf("%s doesn't have a spawn function\n", ent->classname);
 }
@@ -583,6 +647,7 @@ void SpawnEntities(const char *mapname, const char *entities, const char *spawnp
 
     memset(&level, 0, sizeof(level));
     memset(g_edicts, 0, game.maxentities * sizeof(g_edicts[0]));
+    G_ClearTargetnames();
 
     Q_strlcpy(level.mapname, mapname, sizeof(level.mapname));
     Q_strlcpy(game.spawnpoint, spawnpoint, sizeof(game.spawnpoint));
@@ -608,6 +673,7 @@ void SpawnEntities(const char *mapname, const char *entities, const char *spawnp
         else
             ent = G_Spawn();
         ED_ParseEdict(&entities, ent);
+        G_LinkTargetname(ent);
 
         // yet another map hack
         if (!Q_stricmp(level.mapname, "command") && !Q_stricmp(ent->classname, "trigger_once") && !Q_stricmp(ent->model, "*27"))
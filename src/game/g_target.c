@@ -359,7 +359,6 @@ For gibs:
     speed how fast it should be moving otherwise it
     will just be dropped
 */
-void ED_CallSpawn(edict_t *ent);
 
 void use_target_spawner(edict_t *self, edict_t *other, edict_t *activator)
 {
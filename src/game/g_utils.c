@@ -26,6 +26,96 @@ void G_ProjectSource(const vec3_t point, const vec3_t distance, const vec3_t for
     result[2] = point[2] + forward[2] * distance[0] + right[2] * distance[1] + distance[2];
 }
 
+/*
+=============
+Targetname index
+
+All entities with targetname set are kept in a hash table, with chains
+sorted by edict number, so that looking up targets doesn't need to scan
+all edicts. Targetname of an entity that is already spawned must be
+changed with G_SetTargetname.
+=============
+*/
+#define TARGETNAME_HASH_SIZE    1024
+
+static edict_t  *targetname_hash[TARGETNAME_HASH_SIZE];
+
+static unsigned G_HashTargetname(const char *s)
+{
+    unsigned hash = 0;
+
+    while (*s)
+        hash = hash * 127 + Q_tolower(*s++);
+
+    return hash & (TARGETNAME_HASH_SIZE - 1);
+}
+
+// must be called when all edicts are wiped
+void G_ClearTargetnames(void)
+{
+    memset(targetname_hash, 0, sizeof(targetname_hash));
+}
+
+void G_LinkTargetname(edict_t *ent)
+{
+    edict_t **link;
+
+    if (ent->targetname_linked || !ent->targetname)
+        return;
+
+    ent->targetname_hash = G_HashTargetname(ent->targetname);
+    ent->targetname_linked = true;
+
+    link = &targetname_hash[ent->targetname_hash];
+    while (*link && *link < ent)
+        link = &(*link)->targetname_next;
+
+    ent->targetname_next = *link;
+    *link = ent;
+}
+
+void G_UnlinkTargetname(edict_t *ent)
+{
+    edict_t **link;
+
+    if (!ent->targetname_linked)
+        return;
+
+    for (link = &targetname_hash[ent->targetname_hash]; *link; link = &(*link)->targetname_next) {
+        if (*link == ent) {
+            *link = ent->targetname_next;
+            break;
+        }
+    }
+
+    ent->targetname_next = NULL;
+    ent->targetname_linked = false;
+}
+
+void G_SetTargetname(edict_t *ent, char *targetname)
+{
+    G_UnlinkTargetname(ent);
+    ent->targetname = targetname;
+    G_LinkTargetname(ent);
+}
+
+// same as G_Find on targetname field
+static edict_t *G_FindTargetname(edict_t *from, const char *match)
+{
+    edict_t *e;
+
+    for (e = targetname_hash[G_HashTargetname(match)]; e; e = e->targetname_next) {
+        if (from && e <= from)
+            continue;
+        if (!e->inuse || !e->targetname)
+            continue;
+        if (!Q_stricmp(e->targetname, match))
+            return e;
+    }
+
+    return NULL;
+}
+
 /*
 =============
 G_Find
@@ -42,6 +132,9 @@ edict_t *G_Find(edict_t *from, int fieldofs, char *match)
 {
     char    *s;
 
+    if (fieldofs == FOFS(targetname))
+        return G_FindTargetname(from, match);
+
     if (!from)
         from = g_edicts;
     else
@@ -60,6 +153,55 @@ edict_t *G_Find(edict_t *from, int fieldofs, char *match)
     return NULL;
 }
 
+static bool G_InRadius(edict_t *ent, vec3_t org, float rad)
+{
+    vec3_t  eorg;
+    int     j;
+
+    if (!ent->inuse)
+        return false;
+    if (ent->solid == SOLID_NOT)
+        return false;
+    for (j = 0; j < 3; j++)
+        eorg[j] = org[j] - (ent->s.origin[j] + (ent->mins[j] + ent->maxs[j]) * 0.5f);
+    return VectorLength(eorg) <= rad;
+}
+
+// candidates from the engine area tree for the last radius search
+static struct {
+    vec3_t  org;
+    float   rad;
+    int     count;
+    edict_t *list[MAX_EDICTS];
+} radius_search;
+
+// engine only knows about linked edicts, world is never linked
+static edict_t *findradius_area(edict_t *from, vec3_t org, float rad)
+{
+    edict_t *ent;
+    int     i;
+
+    if (!from && G_InRadius(g_edicts, org, rad))
+        return g_edicts;
+
+    // query again on new search, or if nested search has overwritten results
+    if (!from || from == g_edicts || rad != radius_search.rad || !VectorCompare(org, radius_search.org)) {
+        VectorCopy(org, radius_search.org);
+        radius_search.rad = rad;
+        radius_search.count = gix->RadiusEdicts(org, rad, radius_search.list, MAX_EDICTS);
+    }
+
+    for (i = 0; i < radius_search.count; i++) {
+        ent = radius_search.list[i];
+        if (from && ent <= from)
+            continue;
+        if (G_InRadius(ent, org, rad))
+            return ent;
+    }
+
+    return NULL;
+}
+
 /*
 =================
 findradius
@@ -71,23 +213,16 @@ findradius (origin, radius)
 */
 edict_t *findradius(edict_t *from, vec3_t org, float rad)
 {
-    vec3_t  eorg;
-    int     j;
+    if (gix && gix->apiversion >= 3)
+        return findradius_area(from, org, rad);
 
     if (!from)
         from = g_edicts;
     else
         from++;
     for (; from < &g_edicts[globals.num_edicts]; from++) {
-        if (!from->inuse)
-            continue;
-        if (from->solid == SOLID_NOT)
-            continue;
-        for (j = 0; j < 3; j++)
-            eorg[j] = org[j] - (from->s.origin[j] + (from->mins[j] + from->maxs[j]) * 0.5f);
-        if (VectorLength(eorg) > rad)
-            continue;
-        return from;
+        if (G_InRadius(from, org, rad))
+            return from;
     }
 
     return NULL;
@@ -365,6 +500,8 @@ void G_FreeEdict(edict_t *ed)
         return;
     }
 
+    G_UnlinkTargetname(ed);
+
     memset(ed, 0, sizeof(*ed));
     ed->classname = "freed";
     ed->freetime = level.time;
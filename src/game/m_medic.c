@@ -524,8 +524,6 @@ void medic_hook_launch(edict_t *self)
     gi.sound(self, CHAN_WEAPON, sound_hook_launch, 1, ATTN_NORM, 0);
 }
 
-void ED_CallSpawn(edict_t *ent);
-
 static const vec3_t medic_cable_offsets[] = {
     { 45.0,  -9.2, 15.5 },
     { 48.4,  -9.7, 15.2 },
@@ -577,7 +575,7 @@ void medic_cable_attack(edict_t *self)
         self->enemy->spawnflags = 0;
         self->enemy->monsterinfo.aiflags = 0;
         self->enemy->target = NULL;
-        self->enemy->targetname = NULL;
+        G_SetTargetname(self->enemy, NULL);
         self->enemy->combattarget = NULL;
         self->enemy->deathtarget = NULL;
         self->enemy->owner = self;
@@ -1080,10 +1080,10 @@ static int _try_image_format(imageformat_t fmt, image_t *image, int try_src, byt
     int         len;
     int         ret;
 
-    // load the file
-    int fs_flags = 0;
+    // load the file, loaders don't modify it
+    int fs_flags = FS_FLAG_MAPPED;
     if (try_src > 0)
-        fs_flags = try_src == TRY_IMAGE_SRC_GAME ? FS_PATH_GAME : FS_PATH_BASE;
+        fs_flags |= try_src == TRY_IMAGE_SRC_GAME ? FS_PATH_GAME : FS_PATH_BASE;
     len = FS_LoadFileFlags(image->name, (void **)&data, fs_flags);
     if (!data) {
         return len;
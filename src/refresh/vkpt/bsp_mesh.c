@@ -22,6 +22,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "material.h"
 #include "cameras.h"
 #include "conversion.h"
+#include "common/async.h"
+#include "common/mdfour.h"
 
 #include <assert.h>
 #include <float.h>
@@ -551,22 +553,27 @@ is_sky_or_lava_cluster(bsp_mesh_t* wm, mface_t* surf, int cluster, int material_
 	return false;
 }
 
+// PVS matrix rows are 64-bit aligned and padded, see BSP_GetPvs
+
 static void merge_pvs_rows(bsp_t* bsp, byte* src, byte* dst)
 {
-	for (int i = 0; i < bsp->visrowsize; i++)
+	const uint64_t* src64 = (const uint64_t*)src;
+	uint64_t* dst64 = (uint64_t*)dst;
+
+	for (int i = 0; i < bsp->pvs_stride / sizeof(uint64_t); i++)
 	{
-		dst[i] |= src[i];
+		dst64[i] |= src64[i];
 	}
 }
 
 #define FOREACH_BIT_BEGIN(SET,ROWSIZE,VAR) \
-	for (int _byte_idx = 0; _byte_idx < (ROWSIZE); _byte_idx++) { \
-	if (SET[_byte_idx]) { \
-		for (int _bit_idx = 0; _bit_idx < 8; _bit_idx++) { \
-			if (SET[_byte_idx] & (1 << _bit_idx)) { \
-				int VAR = (_byte_idx << 3) | _bit_idx;
+	for (int _word_idx = 0; _word_idx < ((ROWSIZE) + 7) >> 3; _word_idx++) { \
+		uint64_t _word = ((const uint64_t*)(SET))[_word_idx]; \
+		while (_word) { \
+			int VAR = (_word_idx << 6) | q_ctz64(_word); \
+			_word &= _word - 1;
 
-#define FOREACH_BIT_END  } } } }
+#define FOREACH_BIT_END  } }
 
 static void connect_pvs(bsp_t* bsp, int cluster_a, byte* pvs_a, int cluster_b, byte* pvs_b)
 {
@@ -606,7 +613,7 @@ static void make_pvs_symmetric(bsp_t* bsp)
 
 static void build_pvs2(bsp_t* bsp)
 {
-	size_t matrix_size = bsp->visrowsize * bsp->vis->numclusters;
+	size_t matrix_size = bsp->pvs_stride * bsp->vis->numclusters;
 
 	bsp->pvs2_matrix = Z_Mallocz(matrix_size);
 
@@ -1672,73 +1679,223 @@ light_affects_cluster(light_poly_t* light, const aabb_t* aabb)
 	return true;
 }
 
+#define MAX_LIGHTS_PER_CLUSTER 1024
+
+#define CLUSTER_LIGHTS_IDENT    MakeLittleLong('C', 'L', 'I', 'T')
+#define CLUSTER_LIGHTS_VERSION  1
+
+// Header of the `maps/lights/<mapname>.bin` cache file, followed by
+// `num_clusters + 1` light list offsets and `num_cluster_lights` light indices.
+typedef struct {
+	uint32_t ident;
+	uint32_t version;
+	uint32_t bsp_checksum;
+	int32_t num_clusters;
+	int32_t num_light_polys;
+	int32_t num_cluster_lights;
+	uint8_t input_digest[16];	// light polys, cluster bounds and PVS
+} cluster_lights_header_t;
+
+typedef struct {
+	bsp_mesh_t *wm;
+	bsp_t *bsp;
+	int *light_offsets;		// num_light_polys + 1 entries
+	int *light_clusters;	// clusters affected by each light, light-major
+} cluster_lights_job_t;
+
+static int
+find_light_clusters(const cluster_lights_job_t *job, int nlight, int *clusters)
+{
+	light_poly_t* light = job->wm->light_polys + nlight;
+	int count = 0;
+
+	if (light->cluster < 0)
+		return 0;
+
+	const byte* pvs = (const byte*)BSP_GetPvs(job->bsp, light->cluster);
+
+	FOREACH_BIT_BEGIN(pvs, job->bsp->visrowsize, other_cluster)
+		if (light_affects_cluster(light, job->wm->cluster_aabbs + other_cluster))
+		{
+			if (clusters)
+				clusters[count] = other_cluster;
+			count++;
+		}
+	FOREACH_BIT_END
+
+	return count;
+}
+
 static void
-collect_cluster_lights(bsp_mesh_t *wm, bsp_t *bsp)
+count_light_clusters(void *arg, int nlight)
 {
-#define MAX_LIGHTS_PER_CLUSTER 1024
-	int* cluster_lights = Z_Malloc(MAX_LIGHTS_PER_CLUSTER * wm->num_clusters * sizeof(int));
-	int* cluster_light_counts = Z_Mallocz(wm->num_clusters * sizeof(int));
+	cluster_lights_job_t *job = arg;
+	job->light_offsets[nlight + 1] = find_light_clusters(job, nlight, NULL);
+}
+
+static void
+fill_light_clusters(void *arg, int nlight)
+{
+	cluster_lights_job_t *job = arg;
+	find_light_clusters(job, nlight, job->light_clusters + job->light_offsets[nlight]);
+}
 
-	// Construct an array of visible lights for each cluster.
-	// The array is in `cluster_lights`, with MAX_LIGHTS_PER_CLUSTER stride.
+static void
+get_cluster_lights_digest(const bsp_mesh_t *wm, const bsp_t *bsp, uint8_t digest[16])
+{
+	struct mdfour md;
 
+	mdfour_begin(&md);
 	for (int nlight = 0; nlight < wm->num_light_polys; nlight++)
 	{
-		light_poly_t* light = wm->light_polys + nlight;
-
-		if(light->cluster < 0)
-			continue;
+		const light_poly_t* light = wm->light_polys + nlight;
+		mdfour_update(&md, (const uint8_t*)light->positions, sizeof(light->positions));
+		mdfour_update(&md, (const uint8_t*)&light->cluster, sizeof(light->cluster));
+	}
+	mdfour_update(&md, (const uint8_t*)wm->cluster_aabbs, wm->num_clusters * sizeof(aabb_t));
+	mdfour_update(&md, bsp->pvs_matrix, bsp->pvs_stride * bsp->vis->numclusters);
+	mdfour_result(&md, digest);
+}
 
-		const byte* pvs = (const byte*)BSP_GetPvs(bsp, light->cluster);
+static bool
+load_cluster_lights(bsp_mesh_t *wm, const char *path, const cluster_lights_header_t *expected)
+{
+	byte *filebuf = NULL;
+	int filelen = FS_LoadFile(path, (void**)&filebuf);
+	if (!filebuf)
+		return false;
 
-		FOREACH_BIT_BEGIN(pvs, bsp->visrowsize, other_cluster)
-			aabb_t* cluster_aabb = wm->cluster_aabbs + other_cluster;
-			if (light_affects_cluster(light, cluster_aabb))
-			{
-				int* num_cluster_lights = cluster_light_counts + other_cluster;
-				if (*num_cluster_lights < MAX_LIGHTS_PER_CLUSTER)
-				{
-					cluster_lights[other_cluster * MAX_LIGHTS_PER_CLUSTER + *num_cluster_lights] = nlight;
-					(*num_cluster_lights)++;
-				}
-			}
-		FOREACH_BIT_END
+	bool valid = false;
+	const cluster_lights_header_t *header = (const cluster_lights_header_t *)filebuf;
+
+	if (filelen >= sizeof(*header) &&
+		header->ident == expected->ident &&
+		header->version == expected->version &&
+		header->bsp_checksum == expected->bsp_checksum &&
+		header->num_clusters == expected->num_clusters &&
+		header->num_light_polys == expected->num_light_polys &&
+		!memcmp(header->input_digest, expected->input_digest, sizeof(header->input_digest)) &&
+		header->num_cluster_lights >= 0 &&
+		filelen == sizeof(*header) + (header->num_clusters + 1 + header->num_cluster_lights) * sizeof(int))
+	{
+		const int *offsets = (const int *)(header + 1);
+		const int *lights = offsets + header->num_clusters + 1;
+
+		wm->num_cluster_lights = header->num_cluster_lights;
+		wm->cluster_light_offsets = Z_Malloc((wm->num_clusters + 1) * sizeof(int));
+		wm->cluster_lights = Z_Malloc(wm->num_cluster_lights * sizeof(int));
+		memcpy(wm->cluster_light_offsets, offsets, (wm->num_clusters + 1) * sizeof(int));
+		memcpy(wm->cluster_lights, lights, wm->num_cluster_lights * sizeof(int));
+		valid = true;
 	}
 
-	// Count the total number of cluster <-> light relations to allocate memory
+	FS_FreeFile(filebuf);
+	return valid;
+}
 
-	wm->num_cluster_lights = 0;
-	for (int cluster = 0; cluster < wm->num_clusters; cluster++)
+static void
+save_cluster_lights(const bsp_mesh_t *wm, const char *path, const cluster_lights_header_t *header)
+{
+	size_t offsets_size = (wm->num_clusters + 1) * sizeof(int);
+	size_t lights_size = wm->num_cluster_lights * sizeof(int);
+	byte *filebuf = Z_Malloc(sizeof(*header) + offsets_size + lights_size);
+
+	memcpy(filebuf, header, sizeof(*header));
+	((cluster_lights_header_t *)filebuf)->num_cluster_lights = wm->num_cluster_lights;
+	memcpy(filebuf + sizeof(*header), wm->cluster_light_offsets, offsets_size);
+	memcpy(filebuf + sizeof(*header) + offsets_size, wm->cluster_lights, lights_size);
+
+	if (FS_WriteFile(path, filebuf, sizeof(*header) + offsets_size + lights_size) < 0)
+		Com_WPrintf("Couldn't save cluster light lists to %s.\n", path);
+
+	Z_Free(filebuf);
+}
+
+static void
+collect_cluster_lights(bsp_mesh_t *wm, bsp_t *bsp, const char *map_name)
+{
+	char path[MAX_QPATH];
+	cluster_lights_header_t header = {
+		.ident = CLUSTER_LIGHTS_IDENT,
+		.version = CLUSTER_LIGHTS_VERSION,
+		.bsp_checksum = bsp->checksum,
+		.num_clusters = wm->num_clusters,
+		.num_light_polys = wm->num_light_polys,
+	};
+
+	get_cluster_lights_digest(wm, bsp, header.input_digest);
+
+	Q_snprintf(path, sizeof(path), "maps/lights/%s.bin", map_name);
+	if (load_cluster_lights(wm, path, &header))
+		return;
+
+	// Find the clusters affected by each light, in parallel. This is done in two passes:
+	// the first one counts the clusters so that the second one can write them out
+	// into a tightly packed array at the prefix-summed offsets.
+
+	cluster_lights_job_t job = {
+		.wm = wm,
+		.bsp = bsp,
+		.light_offsets = Z_Mallocz((wm->num_light_polys + 1) * sizeof(int)),
+	};
+
+	Com_ParallelFor(count_light_clusters, &job, wm->num_light_polys);
+
+	for (int nlight = 0; nlight < wm->num_light_polys; nlight++)
 	{
-		wm->num_cluster_lights += cluster_light_counts[cluster];
+		job.light_offsets[nlight + 1] += job.light_offsets[nlight];
 	}
 
-	wm->cluster_lights = Z_Mallocz(wm->num_cluster_lights * sizeof(int));
-	wm->cluster_light_offsets = Z_Mallocz((wm->num_clusters + 1) * sizeof(int));
+	job.light_clusters = Z_Malloc(max(job.light_offsets[wm->num_light_polys], 1) * sizeof(int));
+
+	Com_ParallelFor(fill_light_clusters, &job, wm->num_light_polys);
+
+	// Transpose into per-cluster light lists. Lights are visited in order, so each
+	// list is sorted by light index, and the first MAX_LIGHTS_PER_CLUSTER lights win.
+
+	int* cluster_light_counts = Z_Mallocz(wm->num_clusters * sizeof(int));
 
-	// Com_Printf("Total interactions: %d, culled bbox: %d, culled proj: %d\n", wm->num_cluster_lights, lights_culled_bbox, lights_culled_proj);
+	for (int i = 0; i < job.light_offsets[wm->num_light_polys]; i++)
+	{
+		int* num_cluster_lights = cluster_light_counts + job.light_clusters[i];
+		if (*num_cluster_lights < MAX_LIGHTS_PER_CLUSTER)
+			(*num_cluster_lights)++;
+	}
 
-	// Compact the previously constructed array into wm->cluster_lights
+	wm->cluster_light_offsets = Z_Mallocz((wm->num_clusters + 1) * sizeof(int));
 
 	int list_offset = 0;
 	for (int cluster = 0; cluster < wm->num_clusters; cluster++)
 	{
-		assert(list_offset >= 0);
 		wm->cluster_light_offsets[cluster] = list_offset;
-		int count = cluster_light_counts[cluster];
-		memcpy(
-			wm->cluster_lights + list_offset, 
-			cluster_lights + MAX_LIGHTS_PER_CLUSTER * cluster, 
-			count * sizeof(int));
-		list_offset += count;
+		list_offset += cluster_light_counts[cluster];
+		cluster_light_counts[cluster] = 0;
 	}
 	wm->cluster_light_offsets[wm->num_clusters] = list_offset;
 
-	Z_Free(cluster_lights);
+	wm->num_cluster_lights = list_offset;
+	wm->cluster_lights = Z_Mallocz(wm->num_cluster_lights * sizeof(int));
+
+	for (int nlight = 0; nlight < wm->num_light_polys; nlight++)
+	{
+		for (int i = job.light_offsets[nlight]; i < job.light_offsets[nlight + 1]; i++)
+		{
+			int cluster = job.light_clusters[i];
+			int count = wm->cluster_light_offsets[cluster + 1] - wm->cluster_light_offsets[cluster];
+			if (cluster_light_counts[cluster] < count)
+				wm->cluster_lights[wm->cluster_light_offsets[cluster] + cluster_light_counts[cluster]++] = nlight;
+		}
+	}
+
 	Z_Free(cluster_light_counts);
-#undef MAX_LIGHTS_PER_CLUSTER
+	Z_Free(job.light_clusters);
+	Z_Free(job.light_offsets);
+
+	save_cluster_lights(wm, path, &header);
 }
 
+#undef MAX_LIGHTS_PER_CLUSTER
+
 static tinyobj_attrib_t custom_sky_attrib;
 
 static uint32_t
@@ -1975,7 +2132,7 @@ bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp, const char* map_name)
 		model->masked = is_model_masked(wm, model);
 	}
 
-	collect_cluster_lights(wm, bsp);
+	collect_cluster_lights(wm, bsp, map_name);
 
 	compute_sky_visibility(wm, bsp);
 }
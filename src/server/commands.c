@@ -594,6 +594,8 @@ static void dump_downloads(void)
         Com_Printf("%3i %-15.15s %-40.40s %-7d %3d%%\n",
                    client->number, client->name, name, size, percent);
     }
+
+    SV_DownloadCacheStats();
 }
 
 static void dump_time(void)
@@ -698,13 +700,14 @@ static void SV_Status_f(void)
             char *w = Cmd_Argv(1);
             switch (*w) {
             case 'd': dump_downloads(); break;
+            case 'e': SV_DeltaCacheStats(); break;
             case 'l': dump_lag();       break;
             case 'p': dump_protocols(); break;
             case 's': dump_settings();  break;
             case 't': dump_time();      break;
             case 'v': dump_versions();  break;
             default:
-                Com_Printf("Usage: %s [d|l|p|s|t|v]\n", Cmd_Argv(0));
+                Com_Printf("Usage: %s [d|e|l|p|s|t|v]\n", Cmd_Argv(0));
                 dump_clients();
                 break;
             }
@@ -1760,6 +1763,7 @@ static const cmdreg_t c_server[] = {
 #endif
     { "gamemap", SV_GameMap_f, SV_Map_c },
     { "dumpents", SV_DumpEnts_f },
+    { "deltabench", SV_DeltaBench_f },
     { "setmaster", SV_SetMaster_f },
     { "listmasters", SV_ListMasters_f },
     { "killserver", SV_KillServer_f },
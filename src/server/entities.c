@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "server.h"
+#include "common/mdfour.h"
 
 /*
 =============================================================================
@@ -31,6 +32,107 @@ Encode a client frame onto the network channel
 #define Q2PRO_OPTIMIZE(c) \
     ((c)->protocol == PROTOCOL_VERSION_Q2PRO && !(c)->settings[CLS_RECORDING])
 
+/*
+=============================================================================
+
+DELTA CACHE
+
+Clients acknowledging the same frame, or starting from the same baseline,
+get the same entity deltas. Encoded deltas are remembered together with
+the states they were made from, so that they are only written once.
+
+=============================================================================
+*/
+
+#define DELTA_CACHE_SIZE    4096    // must be power of two
+#define DELTA_CACHE_MASK    (DELTA_CACHE_SIZE - 1)
+
+typedef struct {
+    bool            valid;
+    uint8_t         len;
+    msgEsFlags_t    flags;
+    entity_packed_t from;
+    entity_packed_t to;
+    byte            data[MAX_PACKETENTITY_BYTES];
+} deltacache_t;
+
+static deltacache_t *sv_deltacache;
+static uint64_t     sv_deltacache_hits;
+static uint64_t     sv_deltacache_misses;
+static bool         sv_deltacache_bypass;   // for benchmarking
+
+static inline deltacache_t *delta_cache_slot(const entity_packed_t *from,
+                                             const entity_packed_t *to,
+                                             msgEsFlags_t flags)
+{
+    uint32_t hash;
+
+    hash = to->number * 0x9e3779b1U;
+    hash ^= flags * 0x85ebca6bU;
+    hash ^= (from->origin[0] + from->origin[1] * 7 + from->origin[2] * 31) * 0xc2b2ae35U;
+    hash ^= (from->frame + from->angles[1] * 7 + from->modelindex * 31) * 0x27d4eb2fU;
+    hash ^= hash >> 15;
+
+    return &sv_deltacache[hash & DELTA_CACHE_MASK];
+}
+
+// writes entity delta to msg_write, reusing previously encoded bytes if possible
+static void write_delta_entity(const entity_packed_t *from,
+                               const entity_packed_t *to,
+                               msgEsFlags_t flags)
+{
+    deltacache_t *entry;
+    size_t start;
+
+    if (!to || !sv_delta_cache->integer || sv_deltacache_bypass) {
+        MSG_WriteDeltaEntity(from, to, flags);
+        return;
+    }
+
+    if (!sv_deltacache) {
+        sv_deltacache = SV_Mallocz(sizeof(sv_deltacache[0]) * DELTA_CACHE_SIZE);
+    }
+
+    entry = delta_cache_slot(from, to, flags);
+    if (entry->valid && entry->flags == flags &&
+        !memcmp(&entry->to, to, sizeof(*to)) &&
+        !memcmp(&entry->from, from, sizeof(*from))) {
+        MSG_WriteData(entry->data, entry->len);
+        sv_deltacache_hits++;
+        return;
+    }
+
+    start = msg_write.cursize;
+    MSG_WriteDeltaEntity(from, to, flags);
+    sv_deltacache_misses++;
+
+    if (msg_write.overflowed || msg_write.cursize - start > sizeof(entry->data)) {
+        entry->valid = false;
+        return;
+    }
+
+    entry->valid = true;
+    entry->len = msg_write.cursize - start;
+    entry->flags = flags;
+    entry->from = *from;
+    entry->to = *to;
+    memcpy(entry->data, msg_write.data + start, entry->len);
+}
+
+void SV_FreeDeltaCache(void)
+{
+    Z_Freep((void **)&sv_deltacache);
+}
+
+void SV_DeltaCacheStats(void)
+{
+    uint64_t total = sv_deltacache_hits + sv_deltacache_misses;
+
+    Com_Printf("Delta cache: %s, %"PRIu64" hits, %"PRIu64" misses (%.1f%% hit rate)\n",
+               sv_deltacache ? "active" : "inactive", sv_deltacache_hits, sv_deltacache_misses,
+               total ? sv_deltacache_hits * 100.0 / total : 0.0);
+}
+
 /*
 =============
 SV_EmitPacketEntities
@@ -96,7 +198,7 @@ static void SV_EmitPacketEntities(client_t         *client,
             if (Q2PRO_SHORTANGLES(client, newnum)) {
                 flags |= MSG_ES_SHORTANGLES;
             }
-            MSG_WriteDeltaEntity(oldent, newent, flags);
+            write_delta_entity(oldent, newent, flags);
             oldindex++;
             newindex++;
             continue;
@@ -119,14 +221,14 @@ static void SV_EmitPacketEntities(client_t         *client,
             if (Q2PRO_SHORTANGLES(client, newnum)) {
                 flags |= MSG_ES_SHORTANGLES;
             }
-            MSG_WriteDeltaEntity(oldent, newent, flags);
+            write_delta_entity(oldent, newent, flags);
             newindex++;
             continue;
         }
 
         if (newnum > oldnum) {
             // the old entity isn't present in the new message
-            MSG_WriteDeltaEntity(oldent, NULL, MSG_ES_FORCE);
+            write_delta_entity(oldent, NULL, MSG_ES_FORCE);
             oldindex++;
             continue;
         }
@@ -321,10 +423,134 @@ void SV_WriteFrameToClient_Enhanced(client_t *client)
     SV_EmitPacketEntities(client, oldframe, frame, clientEntityNum);
 }
 
+/*
+==================
+SV_DeltaBench_f
+
+Replays frames still held in the history of a connected client as if they
+were sent to a number of clients that lag behind by a different number of
+frames, with and without the delta cache.
+
+deltabench [clients] [passes]
+==================
+*/
+static unsigned delta_bench_pass(client_t *client, client_frame_t **frames,
+                                 int numframes, int numclients, bool verify)
+{
+    client_frame_t *from;
+    unsigned checksum = 0;
+    int i, j, k;
+
+    for (i = 0; i < numframes; i++) {
+        for (j = 0; j < numclients; j++) {
+            k = i - 1 - j % 3;
+            from = k >= 0 ? frames[k] : NULL;
+
+            SZ_Clear(&msg_write);
+            SV_EmitPacketEntities(client, from, frames[i], 0);
+            if (verify) {
+                checksum = Com_BlockChecksum(msg_write.data, msg_write.cursize) ^ (checksum * 31);
+            }
+        }
+    }
+
+    SZ_Clear(&msg_write);
+    return checksum;
+}
+
+void SV_DeltaBench_f(void)
+{
+    client_frame_t  *frames[UPDATE_BACKUP], *frame;
+    client_t        *client, *source = NULL;
+    int             i, numframes, numclients, passes;
+    unsigned        sum1, sum2;
+    uint64_t        start, plain, cached, hits, misses;
+
+    if (!svs.initialized || sv.state != ss_game) {
+        Com_Printf("No game running.\n");
+        return;
+    }
+
+    FOR_EACH_CLIENT(client) {
+        if (client->state == cs_spawned && client->framenum > 1) {
+            source = client;
+            break;
+        }
+    }
+    if (!source) {
+        Com_Printf("No spawned clients to take frames from.\n");
+        return;
+    }
+
+    numclients = Cmd_Argc() > 1 ? Q_clip(atoi(Cmd_Argv(1)), 1, MAX_CLIENTS) : 32;
+    passes = Cmd_Argc() > 2 ? Q_clip(atoi(Cmd_Argv(2)), 1, 10000) : 100;
+
+    numframes = 0;
+    for (i = source->framenum - UPDATE_BACKUP + 1; i <= source->framenum; i++) {
+        frame = &source->frames[i & UPDATE_MASK];
+        if (i < 1 || frame->number != i)
+            continue;
+        if (svs.next_entity - frame->first_entity > svs.num_entities)
+            continue;
+        frames[numframes++] = frame;
+    }
+    if (numframes < 2) {
+        Com_Printf("Not enough frames in history of %s.\n", source->name);
+        return;
+    }
+
+    // make sure cached output is identical
+    sv_deltacache_bypass = true;
+    sum1 = delta_bench_pass(source, frames, numframes, numclients, true);
+    sv_deltacache_bypass = false;
+    sum2 = delta_bench_pass(source, frames, numframes, numclients, true);
+    if (sum1 != sum2) {
+        Com_EPrintf("Delta cache output mismatch!\n");
+    }
+
+    sv_deltacache_bypass = true;
+    start = Sys_Microseconds();
+    for (i = 0; i < passes; i++)
+        delta_bench_pass(source, frames, numframes, numclients, false);
+    plain = Sys_Microseconds() - start;
+    sv_deltacache_bypass = false;
+
+    if (sv_deltacache)
+        memset(sv_deltacache, 0, sizeof(sv_deltacache[0]) * DELTA_CACHE_SIZE);
+
+    hits = sv_deltacache_hits;
+    misses = sv_deltacache_misses;
+    start = Sys_Microseconds();
+    for (i = 0; i < passes; i++)
+        delta_bench_pass(source, frames, numframes, numclients, false);
+    cached = Sys_Microseconds() - start;
+    hits = sv_deltacache_hits - hits;
+    misses = sv_deltacache_misses - misses;
+
+    Com_Printf("%d frames from %s, %d clients, %d passes\n",
+               numframes, source->name, numclients, passes);
+    Com_Printf("uncached: %.3f ms per pass\n", plain * 1e-3 / passes);
+    if (!sv_delta_cache->integer) {
+        Com_Printf("cached: sv_delta_cache is disabled\n");
+        return;
+    }
+    Com_Printf("cached:   %.3f ms per pass, %.1f%% hit rate\n",
+               cached * 1e-3 / passes, hits + misses ? hits * 100.0 / (hits + misses) : 0.0);
+}
+
 /*
 =============================================================================
 
-Build a client frame structure
+Build client frame structures
+
+Frames are built in three steps. Visibility is decided for every client in
+parallel, producing a list of entity numbers per client. Ranges of the
+circular svs.entities array are then reserved serially in client order, so
+the array is laid out exactly as if frames were built one after another.
+Finally entity states are packed in parallel into the reserved ranges.
+
+Worker threads only read game state, anything that needs to modify it or
+print is done on the main thread.
 
 =============================================================================
 */
@@ -374,62 +600,255 @@ fix_old_origin(client_t *client, entity_packed_t *state, edict_t *ent, int e)
 }
 #endif
 
+typedef struct {
+    client_t    *client;
+    uint16_t    *ents;
+    int         num_ents;
+    int         max_ents;
+    bool        bad_number;             // entity with wrong s.number found
+    bool        need_clientnum_fix;
+} framebuild_t;
+
+static framebuild_t frame_builds[MAX_CLIENTS];
+static int          cull_nonvisible_entities;
+
+/*
+Visibility data shared by all clients of the tick. Candidate entities are
+bucketed by the clusters they touch, so each client only needs to walk set
+bits of its PVS. Area connectivity is kept as one entity bitset per flood
+group, since two areas are connected exactly when their flood numbers match.
+*/
+#define VIS_ENT_WORDS   (MAX_EDICTS / 64)
+
+typedef struct {
+    bool        valid;
+    bool        noareas;            // every area is connected
+    int         numwords;
+    int         numclusters;
+    int         numfloods;
+    int         numspecial;
+    uint64_t    candidates[VIS_ENT_WORDS];
+    uint64_t    floods[MAX_MAP_AREAS][VIS_ENT_WORDS];
+    uint16_t    special[MAX_EDICTS];    // beams and headnode entities
+    uint16_t    linked[MAX_EDICTS];
+    uint32_t    cluster_first[MAX_MAP_CLUSTERS + 2];
+    uint16_t    cluster_ents[MAX_EDICTS * MAX_ENT_CLUSTERS];
+} framevis_t;
+
+static framevis_t   frame_vis;
+
+#define SET_ENT_BIT(set, e)     ((set)[(e) >> 6] |= BIT_ULL((e) & 63))
+#define ENT_BIT_SET(set, e)     (((set)[(e) >> 6] >> ((e) & 63)) & 1)
+
+static void SV_FloodEntity(framevis_t *v, int e, int area)
+{
+    int f = CM_AreaFloodnum(&sv.cm, area);
+
+    if (f > 0)
+        SET_ENT_BIT(v->floods[f], e);
+}
+
 /*
 =============
-SV_BuildClientFrame
+SV_PrepareFrameVis
 
-Decides which entities are going to be visible to the client, and
-copies off the playerstat and areabits.
+Builds the per-tick entity visibility data for clients using the server
+game and collision model. Clients it does not apply to take the slow path.
 =============
 */
-void SV_BuildClientFrame(client_t *client)
+static void SV_PrepareFrameVis(void)
 {
-    int         e, i;
-    vec3_t      org;
+    framevis_t  *v = &frame_vis;
+    bsp_t       *bsp = sv.cm.cache;
     edict_t     *ent;
-    edict_t     *clent;
-    client_frame_t  *frame;
-    entity_packed_t *state;
-    player_state_t  *ps;
-	entity_state_t  es;
-    int         clientarea, clientcluster;
-    mleaf_t     *leaf;
-    byte        clientphs[VIS_MAX_BYTES];
-    byte        clientpvs[VIS_MAX_BYTES];
-    bool    ent_visible;
-    int cull_nonvisible_entities = Cvar_Get("sv_cull_nonvisible_entities", "1", CVAR_CHEAT)->integer;
-    bool        need_clientnum_fix;
-    int         max_packet_entities;
+    int         e, i, c, f, numlinked, num_edicts;
+
+    v->valid = false;
+
+    if (!ge || !bsp || !bsp->vis || !cull_nonvisible_entities || sv_novis->integer)
+        return;
+
+    num_edicts = min(ge->num_edicts, MAX_EDICTS);
+    v->numwords = (num_edicts + 63) / 64;
+    v->numclusters = bsp->vis->numclusters;
+    v->noareas = CM_AreaFloodnum(&sv.cm, 1) == -1;
+
+    v->numfloods = 0;
+    for (i = 1; i < bsp->numareas; i++) {
+        f = CM_AreaFloodnum(&sv.cm, i);
+        if (f >= MAX_MAP_AREAS)
+            return;
+        v->numfloods = max(v->numfloods, f + 1);
+    }
+
+    memset(v->candidates, 0, sizeof(v->candidates[0]) * v->numwords);
+    for (i = 0; i < v->numfloods; i++)
+        memset(v->floods[i], 0, sizeof(v->floods[i][0]) * v->numwords);
+    memset(v->cluster_first, 0, sizeof(v->cluster_first[0]) * (v->numclusters + 2));
+
+    v->numspecial = numlinked = 0;
+    for (e = 1; e < num_edicts; e++) {
+        ent = EDICT_NUM2(ge, e);
+
+        if (!ent->inuse && (g_features->integer & GMF_PROPERINUSE))
+            continue;
+        if (ent->svflags & SVF_NOCLIENT)
+            continue;
+        if (!HAS_EFFECTS(ent))
+            continue;
+
+        SET_ENT_BIT(v->candidates, e);
+        if (!v->noareas) {
+            SV_FloodEntity(v, e, ent->areanum);
+            SV_FloodEntity(v, e, ent->areanum2);
+        }
+
+        if ((ent->s.renderfx & RF_BEAM) || ent->num_clusters == -1) {
+            v->special[v->numspecial++] = e;
+            continue;
+        }
+
+        // count entities per cluster
+        for (i = 0; i < ent->num_clusters; i++) {
+            c = ent->clusternums[i];
+            if (c >= 0 && c < v->numclusters)
+                v->cluster_first[c + 2]++;
+        }
+        v->linked[numlinked++] = e;
+    }
+
+    for (c = 2; c < v->numclusters + 2; c++)
+        v->cluster_first[c] += v->cluster_first[c - 1];
+
+    // after this loop cluster_first[c] is the start of cluster c
+    for (i = 0; i < numlinked; i++) {
+        e = v->linked[i];
+        ent = EDICT_NUM2(ge, e);
+        for (f = 0; f < ent->num_clusters; f++) {
+            c = ent->clusternums[f];
+            if (c >= 0 && c < v->numclusters)
+                v->cluster_ents[v->cluster_first[c + 1]++] = e;
+        }
+    }
+
+    v->valid = true;
+}
+
+/*
+=============
+SV_CullClientFrameVis
 
-    clent = client->edict;
-    if (!clent->client)
-        return;        // not in game yet
+Fast path of SV_CullClientFrame using the data built by SV_PrepareFrameVis.
+Produces the same entity list as the slow path.
+=============
+*/
+static void SV_CullClientFrameVis(framebuild_t *b, const vec3_t org,
+                                  int clientarea, int clientcluster,
+                                  byte *clientpvs, byte *clientphs)
+{
+    const framevis_t *v = &frame_vis;
+    client_t    *client = b->client;
+    edict_t     *clent = client->edict;
+    edict_t     *ent;
+    uint64_t    visible[VIS_ENT_WORDS];
+    uint64_t    mask;
+    const uint64_t *area;
+    unsigned    bits;
+    int         i, j, c, e, f, last;
+
+    memset(visible, 0, sizeof(visible[0]) * v->numwords);
+
+    // mark entities touching any cluster in PVS
+    for (i = 0; i < v->numclusters; i += 8) {
+        bits = clientpvs[i >> 3];
+        if (v->numclusters - i < 8)
+            bits &= BIT(v->numclusters - i) - 1;
+        while (bits) {
+            c = i + q_ctz64(bits);
+            bits &= bits - 1;
+            last = v->cluster_first[c + 1];
+            for (j = v->cluster_first[c]; j < last; j++)
+                SET_ENT_BIT(visible, v->cluster_ents[j]);
+        }
+    }
+
+    for (i = 0; i < v->numspecial; i++) {
+        e = v->special[i];
+        ent = EDICT_NUM2(ge, e);
+        if (ent->s.renderfx & RF_BEAM) {
+            // beams just check one point for PHS
+            if (Q_IsBitSet(clientphs, ent->clusternums[0]))
+                SET_ENT_BIT(visible, e);
+        } else {
+            // too many leafs for individual check, go by headnode
+            if (CM_HeadnodeVisible(CM_NodeNum(&sv.cm, ent->headnode), clientpvs))
+                SET_ENT_BIT(visible, e);
+        }
+    }
+
+    // check areas
+    if (clientcluster >= 0 && !v->noareas) {
+        f = CM_AreaFloodnum(&sv.cm, clientarea);
+        area = f > 0 ? v->floods[f] : NULL;
+        for (i = 0; i < v->numwords; i++)
+            visible[i] &= area ? area[i] : 0;
+    }
+
+    // client's own entity is always visible
+    e = NUM_FOR_EDICT(clent);
+    if (e < v->numwords * 64 && ENT_BIT_SET(v->candidates, e))
+        SET_ENT_BIT(visible, e);
+
+    for (i = 0; i < v->numwords; i++) {
+        mask = visible[i];
+        while (mask) {
+            e = i * 64 + q_ctz64(mask);
+            mask &= mask - 1;
+            ent = EDICT_NUM2(ge, e);
+
+            if ((ent->s.effects & EF_GIB) && client->settings[CLS_NOGIBS])
+                continue;
+
+            // don't send sounds if they will be attenuated away
+            if (ent != clent && !(ent->s.renderfx & RF_BEAM) && !ent->s.modelindex
+                && Distance(org, ent->s.origin) > 400)
+                continue;
+
+            if (ent->s.number != e)
+                b->bad_number = true;   // fixed on main thread
+
+            b->ents[b->num_ents] = e;
+
+            if (++b->num_ents == b->max_ents)
+                return;
+        }
+    }
+}
+
+/*
+=============
+SV_BeginClientFrame
+
+Sets up the frame header and copies off the playerstate.
+=============
+*/
+static void SV_BeginClientFrame(framebuild_t *b)
+{
+    client_t        *client = b->client;
+    edict_t         *clent = client->edict;
+    client_frame_t  *frame;
 
     // this is the frame we are creating
     frame = &client->frames[client->framenum & UPDATE_MASK];
     frame->number = client->framenum;
     frame->sentTime = com_eventTime; // save it for ping calc later
     frame->latency = -1; // not yet acked
+    frame->num_entities = 0;
 
     client->frames_sent++;
 
-    // find the client's PVS
-    ps = &clent->client->ps;
-    VectorMA(ps->viewoffset, 0.125f, ps->pmove.origin, org);
-
-    leaf = CM_PointLeaf(client->cm, org);
-    clientarea = leaf->area;
-    clientcluster = leaf->cluster;
-
-    // calculate the visible areas
-    frame->areabytes = CM_WriteAreaBits(client->cm, frame->areabits, clientarea);
-    if (!frame->areabytes && client->protocol != PROTOCOL_VERSION_Q2PRO) {
-        frame->areabits[0] = 255;
-        frame->areabytes = 1;
-    }
-
     // grab the current player_state_t
-    MSG_PackPlayer(&frame->ps, ps);
+    MSG_PackPlayer(&frame->ps, &clent->client->ps);
 
     // grab the current clientNum
     if (g_features->integer & GMF_CLIENTNUM) {
@@ -444,14 +863,59 @@ void SV_BuildClientFrame(client_t *client)
     }
 
     // fix clientNum if out of range for older version of Q2PRO protocol
-    need_clientnum_fix = client->protocol == PROTOCOL_VERSION_Q2PRO
+    b->need_clientnum_fix = client->protocol == PROTOCOL_VERSION_Q2PRO
         && client->version < PROTOCOL_VERSION_Q2PRO_CLIENTNUM_SHORT
         && frame->clientNum >= CLIENTNUM_NONE;
 
     // limit maximum number of entities in client frame
-    max_packet_entities =
+    b->max_ents =
         sv_max_packet_entities->integer > 0 ? sv_max_packet_entities->integer :
         client->csr->extended ? MAX_PACKET_ENTITIES : MAX_PACKET_ENTITIES_OLD;
+    b->max_ents = min(b->max_ents, MAX_EDICTS);
+
+    b->ents = svs.frame_ents + client->number * MAX_EDICTS;
+    b->num_ents = 0;
+    b->bad_number = false;
+}
+
+/*
+=============
+SV_CullClientFrame
+
+Decides which entities are going to be visible to the client, and
+copies off the areabits. Runs on worker threads.
+=============
+*/
+static void SV_CullClientFrame(void *arg, int index)
+{
+    framebuild_t    *b = &frame_builds[index];
+    client_t        *client = b->client;
+    edict_t         *clent = client->edict;
+    client_frame_t  *frame = &client->frames[client->framenum & UPDATE_MASK];
+    int             e, i;
+    vec3_t          org;
+    edict_t         *ent;
+    player_state_t  *ps;
+    int             clientarea, clientcluster;
+    mleaf_t         *leaf;
+    byte            clientphs[VIS_MAX_BYTES];
+    byte            clientpvs[VIS_MAX_BYTES];
+    bool            ent_visible;
+
+    // find the client's PVS
+    ps = &clent->client->ps;
+    VectorMA(ps->viewoffset, 0.125f, ps->pmove.origin, org);
+
+    leaf = CM_PointLeaf(client->cm, org);
+    clientarea = leaf->area;
+    clientcluster = leaf->cluster;
+
+    // calculate the visible areas
+    frame->areabytes = CM_WriteAreaBits(client->cm, frame->areabits, clientarea);
+    if (!frame->areabytes && client->protocol != PROTOCOL_VERSION_Q2PRO) {
+        frame->areabits[0] = 255;
+        frame->areabytes = 1;
+    }
 
 	if (clientcluster >= 0)
 	{
@@ -464,10 +928,12 @@ void SV_BuildClientFrame(client_t *client)
 	}
     BSP_ClusterVis(client->cm->cache, clientphs, clientcluster, DVIS_PHS);
 
-    // build up the list of visible entities
-    frame->num_entities = 0;
-    frame->first_entity = svs.next_entity;
+    if (frame_vis.valid && client->ge == ge && client->cm == &sv.cm) {
+        SV_CullClientFrameVis(b, org, clientarea, clientcluster, clientpvs, clientphs);
+        return;
+    }
 
+    // build up the list of visible entities
     for (e = 1; e < client->ge->num_edicts; e++) {
         ent = EDICT_NUM2(client->ge, e);
 
@@ -535,22 +1001,44 @@ void SV_BuildClientFrame(client_t *client)
 
         if(!ent_visible && (!sv_novis->integer || !ent->s.modelindex))
             continue;
-        
-		if (ent->s.number != e) {
-			Com_WPrintf("%s: fixing ent->s.number: %d to %d\n",
-				__func__, ent->s.number, e);
-			ent->s.number = e;
-		}
 
-		memcpy(&es, &ent->s, sizeof(entity_state_t));
+        if (ent->s.number != e)
+            b->bad_number = true;   // fixed on main thread
+
+        // note that invisible entities sent because of sv_novis keep their
+        // sound, the state is packed unmodified
+        b->ents[b->num_ents] = e;
+
+        if (++b->num_ents == b->max_ents) {
+            break;
+        }
+    }
+}
+
+/*
+=============
+SV_PackClientFrame
+
+Packs entity states into the range of svs.entities reserved for the
+frame. Runs on worker threads.
+=============
+*/
+static void SV_PackClientFrame(void *arg, int index)
+{
+    framebuild_t    *b = &frame_builds[index];
+    client_t        *client = b->client;
+    edict_t         *clent = client->edict;
+    client_frame_t  *frame = &client->frames[client->framenum & UPDATE_MASK];
+    entity_packed_t *state;
+    edict_t         *ent;
+    int             i, e;
 
-		if (!ent_visible) {
-			// if the entity is invisible, kill its sound
-			es.sound = 0;
-		}
+    for (i = 0; i < b->num_ents; i++) {
+        e = b->ents[i];
+        ent = EDICT_NUM2(client->ge, e);
 
         // add it to the circular client_entities array
-        state = &svs.entities[svs.next_entity % svs.num_entities];
+        state = &svs.entities[(frame->first_entity + i) % svs.num_entities];
         MSG_PackEntity(state, &ent->s, ENT_EXTENSION(client->csr, ent));
 
 #if USE_FPS
@@ -569,7 +1057,7 @@ void SV_BuildClientFrame(client_t *client)
 
         // hide POV entity from renderer, unless this is player's own entity
         if (e == frame->clientNum + 1 && ent != clent &&
-            (!Q2PRO_OPTIMIZE(client) || need_clientnum_fix)) {
+            (!Q2PRO_OPTIMIZE(client) || b->need_clientnum_fix)) {
             state->modelindex = 0;
         }
 
@@ -586,15 +1074,69 @@ void SV_BuildClientFrame(client_t *client)
         } else if (client->esFlags & MSG_ES_LONGSOLID) {
             state->solid = sv.entities[e].solid32;
         }
+    }
 
-        svs.next_entity++;
+    if (b->need_clientnum_fix)
+        frame->clientNum = client->slot;
+}
 
-        if (++frame->num_entities == max_packet_entities) {
-            break;
+/*
+=============
+SV_FixEntityNumbers
+=============
+*/
+static void SV_FixEntityNumbers(const framebuild_t *b)
+{
+    edict_t *ent;
+    int     i, e;
+
+    for (i = 0; i < b->num_ents; i++) {
+        e = b->ents[i];
+        ent = EDICT_NUM2(b->client->ge, e);
+        if (ent->s.number != e) {
+            Com_WPrintf("%s: fixing ent->s.number: %d to %d\n",
+                        __func__, ent->s.number, e);
+            ent->s.number = e;
         }
     }
-
-    if (need_clientnum_fix)
-        frame->clientNum = client->slot;
 }
 
+/*
+=============
+SV_BuildClientFrames
+
+Builds frames for the given clients, which must all be in game.
+=============
+*/
+void SV_BuildClientFrames(client_t **clients, int count)
+{
+    client_frame_t  *frame;
+    framebuild_t    *b;
+    int             i;
+
+    Q_assert(count <= MAX_CLIENTS);
+
+    cull_nonvisible_entities = Cvar_Get("sv_cull_nonvisible_entities", "1", CVAR_CHEAT)->integer;
+
+    for (i = 0; i < count; i++) {
+        frame_builds[i].client = clients[i];
+        SV_BeginClientFrame(&frame_builds[i]);
+    }
+
+    SV_PrepareFrameVis();
+
+    Com_ParallelFor(SV_CullClientFrame, NULL, count);
+
+    // reserve ranges of svs.entities in client order
+    for (i = 0, b = frame_builds; i < count; i++, b++) {
+        if (b->bad_number)
+            SV_FixEntityNumbers(b);
+
+        frame = &b->client->frames[b->client->framenum & UPDATE_MASK];
+        frame->first_entity = svs.next_entity;
+        frame->num_entities = b->num_ents;
+        svs.next_entity += b->num_ents;
+    }
+
+    Com_ParallelFor(SV_PackClientFrame, NULL, count);
+}
@@ -749,7 +749,8 @@ static int PF_LoadFile(const char *path, void **buffer, unsigned flags, unsigned
     if (tag > UINT16_MAX - TAG_MAX) {
         Com_Error(ERR_DROP, "%s: bad tag", __func__);
     }
-    return FS_LoadFileEx(path, buffer, flags, tag + TAG_MAX);
+    // game frees with Z_Free, never hand out mappings
+    return FS_LoadFileEx(path, buffer, flags & ~FS_FLAG_MAPPED, tag + TAG_MAX);
 }
 
 static void *PF_TagRealloc(void *ptr, size_t size)
@@ -836,6 +837,10 @@ static const game_import_ex_t game_import_ex = {
 
     .ErrorString = Q_ErrorString,
     .TagRealloc = PF_TagRealloc,
+
+    .TraceBatch = SV_TraceBatch,
+
+    .RadiusEdicts = SV_RadiusEdicts,
 };
 
 static void *game_library;
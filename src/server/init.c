@@ -35,6 +35,7 @@ void SV_ClientReset(client_t *client)
     client->frames_nodelta = 0;
     client->send_delta = 0;
     client->suppress_count = 0;
+    client->mcast_valid = false;
     memset(&client->lastcmd, 0, sizeof(client->lastcmd));
 }
 
@@ -451,6 +452,7 @@ void SV_InitGame(unsigned mvd_spawn)
     max_packet_entities = svs.csr.extended ? MAX_PACKET_ENTITIES : MAX_PACKET_ENTITIES_OLD;
     svs.num_entities = sv_maxclients->integer * max_packet_entities * UPDATE_BACKUP;
     svs.entities = SV_Mallocz(sizeof(svs.entities[0]) * svs.num_entities);
+    svs.frame_ents = SV_Malloc(sizeof(svs.frame_ents[0]) * sv_maxclients->integer * MAX_EDICTS);
 
     // send heartbeat very soon
     svs.last_heartbeat = -(HEARTBEAT_SECONDS - 5) * 1000;
@@ -82,6 +82,8 @@ cvar_t  *sv_max_rate;
 cvar_t  *sv_calcpings_method;
 cvar_t  *sv_changemapcmd;
 cvar_t  *sv_max_download_size;
+cvar_t  *sv_download_cache;
+cvar_t  *sv_delta_cache;
 cvar_t  *sv_max_packet_entities;
 
 cvar_t  *sv_strafejump_hack;
@@ -2061,6 +2063,8 @@ void SV_UserinfoChanged(client_t *cl)
 
 void SV_RestartFilesystem(void)
 {
+    SV_ExpireDownloadCache();
+
     if (gex && gex->RestartFilesystem)
         gex->RestartFilesystem();
 }
@@ -2160,6 +2164,8 @@ void SV_Init(void)
 
     SV_RegisterSavegames();
 
+    SV_RegisterWorld();
+
     Cvar_Get("protocol", STRINGIFY(PROTOCOL_VERSION_DEFAULT), CVAR_SERVERINFO | CVAR_ROM);
 
     Cvar_Get("skill", "1", CVAR_LATCH);
@@ -2223,6 +2229,8 @@ void SV_Init(void)
     sv_calcpings_method = Cvar_Get("sv_calcpings_method", "2", 0);
     sv_changemapcmd = Cvar_Get("sv_changemapcmd", "", 0);
     sv_max_download_size = Cvar_Get("sv_max_download_size", "8388608", 0);
+    sv_download_cache = Cvar_Get("sv_download_cache", "64", 0);
+    sv_delta_cache = Cvar_Get("sv_delta_cache", "1", 0);
     sv_max_packet_entities = Cvar_Get("sv_max_packet_entities", "0", 0);
 
     sv_strafejump_hack = Cvar_Get("sv_strafejump_hack", "1", CVAR_LATCH);
@@ -2373,9 +2381,13 @@ void SV_Shutdown(const char *finalmsg, error_type_t type)
 
     SV_MvdShutdown(type);
 
+    SV_StopAreaRecord();
+
     SV_FinalMessage(finalmsg, type);
     SV_MasterShutdown();
     SV_ShutdownGameProgs();
+    SV_FlushDownloadCache();
+    SV_FreeDeltaCache();
 
     // free current level
     CM_FreeMap(&sv.cm);
@@ -2384,6 +2396,7 @@ void SV_Shutdown(const char *finalmsg, error_type_t type)
     // free server static data
     Z_Free(svs.client_pool);
     Z_Free(svs.entities);
+    Z_Free(svs.frame_ents);
 #if USE_ZLIB
     deflateEnd(&svs.z);
     Z_Free(svs.z_buffer);
@@ -29,13 +29,18 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define FOR_EACH_ACTIVE_GTV(client) \
     LIST_FOR_EACH(gtv_client_t, client, &gtv_active_list, active)
 
+// minimum number of frames between full flushes of the shared stream
+#define GTV_SYNC_FRAMES     10
+
 typedef struct {
     list_t      entry;
     list_t      active;
     clstate_t   state;
     netstream_t stream;
 #if USE_ZLIB
-    z_stream    z;
+    z_stream    z;          // private stream, used while not attached
+    bool        deflate;    // rest of the stream is deflated
+    bool        attached;   // following the shared stream
 #endif
     unsigned    msglen;
     unsigned    lastmessage;
@@ -79,6 +84,16 @@ typedef struct {
 
     // TCP client pool
     gtv_client_t    *clients; // [sv_mvd_maxclients]
+
+#if USE_ZLIB
+    // shared deflate stream, encoded once for all attached clients
+    z_stream        z;
+    unsigned        z_members;
+    unsigned        z_maxbuf;
+    unsigned        z_bufcount;
+    unsigned        z_frames;   // frames since last full flush
+    bool            z_dirty;    // data written since last flush
+#endif
 } mvd_server_t;
 
 static mvd_server_t     mvd;
@@ -113,11 +128,16 @@ static bool     mvd_enable(void);
 static void     mvd_disable(void);
 static void     mvd_error(const char *reason);
 
-static void     write_stream(gtv_client_t *client, void *data, size_t len);
+static void     write_stream(gtv_client_t *client, const void *data, size_t len);
 static void     write_message(gtv_client_t *client, gtv_serverop_t op);
 #if USE_ZLIB
 static void     flush_stream(gtv_client_t *client, int flush);
+static void     attach_clients(void);
 #endif
+static void     write_shared(const void *data, size_t len);
+static void     write_shared_message(gtv_serverop_t op);
+static void     flush_shared(void);
+static void     finish_shared_frame(void);
 
 static void     rec_stop(void);
 static bool     rec_allowed(void);
@@ -811,16 +831,9 @@ static void emit_frame(void)
 
 static void suspend_streams(void)
 {
-    gtv_client_t *client;
-
-    FOR_EACH_ACTIVE_GTV(client) {
-        // send stream suspend marker
-        write_message(client, GTS_STREAM_DATA);
-#if USE_ZLIB
-        flush_stream(client, Z_SYNC_FLUSH);
-#endif
-        NET_UpdateStream(&client->stream);
-    }
+    // send stream suspend marker
+    write_shared_message(GTS_STREAM_DATA);
+    flush_shared();
 
     Com_DPrintf("Suspending MVD streams.\n");
     mvd.active = false;
@@ -828,20 +841,13 @@ static void suspend_streams(void)
 
 static void resume_streams(void)
 {
-    gtv_client_t *client;
-
     // build and emit gamestate
     build_gamestate();
     emit_gamestate();
 
-    FOR_EACH_ACTIVE_GTV(client) {
-        // send gamestate
-        write_message(client, GTS_STREAM_DATA);
-#if USE_ZLIB
-        flush_stream(client, Z_SYNC_FLUSH);
-#endif
-        NET_UpdateStream(&client->stream);
-    }
+    // send gamestate
+    write_shared_message(GTS_STREAM_DATA);
+    flush_shared();
 
     // write it to demofile
     if (mvd.recording) {
@@ -1009,7 +1015,6 @@ SV_MvdEndFrame
 */
 void SV_MvdEndFrame(void)
 {
-    gtv_client_t *client;
     size_t total;
     byte header[3];
 
@@ -1060,19 +1065,16 @@ void SV_MvdEndFrame(void)
     WL16(header, total + 1);
     header[2] = GTS_STREAM_DATA;
 
-    // send frame to clients
-    FOR_EACH_ACTIVE_GTV(client) {
-        write_stream(client, header, sizeof(header));
-        write_stream(client, mvd.message.data, mvd.message.cursize);
-        write_stream(client, msg_write.data, msg_write.cursize);
-        write_stream(client, mvd.datagram.data, mvd.datagram.cursize);
 #if USE_ZLIB
-        if (++client->bufcount > client->maxbuf) {
-            flush_stream(client, Z_SYNC_FLUSH);
-        }
+    attach_clients();
 #endif
-        NET_UpdateStream(&client->stream);
-    }
+
+    // send frame to clients
+    write_shared(header, sizeof(header));
+    write_shared(mvd.message.data, mvd.message.cursize);
+    write_shared(msg_write.data, msg_write.cursize);
+    write_shared(mvd.datagram.data, mvd.datagram.cursize);
+    finish_shared_frame();
 
     // write frame to demofile
     if (mvd.recording) {
@@ -1310,6 +1312,18 @@ static void remove_client(gtv_client_t *client)
 }
 
 #if USE_ZLIB
+// raw deflate is used everywhere, so that output of private and shared
+// streams can be spliced into the single zlib stream client expects
+static const byte zlib_header[2] = { 0x78, 0x9c };
+
+static bool init_stream(z_streamp z)
+{
+    z->zalloc = SV_zalloc;
+    z->zfree = SV_zfree;
+    return deflateInit2(z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                        8, Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
 static void flush_stream(gtv_client_t *client, int flush)
 {
     fifo_t *fifo = &client->stream.send;
@@ -1362,9 +1376,13 @@ static void drop_client(gtv_client_t *client, const char *error)
     }
 
 #if USE_ZLIB
+    if (client->attached) {
+        client->attached = false;
+        mvd.z_members--;
+    }
     if (client->z.state) {
-        // finish zlib stream
-        flush_stream(client, Z_FINISH);
+        // zlib stream can't be finished because checksum isn't known
+        flush_stream(client, Z_SYNC_FLUSH);
         deflateEnd(&client->z);
     }
 #endif
@@ -1375,7 +1393,11 @@ static void drop_client(gtv_client_t *client, const char *error)
 }
 
 
-static void write_stream(gtv_client_t *client, void *data, size_t len)
+#if USE_ZLIB
+static void detach_client(gtv_client_t *client);
+#endif
+
+static void write_stream(gtv_client_t *client, const void *data, size_t len)
 {
     fifo_t *fifo = &client->stream.send;
 
@@ -1388,20 +1410,33 @@ static void write_stream(gtv_client_t *client, void *data, size_t len)
     }
 
 #if USE_ZLIB
-    if (client->z.state) {
+    if (client->deflate) {
         z_streamp z = &client->z;
+        byte *out;
 
-        z->next_in = data;
+        // continue on a private stream
+        if (client->attached) {
+            detach_client(client);
+            if (client->state <= cs_zombie) {
+                return;
+            }
+        }
+        if (!z->state && !init_stream(z)) {
+            drop_client(client, "deflateInit failed");
+            return;
+        }
+
+        z->next_in = (Bytef *)data;
         z->avail_in = (uInt)len;
 
         do {
-            data = FIFO_Reserve(fifo, &len);
+            out = FIFO_Reserve(fifo, &len);
             if (!len) {
                 drop_client(client, "overflowed");
                 return;
             }
 
-            z->next_out = data;
+            z->next_out = out;
             z->avail_out = (uInt)len;
 
             if (deflate(z, Z_NO_FLUSH) != Z_OK) {
@@ -1434,6 +1469,203 @@ static void write_message(gtv_client_t *client, gtv_serverop_t op)
     write_stream(client, msg_write.data, msg_write.cursize);
 }
 
+/*
+==============================================================================
+
+SHARED STREAM
+
+Data common to all active clients is written with write_shared(). It is
+copied to clients sending uncompressed or on a private deflate stream, and
+deflated just once on the shared stream for the rest. Private stream can be
+abandoned and shared one joined only at a full flush point, thus clients
+start on a private stream after stream start, and return to it each time
+something is sent only to them.
+
+==============================================================================
+*/
+
+#if USE_ZLIB
+static void write_attached(const byte *data, size_t len)
+{
+    gtv_client_t *client;
+
+    FOR_EACH_ACTIVE_GTV(client) {
+        if (!client->attached) {
+            continue;
+        }
+        if (FIFO_Write(&client->stream.send, data, len) != len) {
+            drop_client(client, "overflowed");
+        }
+    }
+}
+
+static void deflate_shared(const void *data, size_t len, int flush)
+{
+    z_streamp z = &mvd.z;
+    byte buffer[0x1000];
+
+    z->next_in = (Bytef *)data;
+    z->avail_in = (uInt)len;
+
+    do {
+        z->next_out = buffer;
+        z->avail_out = sizeof(buffer);
+
+        deflate(z, flush);
+
+        len = sizeof(buffer) - z->avail_out;
+        if (len) {
+            write_attached(buffer, len);
+            mvd.z_bufcount = 0;
+        }
+    } while (!z->avail_out);
+
+    mvd.z_dirty = flush == Z_NO_FLUSH;
+    if (flush == Z_FULL_FLUSH) {
+        mvd.z_frames = 0;
+    }
+}
+
+// client needs to receive something private
+static void detach_client(gtv_client_t *client)
+{
+    // complete the shared data sent so far
+    if (mvd.z_dirty) {
+        deflate_shared(NULL, 0, Z_SYNC_FLUSH);
+    }
+
+    if (client->attached) {
+        client->attached = false;
+        mvd.z_members--;
+    }
+}
+
+// move clients on private streams to the shared stream
+static void attach_clients(void)
+{
+    gtv_client_t *client;
+    bool pending = false;
+
+    FOR_EACH_ACTIVE_GTV(client) {
+        if (client->deflate && !client->attached) {
+            pending = true;
+            break;
+        }
+    }
+
+    if (!pending) {
+        return;
+    }
+
+    // don't reset compression state too often
+    if (mvd.z_members && mvd.z_frames < GTV_SYNC_FRAMES) {
+        return;
+    }
+
+    if (!mvd.z.state && !init_stream(&mvd.z)) {
+        return;
+    }
+
+    deflate_shared(NULL, 0, Z_FULL_FLUSH);
+
+    FOR_EACH_ACTIVE_GTV(client) {
+        if (!client->deflate || client->attached) {
+            continue;
+        }
+
+        // private stream ends here
+        if (client->z.state) {
+            flush_stream(client, Z_SYNC_FLUSH);
+            deflateEnd(&client->z);
+        }
+
+        if (mvd.z_members) {
+            mvd.z_maxbuf = min(mvd.z_maxbuf, client->maxbuf);
+        } else {
+            mvd.z_maxbuf = client->maxbuf;
+        }
+        mvd.z_members++;
+        client->attached = true;
+    }
+}
+#endif
+
+static void write_shared(const void *data, size_t len)
+{
+    gtv_client_t *client;
+
+    if (!len) {
+        return;
+    }
+
+    FOR_EACH_ACTIVE_GTV(client) {
+#if USE_ZLIB
+        if (client->attached) {
+            continue;
+        }
+#endif
+        write_stream(client, data, len);
+    }
+
+#if USE_ZLIB
+    if (mvd.z_members) {
+        deflate_shared(data, len, Z_NO_FLUSH);
+    }
+#endif
+}
+
+static void write_shared_message(gtv_serverop_t op)
+{
+    byte header[3];
+
+    WL16(header, msg_write.cursize + 1);
+    header[2] = op;
+    write_shared(header, sizeof(header));
+
+    write_shared(msg_write.data, msg_write.cursize);
+}
+
+static void flush_shared(void)
+{
+    gtv_client_t *client;
+
+#if USE_ZLIB
+    if (mvd.z_dirty) {
+        deflate_shared(NULL, 0, Z_SYNC_FLUSH);
+    }
+#endif
+
+    FOR_EACH_ACTIVE_GTV(client) {
+#if USE_ZLIB
+        flush_stream(client, Z_SYNC_FLUSH);
+#endif
+        NET_UpdateStream(&client->stream);
+    }
+}
+
+static void finish_shared_frame(void)
+{
+    gtv_client_t *client;
+
+#if USE_ZLIB
+    if (mvd.z_members) {
+        mvd.z_frames++;
+        if (++mvd.z_bufcount > mvd.z_maxbuf) {
+            deflate_shared(NULL, 0, Z_SYNC_FLUSH);
+        }
+    }
+#endif
+
+    FOR_EACH_ACTIVE_GTV(client) {
+#if USE_ZLIB
+        if (!client->attached && ++client->bufcount > client->maxbuf) {
+            flush_stream(client, Z_SYNC_FLUSH);
+        }
+#endif
+        NET_UpdateStream(&client->stream);
+    }
+}
+
 static bool auth_client(gtv_client_t *client, const char *password)
 {
     if (SV_MatchAddress(&gtv_white_list, &client->stream.address))
@@ -1514,12 +1746,8 @@ static void parse_hello(gtv_client_t *client)
 #if USE_ZLIB
     // the rest of the stream will be deflated
     if (flags & GTF_DEFLATE) {
-        client->z.zalloc = SV_zalloc;
-        client->z.zfree = SV_zfree;
-        if (deflateInit(&client->z, Z_DEFAULT_COMPRESSION) != Z_OK) {
-            drop_client(client, "deflateInit failed");
-            return;
-        }
+        write_stream(client, zlib_header, sizeof(zlib_header));
+        client->deflate = true;
     }
 #endif
 
@@ -1909,6 +2137,9 @@ void SV_MvdStatus_f(void)
         } else {
             dump_clients();
         }
+#if USE_ZLIB
+        Com_Printf("\n%u clients on shared deflate stream.\n", mvd.z_members);
+#endif
     }
     Com_Printf("\n");
 }
@@ -2006,8 +2237,8 @@ void SV_MvdMapChanged(void)
         emit_gamestate();
 
         // send gamestate to all MVD clients
+        write_shared_message(GTS_STREAM_DATA);
         FOR_EACH_ACTIVE_GTV(client) {
-            write_message(client, GTS_STREAM_DATA);
             NET_UpdateStream(&client->stream);
         }
     }
@@ -2147,6 +2378,12 @@ void SV_MvdShutdown(error_type_t type)
     // drop all clients
     mvd_drop(type == ERR_RECONNECT ? GTS_RECONNECT : GTS_DISCONNECT);
 
+#if USE_ZLIB
+    if (mvd.z.state) {
+        deflateEnd(&mvd.z);
+    }
+#endif
+
     // free static data
     Z_Free(mvd.message.data);
     Z_Free(mvd.datagram.data);
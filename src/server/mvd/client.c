@@ -64,6 +64,10 @@ typedef struct gtv_s {
     unsigned    flags;
 #if USE_ZLIB
     bool        z_act; // true when actively inflating
+    bool        z_window; // inflate window allocated, can inflate on worker
+    bool        z_pending; // inflated on worker, result not yet checked
+    int         z_ret;
+    uint64_t    z_usec;
     z_stream    z_str;
     fifo_t      z_buf;
 #endif
@@ -108,6 +112,11 @@ unsigned    mvd_last_activity;
 
 jmp_buf     mvd_jmpbuf;
 
+#if USE_ZLIB
+static gtv_t    **mvd_inflate_list;
+static int      mvd_inflate_alloc;
+#endif
+
 #if USE_DEBUG
 cvar_t      *mvd_shownet;
 #endif
@@ -120,6 +129,12 @@ static cvar_t  *mvd_buffer_size;
 static cvar_t  *mvd_username;
 static cvar_t  *mvd_password;
 static cvar_t  *mvd_snaps;
+static cvar_t  *mvd_demoindex;
+
+static void parse_stream(gtv_t *gtv);
+#if USE_ZLIB
+static int inflate_stream(fifo_t *dst, fifo_t *src, z_streamp z);
+#endif
 
 // ====================================================================
 
@@ -136,14 +151,29 @@ void MVD_StopRecord(mvd_t *mvd)
     Z_Freep((void**)&mvd->demoname);
 }
 
-static void MVD_Free(mvd_t *mvd)
+void MVD_FreeSnapshots(mvd_t *mvd)
 {
     int i;
 
+    if (mvd->numsnapshots > mvd->numindexed && mvd_demoindex->integer && *mvd->index_path) {
+        Com_SaveDemoIndex(mvd->index_path, mvd->index_segment,
+                          mvd->snapshots, mvd->numsnapshots);
+    }
+    mvd->numindexed = 0;
+
     for (i = 0; i < mvd->numsnapshots; i++) {
         Z_Free(mvd->snapshots[i]);
     }
-    Z_Free(mvd->snapshots);
+    mvd->numsnapshots = 0;
+
+    Z_Freep((void**)&mvd->snapshots);
+}
+
+static void MVD_Free(mvd_t *mvd)
+{
+    int i;
+
+    MVD_FreeSnapshots(mvd);
 
     // stop demo recording
     if (mvd->demorecording) {
@@ -394,6 +424,64 @@ static void set_mvd_active(void)
     }
 }
 
+/*
+==============
+MVD_ChargeCPU
+
+Adds time spent working on the channel. Usage is recomputed once per second
+as percentage of a single core.
+==============
+*/
+void MVD_ChargeCPU(mvd_t *mvd, uint64_t usec)
+{
+    unsigned now = Sys_Milliseconds();
+    unsigned delta = now - mvd->cpu_start;
+
+    mvd->cpu_usec += usec;
+
+    if (delta >= 1000) {
+        mvd->cpu_usage = mvd->cpu_usec / (delta * 10);
+        mvd->cpu_usec = 0;
+        mvd->cpu_start = now;
+    }
+}
+
+#if USE_ZLIB
+static void inflate_job(void *arg, int index)
+{
+    gtv_t *gtv = mvd_inflate_list[index];
+    uint64_t start = Sys_Microseconds();
+
+    gtv->z_ret = inflate_stream(&gtv->z_buf, &gtv->stream.recv, &gtv->z_str);
+    gtv->z_usec = Sys_Microseconds() - start;
+}
+
+// inflate data received by all connections in parallel
+static int inflate_pending(void)
+{
+    gtv_t *gtv;
+    int count = 0;
+
+    LIST_FOR_EACH(gtv_t, gtv, &mvd_gtv_list, entry) {
+        if (!gtv->z_pending) {
+            continue;
+        }
+        if (count == mvd_inflate_alloc) {
+            mvd_inflate_alloc += 16;
+            mvd_inflate_list = Z_Realloc(mvd_inflate_list,
+                                         sizeof(mvd_inflate_list[0]) * mvd_inflate_alloc);
+        }
+        mvd_inflate_list[count++] = gtv;
+    }
+
+    if (count) {
+        Com_ParallelFor(inflate_job, NULL, count);
+    }
+
+    return count;
+}
+#endif
+
 /*
 ==============
 MVD_Frame
@@ -404,6 +492,7 @@ Called from main server loop.
 int MVD_Frame(void)
 {
     gtv_t *gtv, *next;
+    uint64_t start;
     int connections = 0;
 
     if (sv.state == ss_broadcast) {
@@ -417,11 +506,40 @@ int MVD_Frame(void)
             continue;
         }
 
+        start = Sys_Microseconds();
         gtv->run(gtv);
+        if (gtv->mvd) {
+            MVD_ChargeCPU(gtv->mvd, Sys_Microseconds() - start);
+        }
 
         connections++;
     }
 
+#if USE_ZLIB
+    // parse data inflated on worker threads
+    if (!inflate_pending()) {
+        return connections;
+    }
+
+    LIST_FOR_EACH_SAFE(gtv_t, gtv, next, &mvd_gtv_list, entry) {
+        if (!gtv->z_pending) {
+            continue;
+        }
+
+        if (setjmp(mvd_jmpbuf)) {
+            SZ_Clear(&msg_write);
+            continue;
+        }
+
+        start = Sys_Microseconds();
+        parse_stream(gtv);
+        NET_UpdateStream(&gtv->stream);
+        if (gtv->mvd) {
+            MVD_ChargeCPU(gtv->mvd, Sys_Microseconds() - start + gtv->z_usec);
+        }
+    }
+#endif
+
     return connections;
 }
 
@@ -548,6 +666,36 @@ static int demo_read_first(qhandle_t f)
 #define MIN_SNAPSHOTS   64
 #define MAX_SNAPSHOTS   250000000
 
+// loads snapshots of the current gamestate from seek index, if any
+static bool demo_load_index(mvd_t *mvd, const char *path, int64_t pos)
+{
+    mvd_snap_t **snapshots;
+    int i, num;
+
+    Q_strlcpy(mvd->index_path, path, sizeof(mvd->index_path));
+    mvd->index_segment = pos;
+    if (!mvd_demoindex->integer)
+        return false;
+
+    num = Com_LoadDemoIndex(path, pos, &snapshots, TAG_MVD);
+    if (!num)
+        return false;
+
+    // initial snapshot must be the one we are about to emit
+    if (snapshots[0]->framenum != mvd->framenum || snapshots[0]->filepos != pos) {
+        Com_DPrintf("Ignoring mismatched seek index for %s\n", path);
+        for (i = 0; i < num; i++)
+            Z_Free(snapshots[i]);
+        Z_Free(snapshots);
+        return false;
+    }
+
+    mvd->snapshots = snapshots;
+    mvd->numsnapshots = mvd->numindexed = num;
+    mvd->last_snapshot = snapshots[num - 1]->framenum;
+    return true;
+}
+
 // periodically builds a fake demo packet used to reconstruct delta compression
 // state, configstrings and layouts at the given server frame.
 static void demo_emit_snapshot(mvd_t *mvd)
@@ -579,6 +727,9 @@ static void demo_emit_snapshot(mvd_t *mvd)
     if (pos < gtv->demoofs)
         return;
 
+    if (!mvd->numsnapshots && gtv->demoentry && demo_load_index(mvd, gtv->demoentry->string, pos))
+        return;
+
     // write baseline frame
     MSG_WriteByte(mvd_frame);
     emit_base_frame(mvd);
@@ -1396,9 +1547,12 @@ static int inflate_stream(fifo_t *dst, fifo_t *src, z_streamp z)
     return ret;
 }
 
-static void inflate_more(gtv_t *gtv)
+static void inflate_check(gtv_t *gtv, int ret)
 {
-    int ret = inflate_stream(&gtv->z_buf, &gtv->stream.recv, &gtv->z_str);
+    // window is allocated once anything has been inflated
+    if (gtv->z_str.total_out) {
+        gtv->z_window = true;
+    }
 
     switch (ret) {
     case Z_BUF_ERROR:
@@ -1412,6 +1566,11 @@ static void inflate_more(gtv_t *gtv)
         gtv_destroyf(gtv, "inflate() failed with error %d", ret);
     }
 }
+
+static void inflate_more(gtv_t *gtv)
+{
+    inflate_check(gtv, inflate_stream(&gtv->z_buf, &gtv->stream.recv, &gtv->z_str));
+}
 #endif
 
 static neterr_t run_connect(gtv_t *gtv)
@@ -1445,29 +1604,21 @@ static neterr_t run_connect(gtv_t *gtv)
     return NET_OK;
 }
 
-static neterr_t run_stream(gtv_t *gtv)
+static void parse_stream(gtv_t *gtv)
 {
-    neterr_t ret;
 #if USE_DEBUG
-    int count;
-    size_t usage;
-#endif
-
-    // run network stream
-    if ((ret = NET_RunStream(&gtv->stream)) != NET_OK) {
-        return ret;
-    }
-
-#if USE_DEBUG
-    count = 0;
-    usage = FIFO_Usage(&gtv->stream.recv);
+    int count = 0;
+    size_t usage = FIFO_Usage(&gtv->stream.recv);
 #endif
 
 #if USE_ZLIB
-    if (gtv->z_act) {
+    if (gtv->z_act || gtv->z_pending) {
         while (1) {
-            // decompress more data
-            if (gtv->z_act) {
+            // decompress more data, unless already done on worker
+            if (gtv->z_pending) {
+                gtv->z_pending = false;
+                inflate_check(gtv, gtv->z_ret);
+            } else if (gtv->z_act) {
                 inflate_more(gtv);
             }
             if (!parse_message(gtv, &gtv->z_buf)) {
@@ -1493,7 +1644,33 @@ static neterr_t run_stream(gtv_t *gtv)
                    gtv->name, total, count);
     }
 #endif
+}
+
+static neterr_t run_stream(gtv_t *gtv)
+{
+    neterr_t ret;
+#if USE_ZLIB
+    size_t usage = FIFO_Usage(&gtv->stream.recv);
+#endif
+
+    // run network stream
+    if ((ret = NET_RunStream(&gtv->stream)) != NET_OK) {
+        return ret;
+    }
+
+#if USE_ZLIB
+    // defer to MVD_Frame to inflate in parallel with other connections
+    if (gtv->z_act && gtv->z_window) {
+        // parsing happens after check_timeouts, so don't timeout here
+        if (FIFO_Usage(&gtv->stream.recv) > usage) {
+            gtv->last_rcvd = svs.realtime;
+        }
+        gtv->z_pending = true;
+        return NET_OK;
+    }
+#endif
 
+    parse_stream(gtv);
     return NET_OK;
 }
 
@@ -1663,6 +1840,7 @@ static void gtv_drop(gtv_t *gtv)
     inflateReset(&gtv->z_str);
     FIFO_Clear(&gtv->z_buf);
     gtv->z_act = false;
+    gtv->z_pending = false;
 #endif
     gtv->msglen = 0;
     gtv->state = GTV_DISCONNECTED;
@@ -1720,15 +1898,16 @@ static void list_generic(void)
     mvd_t *mvd;
 
     Com_Printf(
-        "id name         map      spc plr stat buf pckt address       \n"
-        "-- ------------ -------- --- --- ---- --- ---- --------------\n");
+        "id name         map      spc plr stat buf pckt cpu address       \n"
+        "-- ------------ -------- --- --- ---- --- ---- --- --------------\n");
 
     FOR_EACH_MVD(mvd) {
-        Com_Printf("%2d %-12.12s %-8.8s %3d %3d %-4.4s %3d %4u %s\n",
+        Com_Printf("%2d %-12.12s %-8.8s %3d %3d %-4.4s %3d %4u %3d %s\n",
                    mvd->id, mvd->name, mvd->mapname,
                    List_Count(&mvd->clients), mvd->numplayers,
                    mvd_states[mvd->state],
                    FIFO_Percent(&mvd->delay), mvd->num_packets,
+                   mvd->cpu_usage,
                    mvd->gtv ? mvd->gtv->address : "<disconnected>");
     }
 }
@@ -2653,6 +2832,10 @@ void MVD_Shutdown(void)
 
     Z_Freep((void**)&mvd_clients);
     Z_Freep((void**)&mvd_ge.edicts);
+#if USE_ZLIB
+    Z_Freep((void**)&mvd_inflate_list);
+    mvd_inflate_alloc = 0;
+#endif
 
     mvd_chanid = 0;
 
@@ -2706,6 +2889,7 @@ void MVD_Register(void)
     mvd_username = Cvar_Get("mvd_username", "unnamed", 0);
     mvd_password = Cvar_Get("mvd_password", "", CVAR_PRIVATE);
     mvd_snaps = Cvar_Get("mvd_snaps", "10", 0);
+    mvd_demoindex = Cvar_Get("mvd_demoindex", "1", 0);
 
     Cmd_Register(c_mvd);
 }
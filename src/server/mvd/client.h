@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include "../server.h"
+#include "common/demoidx.h"
 #include <setjmp.h>
 
 #define MVD_Malloc(size)    Z_TagMalloc(size, TAG_MVD)
@@ -113,12 +114,7 @@ typedef enum {
     MVD_NUM_STATES
 } mvd_state_t;
 
-typedef struct {
-    int framenum;
-    int64_t filepos;
-    size_t msglen;
-    byte data[1];
-} mvd_snap_t;
+typedef demosnap_t mvd_snap_t;
 
 struct gtv_s;
 
@@ -141,6 +137,9 @@ typedef struct mvd_s {
     int         last_snapshot;
     mvd_snap_t  **snapshots;
     int         numsnapshots;
+    int         numindexed;         // number of snapshots loaded from seek index
+    int64_t     index_segment;      // file position of the first snapshot after gamestate
+    char        index_path[MAX_OSPATH];
 
     // delay buffer
     fifo_t      delay;
@@ -149,6 +148,11 @@ typedef struct mvd_s {
     unsigned    underflows, overflows;
     int         framenum;
 
+    // CPU accounting
+    uint64_t    cpu_usec;   // time spent since cpu_start
+    unsigned    cpu_start;
+    int         cpu_usage;  // percentage of one core during last second
+
     // game state
     char            gamedir[MAX_QPATH];
     char            mapname[MAX_QPATH];
@@ -209,6 +213,8 @@ void MVD_File_g(genctx_t *ctx);
 void MVD_Spawn(void);
 
 void MVD_StopRecord(mvd_t *mvd);
+void MVD_FreeSnapshots(mvd_t *mvd);
+void MVD_ChargeCPU(mvd_t *mvd, uint64_t usec);
 
 void MVD_StreamedStop_f(void);
 void MVD_StreamedRecord_f(void);
@@ -2252,6 +2252,7 @@ fail:
 static void MVD_GameRunFrame(void)
 {
     mvd_t *mvd, *next;
+    uint64_t start;
     int numplayers = 0;
 
     LIST_FOR_EACH_SAFE(mvd_t, mvd, next, &mvd_channel_list, entry) {
@@ -2259,6 +2260,8 @@ static void MVD_GameRunFrame(void)
             continue;
         }
 
+        start = Sys_Microseconds();
+
         // parse stream
         if (!mvd->read_frame(mvd)) {
             goto update;
@@ -2272,6 +2275,8 @@ static void MVD_GameRunFrame(void)
 update:
         MVD_UpdateLayouts(mvd);
         numplayers += mvd->numplayers;
+
+        MVD_ChargeCPU(mvd, Sys_Microseconds() - start);
     }
 
     MVD_UpdateLayouts(&mvd_waitingRoom);
@@ -828,12 +828,7 @@ void MVD_ClearState(mvd_t *mvd, bool full)
         return;
 
     // free all snapshots
-    for (i = 0; i < mvd->numsnapshots; i++) {
-        Z_Free(mvd->snapshots[i]);
-    }
-    mvd->numsnapshots = 0;
-
-    Z_Freep((void**)&mvd->snapshots);
+    MVD_FreeSnapshots(mvd);
 
     // free current map
     CM_FreeMap(&mvd->cm);
@@ -239,6 +239,27 @@ void SV_BroadcastCommand(const char *fmt, ...)
 }
 
 
+// set while the write buffer is being multicast to several clients
+static bool             msg_share_pending;
+static message_blob_t   *msg_share_blob;
+
+// client leaf is looked up again only when the client has moved
+static void update_client_leaf(client_t *client)
+{
+    const float *org = client->edict->s.origin;
+    mleaf_t *leaf;
+
+    if (client->mcast_valid && VectorCompare(org, client->mcast_origin)) {
+        return;
+    }
+
+    leaf = CM_PointLeaf(&sv.cm, org);
+    VectorCopy(org, client->mcast_origin);
+    client->mcast_cluster = leaf->cluster;
+    client->mcast_area = leaf->area;
+    client->mcast_valid = true;
+}
+
 /*
 =================
 SV_Multicast
@@ -257,9 +278,13 @@ void SV_Multicast(const vec3_t origin, multicast_t to)
 {
     client_t    *client;
     byte        mask[VIS_MAX_BYTES];
-    mleaf_t     *leaf1 = NULL, *leaf2;
+    uint32_t    recipients[MAX_CLIENTS / 32];
+    uint32_t    bits;
+    mleaf_t     *leaf1 = NULL;
     int         leafnum q_unused = 0;
     int         flags = 0;
+    int         i, j;
+    size_t      cursize = msg_write.cursize;
 
     if (!sv.cm.cache) {
         Com_Error(ERR_DROP, "%s: no map loaded", __func__);
@@ -291,7 +316,8 @@ void SV_Multicast(const vec3_t origin, multicast_t to)
         Com_Error(ERR_DROP, "SV_Multicast: bad to: %i", to);
     }
 
-    // send the data to all relevent clients
+    // find all relevant clients
+    memset(recipients, 0, sizeof(recipients));
     FOR_EACH_CLIENT(client) {
         if (client->state < cs_primed) {
             continue;
@@ -302,17 +328,35 @@ void SV_Multicast(const vec3_t origin, multicast_t to)
         }
 
         if (leaf1) {
-            leaf2 = CM_PointLeaf(&sv.cm, client->edict->s.origin);
-            if (!CM_AreasConnected(&sv.cm, leaf1->area, leaf2->area))
+            update_client_leaf(client);
+            if (client->mcast_cluster == -1)
                 continue;
-            if (leaf2->cluster == -1)
+            if (!Q_IsBitSet(mask, client->mcast_cluster))
                 continue;
-            if (!Q_IsBitSet(mask, leaf2->cluster))
+            if (!CM_AreasConnected(&sv.cm, leaf1->area, client->mcast_area))
                 continue;
         }
 
-        SV_ClientAddMessage(client, flags);
+        recipients[client->number >> 5] |= 1U << (client->number & 31);
+    }
+
+    // send the data to them, sharing large message body
+    msg_share_pending = true;
+    msg_share_blob = NULL;
+    for (i = 0; i < q_countof(recipients); i++) {
+        for (j = 0, bits = recipients[i]; bits; j++, bits >>= 1) {
+            if (bits & 1) {
+                SV_ClientAddMessage(&svs.client_pool[i * 32 + j], flags);
+                // dropping a client may have reused the write buffer
+                if (!msg_share_pending || msg_write.cursize != cursize) {
+                    msg_share_pending = false;
+                    msg_share_blob = NULL;
+                }
+            }
+        }
     }
+    msg_share_pending = false;
+    msg_share_blob = NULL;
 
     // add to MVD datagram
     SV_MvdMulticast(leafnum, to);
@@ -430,6 +474,11 @@ FRAME UPDATES - COMMON
 ===============================================================================
 */
 
+static inline byte *msg_packet_data(message_packet_t *msg)
+{
+    return msg->cursize > MSG_TRESHOLD ? msg->blob->data : msg->data;
+}
+
 static inline void free_msg_packet(client_t *client, message_packet_t *msg)
 {
     List_Remove(&msg->entry);
@@ -437,10 +486,33 @@ static inline void free_msg_packet(client_t *client, message_packet_t *msg)
     if (msg->cursize > MSG_TRESHOLD) {
         Q_assert(msg->cursize <= client->msg_dynamic_bytes);
         client->msg_dynamic_bytes -= msg->cursize;
-        Z_Free(msg);
+        if (!--msg->blob->refcount) {
+            Z_Free(msg->blob);
+        }
+    }
+
+    List_Insert(&client->msg_free_list, &msg->entry);
+}
+
+// multicast message body is allocated once and referenced by all recipients
+static message_blob_t *get_msg_blob(const byte *data, size_t len)
+{
+    message_blob_t *blob;
+    bool shared = msg_share_pending && data == msg_write.data && len == msg_write.cursize;
+
+    if (shared && msg_share_blob) {
+        blob = msg_share_blob;
     } else {
-        List_Insert(&client->msg_free_list, &msg->entry);
+        blob = SV_Malloc(sizeof(*blob) + len - 1);
+        blob->refcount = 0;
+        memcpy(blob->data, data, len);
+        if (shared) {
+            msg_share_blob = blob;
+        }
     }
+
+    blob->refcount++;
+    return blob;
 }
 
 #define FOR_EACH_MSG_SAFE(list) \
@@ -475,25 +547,27 @@ static void add_msg_packet(client_t     *client,
 
     Q_assert(len <= MAX_MSGLEN);
 
+    if (len > MSG_TRESHOLD && client->msg_dynamic_bytes > MAX_MSGLEN - len) {
+        Com_WPrintf("%s: %s: out of dynamic memory\n",
+                    __func__, client->name);
+        goto overflowed;
+    }
+
+    if (LIST_EMPTY(&client->msg_free_list)) {
+        Com_WPrintf("%s: %s: out of message slots\n",
+                    __func__, client->name);
+        goto overflowed;
+    }
+
+    msg = MSG_FIRST(&client->msg_free_list);
+    List_Remove(&msg->entry);
+
     if (len > MSG_TRESHOLD) {
-        if (client->msg_dynamic_bytes > MAX_MSGLEN - len) {
-            Com_WPrintf("%s: %s: out of dynamic memory\n",
-                        __func__, client->name);
-            goto overflowed;
-        }
-        msg = SV_Malloc(sizeof(*msg) + len - MSG_TRESHOLD);
+        msg->blob = get_msg_blob(data, len);
         client->msg_dynamic_bytes += len;
     } else {
-        if (LIST_EMPTY(&client->msg_free_list)) {
-            Com_WPrintf("%s: %s: out of message slots\n",
-                        __func__, client->name);
-            goto overflowed;
-        }
-        msg = MSG_FIRST(&client->msg_free_list);
-        List_Remove(&msg->entry);
+        memcpy(msg->data, data, len);
     }
-
-    memcpy(msg->data, data, len);
     msg->cursize = (uint16_t)len;
 
     if (reliable) {
@@ -583,7 +657,7 @@ static inline void write_msg(client_t *client, message_packet_t *msg, size_t max
 {
     // if this msg fits, write it
     if (msg_write.cursize + msg->cursize <= maxsize) {
-        MSG_WriteData(msg->data, msg->cursize);
+        MSG_WriteData(msg_packet_data(msg), msg->cursize);
     }
     free_msg_packet(client, msg);
 }
@@ -651,7 +725,7 @@ static void write_reliables_old(client_t *client, size_t maxsize)
         SV_DPrintf(1, "%s to %s: writing msg %d: %d bytes\n",
                    __func__, client->name, count, msg->cursize);
 
-        SZ_Write(&client->netchan.message, msg->data, msg->cursize);
+        SZ_Write(&client->netchan.message, msg_packet_data(msg), msg->cursize);
         free_msg_packet(client, msg);
         count++;
     }
@@ -661,6 +735,7 @@ static void write_reliables_old(client_t *client, size_t maxsize)
 static void repack_unreliables(client_t *client, size_t maxsize)
 {
     message_packet_t *msg, *next;
+    byte *data;
 
     if (msg_write.cursize + 4 > maxsize) {
         return;
@@ -668,13 +743,17 @@ static void repack_unreliables(client_t *client, size_t maxsize)
 
     // temp entities first
     FOR_EACH_MSG_SAFE(&client->msg_unreliable_list) {
-        if (!msg->cursize || msg->data[0] != svc_temp_entity) {
+        if (!msg->cursize) {
+            continue;
+        }
+        data = msg_packet_data(msg);
+        if (data[0] != svc_temp_entity) {
             continue;
         }
         // ignore some low-priority effects, these checks come from r1q2
-        if (msg->data[1] == TE_BLOOD || msg->data[1] == TE_SPLASH ||
-            msg->data[1] == TE_GUNSHOT || msg->data[1] == TE_BULLET_SPARKS ||
-            msg->data[1] == TE_SHOTGUN) {
+        if (data[1] == TE_BLOOD || data[1] == TE_SPLASH ||
+            data[1] == TE_GUNSHOT || data[1] == TE_BULLET_SPARKS ||
+            data[1] == TE_SHOTGUN) {
             continue;
         }
         write_msg(client, msg, maxsize);
@@ -697,7 +776,7 @@ static void repack_unreliables(client_t *client, size_t maxsize)
 
     // then positioned sounds
     FOR_EACH_MSG_SAFE(&client->msg_unreliable_list) {
-        if (msg->cursize && msg->data[0] == svc_sound) {
+        if (msg->cursize && msg_packet_data(msg)[0] == svc_sound) {
             write_msg(client, msg, maxsize);
         }
     }
@@ -905,8 +984,16 @@ Clients in earlier connection state are handled in SV_SendAsyncPackets.
 void SV_SendClientMessages(void)
 {
     client_t    *client;
+    client_t    *build[MAX_CLIENTS];
+    client_t    *write[MAX_CLIENTS];
+    int         i, numbuild, numwrite;
     size_t      cursize;
 
+    numbuild = numwrite = 0;
+
+    // write all datagrams out together
+    NET_BeginSendBatch();
+
     // send a message to each connected client
     FOR_EACH_CLIENT(client) {
         if (!CLIENT_ACTIVE(client))
@@ -940,9 +1027,11 @@ void SV_SendClientMessages(void)
             goto advance;
         }
 
-        // build the new frame and write it
-        SV_BuildClientFrame(client);
-        client->WriteDatagram(client);
+        // build the new frame and write it once all frames are built
+        if (client->edict->client)
+            build[numbuild++] = client;
+        write[numwrite++] = client;
+        continue;
 
 advance:
         // advance for next frame
@@ -952,6 +1041,21 @@ finish:
         // clear all unreliable messages still left
         finish_frame(client);
     }
+
+    SV_BuildClientFrames(build, numbuild);
+
+    for (i = 0; i < numwrite; i++) {
+        client = write[i];
+        client->WriteDatagram(client);
+
+        // advance for next frame
+        client->framenum++;
+
+        // clear all unreliable messages still left
+        finish_frame(client);
+    }
+
+    NET_FlushSendBatch();
 }
 
 static void write_pending_download(client_t *client)
@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "shared/list.h"
 #include "shared/game.h"
 
+#include "common/async.h"
 #include "common/bsp.h"
 #include "common/cmd.h"
 #include "common/cmodel.h"
@@ -230,11 +231,19 @@ typedef enum {
 
 #define MAX_SOUND_PACKET   14
 
+// message body larger than MSG_TRESHOLD, shared by all clients it was
+// multicast to
+typedef struct {
+    int                 refcount;
+    uint8_t             data[1];
+} message_blob_t;
+
 typedef struct {
     list_t              entry;
     uint16_t            cursize;    // zero means sound packet
     union {
         uint8_t         data[MSG_TRESHOLD];
+        message_blob_t  *blob;      // if cursize > MSG_TRESHOLD
         struct {
             uint16_t    index;
             uint16_t    sendchan;
@@ -330,7 +339,8 @@ typedef struct client_s {
     unsigned        send_time, send_delta;          // used to rate drop async packets
 
     // current download
-    byte            *download;      // file being downloaded
+    struct dlcache_s    *downloadcache; // shared file contents
+    const byte      *download;      // file being downloaded
     int             downloadsize;   // total bytes (can't use EOF because of paks)
     int             downloadcount;  // bytes sent
     char            *downloadname;  // name of the file
@@ -354,6 +364,12 @@ typedef struct client_s {
     unsigned            msg_unreliable_bytes;   // total size of unreliable datagram
     unsigned            msg_dynamic_bytes;      // total size of dynamic memory allocated
 
+    // multicast visibility, looked up again only when the client moves
+    bool            mcast_valid;
+    vec3_t          mcast_origin;
+    int             mcast_cluster;
+    int             mcast_area;
+
     // per-client baseline chunks
     entity_packed_t     *baselines[SV_BASELINES_CHUNKS];
 
@@ -479,6 +495,7 @@ typedef struct server_static_s {
     unsigned        num_entities;   // maxclients*UPDATE_BACKUP*MAX_PACKET_ENTITIES
     unsigned        next_entity;    // next state to use
     entity_packed_t *entities;      // [num_entities]
+    uint16_t        *frame_ents;    // [maxclients*MAX_EDICTS], for building frames
 
 #if USE_ZLIB
     z_stream        z;  // for compressing messages at once
@@ -541,6 +558,8 @@ extern cvar_t       *sv_lan_force_rate;
 extern cvar_t       *sv_calcpings_method;
 extern cvar_t       *sv_changemapcmd;
 extern cvar_t       *sv_max_download_size;
+extern cvar_t       *sv_download_cache;
+extern cvar_t       *sv_delta_cache;
 extern cvar_t       *sv_max_packet_entities;
 
 extern cvar_t       *sv_strafejump_hack;
@@ -730,6 +749,9 @@ void SV_New_f(void);
 void SV_Begin_f(void);
 void SV_ExecuteClientMessage(client_t *cl);
 void SV_CloseDownload(client_t *client);
+void SV_ExpireDownloadCache(void);
+void SV_FlushDownloadCache(void);
+void SV_DownloadCacheStats(void);
 #if USE_FPS
 void SV_AlignKeyFrames(client_t *client);
 #else
@@ -757,9 +779,12 @@ void SV_PrintMiscInfo(void);
 #define HAS_EFFECTS(ent) \
     ((ent)->s.modelindex || (ent)->s.effects || (ent)->s.sound || (ent)->s.event)
 
-void SV_BuildClientFrame(client_t *client);
+void SV_BuildClientFrames(client_t **clients, int count);
 void SV_WriteFrameToClient_Default(client_t *client);
 void SV_WriteFrameToClient_Enhanced(client_t *client);
+void SV_FreeDeltaCache(void);
+void SV_DeltaCacheStats(void);
+void SV_DeltaBench_f(void);
 
 //
 // sv_game.c
@@ -789,6 +814,9 @@ bool SV_NoSaveGames(void);
 // high level object sorting to reduce interaction tests
 //
 
+void SV_RegisterWorld(void);
+void SV_StopAreaRecord(void);
+
 void SV_ClearWorld(void);
 // called after the world model has been loaded, before linking any entities
 
@@ -805,6 +833,7 @@ void PF_LinkEdict(edict_t *ent);
 // is not solid
 
 int SV_AreaEdicts(const vec3_t mins, const vec3_t maxs, edict_t **list, int maxcount, int areatype);
+int SV_RadiusEdicts(const vec3_t origin, float radius, edict_t **list, int maxcount);
 // fills in a table of edict pointers with edicts that have bounding boxes
 // that intersect the given area.  It is possible for a non-axial bmodel
 // to be returned that doesn't actually intersect the area on an exact
@@ -824,6 +853,8 @@ int SV_PointContents(const vec3_t p);
 trace_t q_gameabi SV_Trace(const vec3_t start, const vec3_t mins,
                            const vec3_t maxs, const vec3_t end,
                            edict_t *passedict, int contentmask);
+void SV_TraceBatch(trace_t *traces, const vec3_t *starts, const vec3_t *ends, int count,
+                   const vec3_t mins, const vec3_t maxs, edict_t *passedict, int contentmask);
 // mins and maxs are relative
 
 // if the entire move stays in a solid volume, trace.allsolid will be set,
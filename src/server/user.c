@@ -546,9 +546,150 @@ void SV_Begin_f(void)
 
 //=============================================================================
 
+/*
+============================================================================
+
+DOWNLOAD CACHE
+
+Files served over UDP are loaded once and shared by all clients downloading
+them, each client only keeps its own offset. Files are keyed by name,
+compression mode, size and modification time. Files nobody is downloading
+are kept around until total size exceeds sv_download_cache megabytes, then
+least recently used ones are freed first.
+
+============================================================================
+*/
+
+typedef struct dlcache_s {
+    list_t      entry;
+    unsigned    refcount;
+    int         cmd;
+    int         size;
+    uint64_t    mtime;
+    unsigned    generation;
+    char        *name;
+    byte        data[1];
+} dlcache_t;
+
+static LIST_DECL(sv_dlcache);   // most recently used first
+static size_t   sv_dlcache_bytes;
+static unsigned sv_dlcache_count;
+static unsigned sv_dlcache_hits;
+static unsigned sv_dlcache_misses;
+static unsigned sv_dlcache_generation;  // bumped on filesystem restart
+
+static void free_dlcache(dlcache_t *cache)
+{
+    List_Remove(&cache->entry);
+    sv_dlcache_bytes -= cache->size;
+    sv_dlcache_count--;
+    Z_Free(cache->name);
+    Z_Free(cache);
+}
+
+// frees unused files until cache fits
+static void trim_dlcache(void)
+{
+    size_t maxbytes = (size_t)Cvar_ClampInteger(sv_download_cache, 0, 4096) << 20;
+    dlcache_t *cache, *next;
+
+    for (cache = LIST_LAST(dlcache_t, &sv_dlcache, entry);
+         !LIST_TERM(cache, &sv_dlcache, entry) && sv_dlcache_bytes > maxbytes;
+         cache = next) {
+        next = LIST_PREV(dlcache_t, cache, entry);
+        if (!cache->refcount)
+            free_dlcache(cache);
+    }
+}
+
+static dlcache_t *find_dlcache(const char *name, int cmd, int size, uint64_t mtime)
+{
+    dlcache_t *cache;
+
+    LIST_FOR_EACH(dlcache_t, cache, &sv_dlcache, entry) {
+        if (cache->generation == sv_dlcache_generation &&
+            cache->cmd == cmd && cache->size == size &&
+            cache->mtime == mtime && !strcmp(cache->name, name)) {
+            // move to front
+            List_Remove(&cache->entry);
+            List_Insert(&sv_dlcache, &cache->entry);
+            return cache;
+        }
+    }
+
+    return NULL;
+}
+
+static dlcache_t *load_dlcache(const char *name, int cmd, int size, uint64_t mtime, qhandle_t f)
+{
+    dlcache_t *cache;
+
+    cache = SV_Malloc(sizeof(*cache) + size - 1);
+    if (FS_Read(cache->data, size, f) != size) {
+        Z_Free(cache);
+        return NULL;
+    }
+
+    cache->refcount = 0;
+    cache->cmd = cmd;
+    cache->size = size;
+    cache->mtime = mtime;
+    cache->generation = sv_dlcache_generation;
+    cache->name = SV_CopyString(name);
+    List_Insert(&sv_dlcache, &cache->entry);
+    sv_dlcache_bytes += size;
+    sv_dlcache_count++;
+
+    return cache;
+}
+
+// contents of packs may have changed, don't reuse any cached files
+void SV_ExpireDownloadCache(void)
+{
+    dlcache_t *cache, *next;
+
+    LIST_FOR_EACH_SAFE(dlcache_t, cache, next, &sv_dlcache, entry) {
+        if (!cache->refcount)
+            free_dlcache(cache);
+    }
+
+    sv_dlcache_generation++;
+}
+
+void SV_FlushDownloadCache(void)
+{
+    dlcache_t *cache, *next;
+
+    LIST_FOR_EACH_SAFE(dlcache_t, cache, next, &sv_dlcache, entry) {
+        if (cache->refcount)
+            Com_WPrintf("%s: %s still referenced\n", __func__, cache->name);
+        Z_Free(cache->name);
+        Z_Free(cache);
+    }
+
+    List_Init(&sv_dlcache);
+    sv_dlcache_bytes = 0;
+    sv_dlcache_count = 0;
+}
+
+void SV_DownloadCacheStats(void)
+{
+    char buffer[16];
+
+    Com_FormatSizeLong(buffer, sizeof(buffer), sv_dlcache_bytes);
+    Com_Printf("\nDownload cache: %u files, %s resident, %u hits, %u misses\n",
+               sv_dlcache_count, buffer, sv_dlcache_hits, sv_dlcache_misses);
+}
+
 void SV_CloseDownload(client_t *client)
 {
-    Z_Freep((void**)&client->download);
+    if (client->downloadcache) {
+        Q_assert(client->downloadcache->refcount);
+        client->downloadcache->refcount--;
+        client->downloadcache = NULL;
+        trim_dlcache();
+    }
+    client->download = NULL;
     Z_Freep((void**)&client->downloadname);
     client->downloadsize = 0;
     client->downloadcount = 0;
@@ -577,10 +718,11 @@ SV_BeginDownload_f
 static void SV_BeginDownload_f(void)
 {
     char    name[MAX_QPATH];
-    byte    *download;
+    dlcache_t   *cache;
+    uint64_t    mtime;
     int     downloadcmd;
     int64_t downloadsize;
-    int     maxdownloadsize, result, offset = 0;
+    int     maxdownloadsize, offset = 0;
     cvar_t  *allow;
     size_t  len;
     qhandle_t f;
@@ -705,16 +847,30 @@ static void SV_BeginDownload_f(void)
         return;
     }
 
-    download = SV_Malloc(downloadsize);
-    result = FS_Read(download, downloadsize, f);
-    if (result != downloadsize) {
-        Com_DPrintf("Couldn't download %s to %s\n", name, sv_client->name);
-        goto fail3;
+    // files in packs have no modification time, but can't change
+    // without filesystem restart, which expires the cache
+    if (FS_LastModified(name, &mtime))
+        mtime = 0;
+
+    cache = find_dlcache(name, downloadcmd, downloadsize, mtime);
+    if (cache) {
+        sv_dlcache_hits++;
+    } else {
+        cache = load_dlcache(name, downloadcmd, downloadsize, mtime, f);
+        if (!cache) {
+            Com_DPrintf("Couldn't download %s to %s\n", name, sv_client->name);
+            goto fail2;
+        }
+        sv_dlcache_misses++;
     }
 
     FS_CloseFile(f);
 
-    sv_client->download = download;
+    cache->refcount++;
+    trim_dlcache();
+
+    sv_client->downloadcache = cache;
+    sv_client->download = cache->data;
     sv_client->downloadsize = downloadsize;
     sv_client->downloadcount = offset;
     sv_client->downloadname = SV_CopyString(name);
@@ -724,8 +880,6 @@ static void SV_BeginDownload_f(void)
     Com_DPrintf("Downloading %s to %s\n", name, sv_client->name);
     return;
 
-fail3:
-    Z_Free(download);
 fail2:
     FS_CloseFile(f);
 fail1:
@@ -25,27 +25,174 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 ENTITY AREA CHECKING
 
 FIXME: this use of "area" is different from the bsp file use
+
+Entities are sorted into a binary tree of axis aligned nodes. Each entity is
+linked into the deepest node that fully contains its absolute bounding box.
+
+The classic layout is a uniform tree of fixed depth splitting only on X/Y,
+which is kept as a fallback (sv_area_adaptive 0). The adaptive layout starts
+with a single node and splits leafs on their longest axis (including Z) once
+they collect more than AREA_SPLIT_COUNT entities, so the tree only gets deep
+where entities actually cluster. Nodes are never merged, the tree is thrown
+away on every map change.
 ===============================================================================
 */
 
+#define AREA_DEPTH          4       // classic tree
+#define AREA_NODES          1024
+#define AREA_MAX_DEPTH      12      // adaptive tree
+#define AREA_SPLIT_COUNT    12
+#define AREA_MIN_SIZE       64
+
 typedef struct areanode_s {
     int     axis;       // -1 = leaf node
     float   dist;
     struct areanode_s   *children[2];
+    struct areanode_s   *parent;
     list_t  trigger_edicts;
     list_t  solid_edicts;
+    vec3_t  mins, maxs;
+    int     depth;
+    int     numedicts;
+    unsigned    generation;     // link changes in this node (trace memo only)
+    unsigned    subtree_generation;     // link changes in this node or below
 } areanode_t;
 
-#define    AREA_DEPTH    4
-#define    AREA_NODES    32
+typedef struct {
+    areanode_t  *node;
+    bool        trigger;
+} arealink_t;
 
-static areanode_t   sv_areanodes[AREA_NODES];
-static int          sv_numareanodes;
+typedef struct {
+    areanode_t  nodes[AREA_NODES];
+    int         numnodes;
+    bool        adaptive;
+    byte        *edicts;
+    int         edict_size;
+    arealink_t  links[MAX_EDICTS];
+} areatree_t;
+
+// server tree uses game edicts, which may get reallocated by the game
+#define AREA_NUM(tree, e) \
+    ((tree)->edicts ? (int)(((byte *)(e) - (tree)->edicts) / (tree)->edict_size) : NUM_FOR_EDICT(e))
+
+static areatree_t   sv_area;
 
 static const vec_t  *area_mins, *area_maxs;
 static edict_t      **area_list;
 static int          area_count, area_maxcount;
 static int          area_type;
+static unsigned     area_scanned;
+
+static cvar_t       *sv_area_adaptive;
+
+static cvar_t       *sv_tracememo;
+
+static void SV_ClearTraceMemo(void);
+
+/*
+===============
+SV_AllocAreaNode
+===============
+*/
+static areanode_t *SV_AllocAreaNode(areatree_t *tree, int depth, const vec3_t mins, const vec3_t maxs)
+{
+    areanode_t  *anode;
+
+    Q_assert(tree->numnodes < AREA_NODES);
+    anode = &tree->nodes[tree->numnodes++];
+
+    List_Init(&anode->trigger_edicts);
+    List_Init(&anode->solid_edicts);
+    VectorCopy(mins, anode->mins);
+    VectorCopy(maxs, anode->maxs);
+    anode->axis = -1;
+    anode->children[0] = anode->children[1] = NULL;
+    anode->parent = NULL;
+    anode->depth = depth;
+    anode->numedicts = 0;
+    anode->generation = 0;
+    anode->subtree_generation = 0;
+
+    return anode;
+}
+
+/*
+===============
+SV_DivideAreaNode
+
+Turns a leaf into a node with two empty children split at the middle of the
+given axis. Children[0] is the side above the split plane.
+===============
+*/
+static void SV_DivideAreaNode(areatree_t *tree, areanode_t *anode, int axis)
+{
+    vec3_t      mins1, maxs1, mins2, maxs2;
+
+    anode->axis = axis;
+    anode->dist = 0.5f * (anode->maxs[axis] + anode->mins[axis]);
+    VectorCopy(anode->mins, mins1);
+    VectorCopy(anode->mins, mins2);
+    VectorCopy(anode->maxs, maxs1);
+    VectorCopy(anode->maxs, maxs2);
+
+    maxs1[axis] = mins2[axis] = anode->dist;
+
+    anode->children[0] = SV_AllocAreaNode(tree, anode->depth + 1, mins2, maxs2);
+    anode->children[1] = SV_AllocAreaNode(tree, anode->depth + 1, mins1, maxs1);
+    anode->children[0]->parent = anode;
+    anode->children[1]->parent = anode;
+}
+
+/*
+===============
+SV_TouchAreaNode
+
+Records a link change for the trace memo. Area queries see entities of every
+node on the path from the root down to the deepest node containing the query
+box, and of that node's subtree, so the memo checks generations of the path
+and subtree generation of the last node. Nothing is tracked with memo off.
+===============
+*/
+static void SV_TouchAreaNode(areanode_t *anode)
+{
+    if (!sv_tracememo->integer)
+        return;
+
+    anode->generation++;
+    for (; anode; anode = anode->parent)
+        anode->subtree_generation++;
+}
+
+/*
+===============
+SV_FindAreaNode
+
+Returns the deepest node that fully contains the box. If pathgen is given,
+it receives the sum of generations of nodes above it.
+===============
+*/
+static areanode_t *SV_FindAreaNode(areatree_t *tree, const vec3_t mins, const vec3_t maxs,
+                                   unsigned *pathgen)
+{
+    areanode_t  *node = tree->nodes;
+    unsigned    gen = 0;
+
+    while (node->axis != -1) {
+        if (mins[node->axis] > node->dist)
+            node = node->children[0];
+        else if (maxs[node->axis] < node->dist)
+            node = node->children[1];
+        else
+            break;        // crosses the node
+        gen += node->parent->generation;
+    }
+
+    if (pathgen)
+        *pathgen = gen;
+
+    return node;
+}
 
 /*
 ===============
@@ -54,42 +201,164 @@ SV_CreateAreaNode
 Builds a uniformly subdivided tree for the given world size
 ===============
 */
-static areanode_t *SV_CreateAreaNode(int depth, const vec3_t mins, const vec3_t maxs)
+static void SV_CreateAreaNode(areatree_t *tree, areanode_t *anode)
 {
-    areanode_t  *anode;
     vec3_t      size;
-    vec3_t      mins1, maxs1, mins2, maxs2;
 
-    anode = &sv_areanodes[sv_numareanodes];
-    sv_numareanodes++;
+    if (anode->depth == AREA_DEPTH)
+        return;
+
+    VectorSubtract(anode->maxs, anode->mins, size);
+    SV_DivideAreaNode(tree, anode, size[0] > size[1] ? 0 : 1);
 
-    List_Init(&anode->trigger_edicts);
-    List_Init(&anode->solid_edicts);
+    SV_CreateAreaNode(tree, anode->children[0]);
+    SV_CreateAreaNode(tree, anode->children[1]);
+}
 
-    if (depth == AREA_DEPTH) {
-        anode->axis = -1;
-        anode->children[0] = anode->children[1] = NULL;
-        return anode;
+/*
+===============
+SV_InitAreaTree
+===============
+*/
+static void SV_InitAreaTree(areatree_t *tree, bool adaptive, const vec3_t mins, const vec3_t maxs,
+                            void *edicts, int edict_size)
+{
+    areanode_t  *root;
+
+    memset(tree, 0, sizeof(*tree));
+    tree->adaptive = adaptive;
+    tree->edicts = edicts;
+    tree->edict_size = edict_size;
+
+    root = SV_AllocAreaNode(tree, 0, mins, maxs);
+    if (!adaptive)
+        SV_CreateAreaNode(tree, root);
+}
+
+/*
+===============
+SV_SplitAreaNode
+
+Splits an overpopulated leaf of the adaptive tree and moves down every
+entity that fits entirely into one of the halves.
+===============
+*/
+static void SV_SplitAreaNode(areatree_t *tree, areanode_t *anode)
+{
+    static const int    lists[2] = {
+        q_offsetof(areanode_t, solid_edicts),
+        q_offsetof(areanode_t, trigger_edicts)
+    };
+    areanode_t  *child;
+    edict_t     *check, *next;
+    list_t      *list;
+    vec3_t      size;
+    int         i, axis;
+
+    if (anode->depth >= AREA_MAX_DEPTH)
+        return;
+    if (tree->numnodes > AREA_NODES - 2)
+        return;
+
+    VectorSubtract(anode->maxs, anode->mins, size);
+    axis = 0;
+    if (size[1] > size[axis])
+        axis = 1;
+    if (size[2] > size[axis])
+        axis = 2;
+    if (size[axis] < AREA_MIN_SIZE * 2)
+        return;
+
+    SV_DivideAreaNode(tree, anode, axis);
+
+    // entities move down, which changes the order queries return them in
+    SV_TouchAreaNode(anode);
+
+    for (i = 0; i < 2; i++) {
+        list = (list_t *)((byte *)anode + lists[i]);
+        LIST_FOR_EACH_SAFE(edict_t, check, next, list, area) {
+            if (check->absmin[axis] > anode->dist)
+                child = anode->children[0];
+            else if (check->absmax[axis] < anode->dist)
+                child = anode->children[1];
+            else
+                continue;   // crosses the node
+
+            List_Remove(&check->area);
+            List_Append((list_t *)((byte *)child + lists[i]), &check->area);
+            tree->links[AREA_NUM(tree, check)].node = child;
+            anode->numedicts--;
+            child->numedicts++;
+        }
     }
 
-    VectorSubtract(maxs, mins, size);
-    if (size[0] > size[1])
-        anode->axis = 0;
-    else
-        anode->axis = 1;
+    for (i = 0; i < 2; i++) {
+        child = anode->children[i];
+        if (child->numedicts > AREA_SPLIT_COUNT)
+            SV_SplitAreaNode(tree, child);
+    }
+}
 
-    anode->dist = 0.5f * (maxs[anode->axis] + mins[anode->axis]);
-    VectorCopy(mins, mins1);
-    VectorCopy(mins, mins2);
-    VectorCopy(maxs, maxs1);
-    VectorCopy(maxs, maxs2);
+/*
+===============
+SV_AreaUnlink
+===============
+*/
+static void SV_AreaUnlink(areatree_t *tree, edict_t *ent)
+{
+    arealink_t  *link = &tree->links[AREA_NUM(tree, ent)];
 
-    maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+    if (link->node) {
+        SV_TouchAreaNode(link->node);
+        link->node->numedicts--;
+        link->node = NULL;
+    }
 
-    anode->children[0] = SV_CreateAreaNode(depth + 1, mins2, maxs2);
-    anode->children[1] = SV_CreateAreaNode(depth + 1, mins1, maxs1);
+    if (!ent->area.prev)
+        return;        // not linked in anywhere
 
-    return anode;
+    List_Remove(&ent->area);
+    ent->area.prev = ent->area.next = NULL;
+}
+
+/*
+===============
+SV_AreaLink
+
+Links entity into the node its absolute bounding box belongs to. Entities
+that didn't leave their node are not relinked at all.
+===============
+*/
+static void SV_AreaLink(areatree_t *tree, edict_t *ent)
+{
+    arealink_t  *link = &tree->links[AREA_NUM(tree, ent)];
+    areanode_t  *node;
+    bool        trigger;
+
+// find the first node that the ent's box crosses
+    node = SV_FindAreaNode(tree, ent->absmin, ent->absmax, NULL);
+
+    // bounds may have changed even if the node didn't
+    SV_TouchAreaNode(node);
+
+    trigger = ent->solid == SOLID_TRIGGER;
+    if (ent->area.prev && link->node == node && link->trigger == trigger)
+        return;        // still in place
+
+    SV_AreaUnlink(tree, ent);
+
+    // link it in
+    if (trigger)
+        List_Append(&node->trigger_edicts, &ent->area);
+    else
+        List_Append(&node->solid_edicts, &ent->area);
+
+    link->node = node;
+    link->trigger = trigger;
+    node->numedicts++;
+
+    if (tree->adaptive && node->axis == -1 && node->numedicts > AREA_SPLIT_COUNT)
+        SV_SplitAreaNode(tree, node);
 }
 
 /*
@@ -104,12 +373,14 @@ void SV_ClearWorld(void)
     edict_t *ent;
     int i;
 
-    memset(sv_areanodes, 0, sizeof(sv_areanodes));
-    sv_numareanodes = 0;
+    SV_StopAreaRecord();
+    SV_ClearTraceMemo();
 
     if (sv.cm.cache) {
         cm = &sv.cm.cache->models[0];
-        SV_CreateAreaNode(0, cm->mins, cm->maxs);
+        SV_InitAreaTree(&sv_area, sv_area_adaptive->integer, cm->mins, cm->maxs, NULL, 0);
+    } else {
+        SV_InitAreaTree(&sv_area, false, vec3_origin, vec3_origin, NULL, 0);
     }
 
     // make sure all entities are unlinked
@@ -119,6 +390,152 @@ void SV_ClearWorld(void)
     }
 }
 
+/*
+===============================================================================
+
+AREA QUERY RECORDING
+
+Link, unlink and area queries can be recorded into a file and later replayed
+against both tree layouts with `areabench'.
+===============================================================================
+*/
+
+#define AREA_REC_IDENT      MakeLittleLong('A','R','E','C')
+#define AREA_REC_VERSION    1
+
+typedef enum {
+    AREA_REC_LINK,
+    AREA_REC_UNLINK,
+    AREA_REC_SOLID,
+    AREA_REC_TRIGGERS
+} arearectype_t;
+
+typedef struct {
+    uint32_t    ident;
+    uint32_t    version;
+    uint32_t    numedicts;
+    float       mins[3];
+    float       maxs[3];
+} arearecheader_t;
+
+typedef struct {
+    uint16_t    type;
+    uint16_t    entnum;
+    uint32_t    solid;
+    float       mins[3];
+    float       maxs[3];
+} arearec_t;
+
+static qhandle_t    area_rec_file;
+static unsigned     area_rec_count;
+
+static void SV_RecordArea(arearectype_t type, edict_t *ent, const vec3_t mins, const vec3_t maxs)
+{
+    arearec_t   rec;
+    int         i;
+
+    if (!area_rec_file)
+        return;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = LittleShort(type);
+    if (ent) {
+        rec.entnum = LittleShort(NUM_FOR_EDICT(ent));
+        rec.solid = LittleLong(ent->solid);
+    }
+    if (mins && maxs) {
+        for (i = 0; i < 3; i++) {
+            rec.mins[i] = LittleFloat(mins[i]);
+            rec.maxs[i] = LittleFloat(maxs[i]);
+        }
+    }
+
+    if (FS_Write(&rec, sizeof(rec), area_rec_file) != sizeof(rec)) {
+        Com_EPrintf("Couldn't write area record, recording stopped.\n");
+        SV_StopAreaRecord();
+        return;
+    }
+
+    area_rec_count++;
+}
+
+void SV_StopAreaRecord(void)
+{
+    if (!area_rec_file)
+        return;
+
+    FS_CloseFile(area_rec_file);
+    area_rec_file = 0;
+
+    Com_Printf("Stopped area recording (%u records).\n", area_rec_count);
+}
+
+/*
+===============
+SV_AreaRecord_f
+
+Records area operations of the current level until stopped or the level
+changes. Entities already linked are recorded first, so the file can be
+replayed from an empty tree.
+===============
+*/
+static void SV_AreaRecord_f(void)
+{
+    char            buffer[MAX_OSPATH];
+    arearecheader_t header;
+    mmodel_t        *cm;
+    edict_t         *ent;
+    int             i;
+
+    if (Cmd_Argc() < 2) {
+        if (area_rec_file) {
+            SV_StopAreaRecord();
+            return;
+        }
+        Com_Printf("Usage: %s <filename>\n", Cmd_Argv(0));
+        Com_Printf("Run without arguments to stop recording.\n");
+        return;
+    }
+
+    if (!sv.cm.cache || !ge) {
+        Com_Printf("No map loaded.\n");
+        return;
+    }
+
+    SV_StopAreaRecord();
+
+    area_rec_file = FS_EasyOpenFile(buffer, sizeof(buffer), FS_MODE_WRITE,
+                                    "areas/", Cmd_Argv(1), ".arec");
+    if (!area_rec_file)
+        return;
+
+    cm = &sv.cm.cache->models[0];
+    header.ident = AREA_REC_IDENT;
+    header.version = LittleLong(AREA_REC_VERSION);
+    header.numedicts = LittleLong(ge->max_edicts);
+    for (i = 0; i < 3; i++) {
+        header.mins[i] = LittleFloat(cm->mins[i]);
+        header.maxs[i] = LittleFloat(cm->maxs[i]);
+    }
+
+    if (FS_Write(&header, sizeof(header), area_rec_file) != sizeof(header)) {
+        Com_EPrintf("Couldn't write %s\n", buffer);
+        FS_CloseFile(area_rec_file);
+        area_rec_file = 0;
+        return;
+    }
+
+    area_rec_count = 0;
+
+    for (i = 1; i < ge->num_edicts; i++) {
+        ent = EDICT_NUM(i);
+        if (ent->area.prev)
+            SV_RecordArea(AREA_REC_LINK, ent, ent->absmin, ent->absmax);
+    }
+
+    Com_Printf("Recording area operations to %s\n", buffer);
+}
+
 /*
 ===============
 SV_LinkEdict
@@ -230,8 +647,8 @@ void PF_UnlinkEdict(edict_t *ent)
         Com_Error(ERR_DROP, "%s: NULL", __func__);
     if (!ent->area.prev)
         return;        // not linked in anywhere
-    List_Remove(&ent->area);
-    ent->area.prev = ent->area.next = NULL;
+    SV_RecordArea(AREA_REC_UNLINK, ent, NULL, NULL);
+    SV_AreaUnlink(&sv_area, ent);
 }
 
 static uint32_t SV_PackSolid32(edict_t *ent)
@@ -266,7 +683,6 @@ static uint32_t SV_PackSolid32(edict_t *ent)
 
 void PF_LinkEdict(edict_t *ent)
 {
-    areanode_t *node;
     server_entity_t *sent;
     int entnum;
 #if USE_FPS
@@ -276,21 +692,24 @@ void PF_LinkEdict(edict_t *ent)
     if (!ent)
         Com_Error(ERR_DROP, "%s: NULL", __func__);
 
-    if (ent->area.prev)
-        PF_UnlinkEdict(ent);     // unlink from old position
-
-    if (ent == ge->edicts)
+    if (ent == ge->edicts) {
+        PF_UnlinkEdict(ent);
         return;        // don't add the world
+    }
 
     if (!ent->inuse) {
         Com_DPrintf("%s: entity %d is not in use\n", __func__, NUM_FOR_EDICT(ent));
+        PF_UnlinkEdict(ent);
         return;
     }
 
     if (!sv.cm.cache) {
+        PF_UnlinkEdict(ent);
         return;
     }
 
+    // entity is relinked at the end, once the new bounds are known
+
     entnum = NUM_FOR_EDICT(ent);
     sent = &sv.entities[entnum];
 
@@ -335,27 +754,13 @@ void PF_LinkEdict(edict_t *ent)
     sent->history[i].framenum = sv.framenum;
 #endif
 
-    if (ent->solid == SOLID_NOT)
+    if (ent->solid == SOLID_NOT) {
+        PF_UnlinkEdict(ent);
         return;
-
-// find the first node that the ent's box crosses
-    node = sv_areanodes;
-    while (1) {
-        if (node->axis == -1)
-            break;
-        if (ent->absmin[node->axis] > node->dist)
-            node = node->children[0];
-        else if (ent->absmax[node->axis] < node->dist)
-            node = node->children[1];
-        else
-            break;        // crosses the node
     }
 
-    // link it in
-    if (ent->solid == SOLID_TRIGGER)
-        List_Append(&node->trigger_edicts, &ent->area);
-    else
-        List_Append(&node->solid_edicts, &ent->area);
+    SV_RecordArea(AREA_REC_LINK, ent, ent->absmin, ent->absmax);
+    SV_AreaLink(&sv_area, ent);
 }
 
 
@@ -377,6 +782,7 @@ static void SV_AreaEdicts_r(areanode_t *node)
         start = &node->trigger_edicts;
 
     LIST_FOR_EACH(edict_t, check, start, area) {
+        area_scanned++;
         if (check->solid == SOLID_NOT)
             continue;        // deactivated
         if (check->absmin[0] > area_maxs[0]
@@ -411,8 +817,8 @@ static void SV_AreaEdicts_r(areanode_t *node)
 SV_AreaEdicts
 ================
 */
-int SV_AreaEdicts(const vec3_t mins, const vec3_t maxs,
-                  edict_t **list, int maxcount, int areatype)
+static int SV_AreaEdictsTree(areatree_t *tree, const vec3_t mins, const vec3_t maxs,
+                             edict_t **list, int maxcount, int areatype)
 {
     area_mins = mins;
     area_maxs = maxs;
@@ -421,11 +827,52 @@ int SV_AreaEdicts(const vec3_t mins, const vec3_t maxs,
     area_maxcount = maxcount;
     area_type = areatype;
 
-    SV_AreaEdicts_r(sv_areanodes);
+    SV_AreaEdicts_r(tree->nodes);
 
     return area_count;
 }
 
+int SV_AreaEdicts(const vec3_t mins, const vec3_t maxs,
+                  edict_t **list, int maxcount, int areatype)
+{
+    SV_RecordArea(areatype == AREA_SOLID ? AREA_REC_SOLID : AREA_REC_TRIGGERS, NULL, mins, maxs);
+    return SV_AreaEdictsTree(&sv_area, mins, maxs, list, maxcount, areatype);
+}
+
+static int edictcmp(const void *p1, const void *p2)
+{
+    const edict_t *e1 = *(const edict_t **)p1;
+    const edict_t *e2 = *(const edict_t **)p2;
+
+    return (e1 > e2) - (e1 < e2);
+}
+
+/*
+================
+SV_RadiusEdicts
+
+Returns both solid and trigger edicts whose bounds touch the box enclosing
+the sphere, sorted by edict number. Caller is expected to do the exact
+distance check, this only gets rid of entities that are too far away.
+================
+*/
+int SV_RadiusEdicts(const vec3_t origin, float radius, edict_t **list, int maxcount)
+{
+    vec3_t  mins, maxs;
+    int     i, count;
+
+    for (i = 0; i < 3; i++) {
+        mins[i] = origin[i] - radius;
+        maxs[i] = origin[i] + radius;
+    }
+
+    count = SV_AreaEdicts(mins, maxs, list, maxcount, AREA_SOLID);
+    count += SV_AreaEdicts(mins, maxs, list + count, maxcount - count, AREA_TRIGGERS);
+
+    qsort(list, count, sizeof(list[0]), edictcmp);
+    return count;
+}
+
 
 //===========================================================================
 
@@ -485,22 +932,26 @@ int SV_PointContents(const vec3_t p)
     return contents;
 }
 
+static struct {
+    unsigned    traces;
+    unsigned    batched;
+    unsigned    clips;
+    unsigned    memo_hits;
+    unsigned    memo_misses;
+} sv_trace_stats;
+
 /*
 ====================
-SV_ClipMoveToEntities
+SV_MoveBounds
 
+Creates the bounding box of the entire move
 ====================
 */
-static void SV_ClipMoveToEntities(const vec3_t start, const vec3_t mins,
-                                  const vec3_t maxs, const vec3_t end,
-                                  edict_t *passedict, int contentmask, trace_t *tr)
+static void SV_MoveBounds(const vec3_t start, const vec3_t mins, const vec3_t maxs,
+                          const vec3_t end, vec3_t boxmins, vec3_t boxmaxs)
 {
-    vec3_t      boxmins, boxmaxs;
-    int         i, num;
-    edict_t     *touchlist[MAX_EDICTS], *touch;
-    trace_t     trace;
+    int         i;
 
-    // create the bounding box of the entire move
     for (i = 0; i < 3; i++) {
         if (end[i] > start[i]) {
             boxmins[i] = start[i] + mins[i] - 1;
@@ -510,8 +961,29 @@ static void SV_ClipMoveToEntities(const vec3_t start, const vec3_t mins,
             boxmaxs[i] = start[i] + maxs[i] + 1;
         }
     }
+}
+
+/*
+====================
+SV_ClipMoveToEntities
+
+Clips the move against gathered entities. When the list was gathered for a
+larger area, entities outside of the move bounds are skipped, which yields
+the same set (in the same order) SV_AreaEdicts would have returned.
+====================
+*/
+static void SV_ClipMoveToEntities(const vec3_t start, const vec3_t mins,
+                                  const vec3_t maxs, const vec3_t end,
+                                  edict_t *passedict, int contentmask, trace_t *tr,
+                                  edict_t **touchlist, int num, bool cull)
+{
+    vec3_t      boxmins, boxmaxs;
+    int         i;
+    edict_t     *touch;
+    trace_t     trace;
 
-    num = SV_AreaEdicts(boxmins, boxmaxs, touchlist, MAX_EDICTS, AREA_SOLID);
+    if (cull)
+        SV_MoveBounds(start, mins, maxs, end, boxmins, boxmaxs);
 
     // be careful, it is possible to have an entity in this
     // list removed before we get to it (killtriggered)
@@ -534,15 +1006,79 @@ static void SV_ClipMoveToEntities(const vec3_t start, const vec3_t mins,
             && (touch->svflags & SVF_DEADMONSTER))
             continue;
 
+        if (cull && (touch->absmin[0] > boxmaxs[0]
+                     || touch->absmin[1] > boxmaxs[1]
+                     || touch->absmin[2] > boxmaxs[2]
+                     || touch->absmax[0] < boxmins[0]
+                     || touch->absmax[1] < boxmins[1]
+                     || touch->absmax[2] < boxmins[2]))
+            continue;        // not touching this move
+
         // might intersect, so do an exact clip
         CM_TransformedBoxTrace(&trace, start, end, mins, maxs,
                                SV_HullForEntity(touch), contentmask,
                                touch->s.origin, touch->s.angles);
 
         CM_ClipEntity(tr, &trace, touch);
+        sv_trace_stats.clips++;
     }
 }
 
+/*
+===============================================================================
+
+TRACE MEMO
+
+Optional per-frame cache of SV_Trace results. An entry is only reused within
+the same server frame and as long as no entity was linked or unlinked in
+area nodes the trace gathers entities from since it was stored. Game code
+changing solidity or ownership of an entity without relinking it is not
+detected, hence this is disabled by default.
+===============================================================================
+*/
+
+#define TRACE_MEMO_SIZE     512     // must be power of two
+
+typedef struct {
+    vec3_t      start, mins, maxs, end;
+    edict_t     *passedict;
+    int         contentmask;
+} tracekey_t;
+
+typedef struct {
+    tracekey_t  key;
+    trace_t     trace;
+    int         framenum;
+    areanode_t  *node;
+    unsigned    pathgen;
+    unsigned    generation;
+} tracememo_t;
+
+static tracememo_t  sv_trace_memo[TRACE_MEMO_SIZE];
+
+static void SV_ClearTraceMemo(void)
+{
+    memset(sv_trace_memo, 0, sizeof(sv_trace_memo));
+}
+
+// generations aren't tracked while memo is off
+static void sv_tracememo_changed(cvar_t *self)
+{
+    SV_ClearTraceMemo();
+}
+
+static unsigned SV_HashTraceKey(const tracekey_t *key)
+{
+    const uint32_t  *p = (const uint32_t *)key;
+    uint32_t        hash = 2166136261U;
+    int             i;
+
+    for (i = 0; i < sizeof(*key) / sizeof(*p); i++)
+        hash = (hash ^ p[i]) * 16777619U;
+
+    return (hash ^ (hash >> 16)) & (TRACE_MEMO_SIZE - 1);
+}
+
 /*
 ==================
 SV_Trace
@@ -555,7 +1091,13 @@ trace_t q_gameabi SV_Trace(const vec3_t start, const vec3_t mins,
                            const vec3_t maxs, const vec3_t end,
                            edict_t *passedict, int contentmask)
 {
+    edict_t     *touchlist[MAX_EDICTS];
+    vec3_t      boxmins, boxmaxs;
+    tracememo_t *memo = NULL;
+    areanode_t  *node = NULL;
+    unsigned    pathgen = 0;
     trace_t     trace;
+    int         num;
 
     if (!sv.cm.cache) {
         Com_Error(ERR_DROP, "%s: no map loaded", __func__);
@@ -566,15 +1108,316 @@ trace_t q_gameabi SV_Trace(const vec3_t start, const vec3_t mins,
     if (!maxs)
         maxs = vec3_origin;
 
+    sv_trace_stats.traces++;
+
+    SV_MoveBounds(start, mins, maxs, end, boxmins, boxmaxs);
+
+    if (sv_tracememo->integer) {
+        tracekey_t  key;
+
+        memset(&key, 0, sizeof(key));
+        VectorCopy(start, key.start);
+        VectorCopy(mins, key.mins);
+        VectorCopy(maxs, key.maxs);
+        VectorCopy(end, key.end);
+        key.passedict = passedict;
+        key.contentmask = contentmask;
+
+        node = SV_FindAreaNode(&sv_area, boxmins, boxmaxs, &pathgen);
+        memo = &sv_trace_memo[SV_HashTraceKey(&key)];
+        if (memo->framenum == sv.framenum && memo->node == node &&
+            memo->pathgen == pathgen && memo->generation == node->subtree_generation &&
+            !memcmp(&memo->key, &key, sizeof(key))) {
+            sv_trace_stats.memo_hits++;
+            return memo->trace;
+        }
+
+        sv_trace_stats.memo_misses++;
+        memo->key = key;
+    }
+
     // clip to world
     CM_BoxTrace(&trace, start, end, mins, maxs, sv.cm.cache->nodes, contentmask);
     trace.ent = ge->edicts;
-    if (trace.fraction == 0) {
-        return trace;   // blocked by the world
+    if (trace.fraction > 0) {
+        // clip to other solid entities
+        num = SV_AreaEdicts(boxmins, boxmaxs, touchlist, MAX_EDICTS, AREA_SOLID);
+        SV_ClipMoveToEntities(start, mins, maxs, end, passedict, contentmask,
+                              &trace, touchlist, num, false);
+    }
+
+    if (memo) {
+        memo->trace = trace;
+        memo->framenum = sv.framenum;
+        memo->node = node;
+        memo->pathgen = pathgen;
+        memo->generation = node->subtree_generation;
     }
 
-    // clip to other solid entities
-    SV_ClipMoveToEntities(start, mins, maxs, end, passedict, contentmask, &trace);
     return trace;
 }
 
+/*
+==================
+SV_TraceBatch
+
+Traces a number of moves sharing the same box size, passedict and
+contentmask. Entities are gathered once for the bounds of the whole batch.
+Results are identical to calling SV_Trace for each move.
+==================
+*/
+void SV_TraceBatch(trace_t *traces, const vec3_t *starts, const vec3_t *ends, int count,
+                   const vec3_t mins, const vec3_t maxs, edict_t *passedict, int contentmask)
+{
+    edict_t     *touchlist[MAX_EDICTS];
+    vec3_t      boxmins, boxmaxs, totalmins, totalmaxs;
+    int         i, num;
+    bool        clip = false;
+
+    if (!sv.cm.cache) {
+        Com_Error(ERR_DROP, "%s: no map loaded", __func__);
+    }
+
+    if (count <= 0)
+        return;
+
+    if (!mins)
+        mins = vec3_origin;
+    if (!maxs)
+        maxs = vec3_origin;
+
+    sv_trace_stats.traces += count;
+    sv_trace_stats.batched += count;
+
+    // clip to world
+    ClearBounds(totalmins, totalmaxs);
+    for (i = 0; i < count; i++) {
+        CM_BoxTrace(&traces[i], starts[i], ends[i], mins, maxs, sv.cm.cache->nodes, contentmask);
+        traces[i].ent = ge->edicts;
+        if (traces[i].fraction == 0)
+            continue;   // blocked by the world
+
+        SV_MoveBounds(starts[i], mins, maxs, ends[i], boxmins, boxmaxs);
+        AddPointToBounds(boxmins, totalmins, totalmaxs);
+        AddPointToBounds(boxmaxs, totalmins, totalmaxs);
+        clip = true;
+    }
+
+    if (!clip)
+        return;
+
+    // clip to other solid entities
+    num = SV_AreaEdicts(totalmins, totalmaxs, touchlist, MAX_EDICTS, AREA_SOLID);
+
+    for (i = 0; i < count; i++) {
+        if (traces[i].fraction == 0)
+            continue;
+
+        SV_ClipMoveToEntities(starts[i], mins, maxs, ends[i], passedict, contentmask,
+                              &traces[i], touchlist, num, count > 1);
+    }
+}
+
+/*
+================
+SV_TraceStats_f
+================
+*/
+static void SV_TraceStats_f(void)
+{
+    unsigned    lookups = sv_trace_stats.memo_hits + sv_trace_stats.memo_misses;
+
+    Com_Printf("%u traces, %u batched, %u entity clips\n",
+               sv_trace_stats.traces, sv_trace_stats.batched, sv_trace_stats.clips);
+    Com_Printf("%u memo hits, %u misses (%.1f%% hit rate)\n",
+               sv_trace_stats.memo_hits, sv_trace_stats.memo_misses,
+               lookups ? sv_trace_stats.memo_hits * 100.0 / lookups : 0.0);
+
+    if (Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "reset"))
+        memset(&sv_trace_stats, 0, sizeof(sv_trace_stats));
+}
+
+/*
+===============================================================================
+
+AREA BENCHMARK
+
+===============================================================================
+*/
+
+typedef struct {
+    unsigned    queries;
+    unsigned    results;
+    unsigned    checksum;
+    unsigned    scanned;
+} areabench_t;
+
+static void SV_ReplayArea(areatree_t *tree, bool adaptive, const arearecheader_t *header,
+                          const arearec_t *recs, int numrecs,
+                          edict_t *edicts, areabench_t *bench)
+{
+    edict_t     *touch[MAX_EDICTS], *ent;
+    int         i, j, num;
+
+    for (i = 0; i < header->numedicts; i++)
+        edicts[i].area.prev = edicts[i].area.next = NULL;
+
+    SV_InitAreaTree(tree, adaptive, header->mins, header->maxs,
+                    edicts, sizeof(edict_t));
+
+    for (i = 0; i < numrecs; i++) {
+        const arearec_t *rec = &recs[i];
+
+        switch (rec->type) {
+        case AREA_REC_LINK:
+            ent = &edicts[rec->entnum];
+            ent->solid = rec->solid;
+            VectorCopy(rec->mins, ent->absmin);
+            VectorCopy(rec->maxs, ent->absmax);
+            if (ent->solid == SOLID_NOT)
+                SV_AreaUnlink(tree, ent);
+            else
+                SV_AreaLink(tree, ent);
+            break;
+        case AREA_REC_UNLINK:
+            SV_AreaUnlink(tree, &edicts[rec->entnum]);
+            break;
+        default:
+            area_scanned = 0;
+            num = SV_AreaEdictsTree(tree, rec->mins, rec->maxs, touch, MAX_EDICTS,
+                                    rec->type == AREA_REC_SOLID ? AREA_SOLID : AREA_TRIGGERS);
+            bench->queries++;
+            bench->scanned += area_scanned;
+            bench->results += num;
+            for (j = 0; j < num; j++)
+                bench->checksum += (touch[j] - edicts) * 2654435761U;
+            break;
+        }
+    }
+}
+
+/*
+===============
+SV_AreaBench_f
+
+Replays a recorded area file against the classic and the adaptive tree
+layouts and compares query cost and results.
+===============
+*/
+static void SV_AreaBench_f(void)
+{
+    static const char *const layouts[2] = { "classic", "adaptive" };
+    char            buffer[MAX_OSPATH];
+    arearecheader_t header;
+    arearec_t       *recs, *rec;
+    areabench_t     bench[2];
+    areatree_t      *tree;
+    edict_t         *edicts;
+    qhandle_t       f;
+    int64_t         len;
+    int             i, j, numrecs, passes;
+    unsigned        start, msec;
+
+    if (Cmd_Argc() < 2) {
+        Com_Printf("Usage: %s <filename> [passes]\n", Cmd_Argv(0));
+        return;
+    }
+
+    passes = 1;
+    if (Cmd_Argc() > 2)
+        passes = Q_clip(Q_atoi(Cmd_Argv(2)), 1, 1000);
+
+    f = FS_EasyOpenFile(buffer, sizeof(buffer), FS_MODE_READ,
+                        "areas/", Cmd_Argv(1), ".arec");
+    if (!f)
+        return;
+
+    len = FS_Length(f);
+    if (len < sizeof(header) || FS_Read(&header, sizeof(header), f) != sizeof(header)) {
+        Com_Printf("%s is too short\n", buffer);
+        FS_CloseFile(f);
+        return;
+    }
+
+    header.version = LittleLong(header.version);
+    header.numedicts = LittleLong(header.numedicts);
+    for (i = 0; i < 3; i++) {
+        header.mins[i] = LittleFloat(header.mins[i]);
+        header.maxs[i] = LittleFloat(header.maxs[i]);
+    }
+
+    if (header.ident != AREA_REC_IDENT || header.version != AREA_REC_VERSION ||
+        header.numedicts < 1 || header.numedicts > MAX_EDICTS) {
+        Com_Printf("%s is not a valid area recording\n", buffer);
+        FS_CloseFile(f);
+        return;
+    }
+
+    numrecs = min(len - sizeof(header), INT_MAX) / sizeof(*recs);
+    recs = Z_Malloc(numrecs * sizeof(*recs));
+    if (FS_Read(recs, numrecs * sizeof(*recs), f) != numrecs * sizeof(*recs)) {
+        Com_Printf("Couldn't read %s\n", buffer);
+        FS_CloseFile(f);
+        Z_Free(recs);
+        return;
+    }
+
+    FS_CloseFile(f);
+
+    for (i = 0, rec = recs; i < numrecs; i++, rec++) {
+        rec->type = LittleShort(rec->type);
+        rec->entnum = LittleShort(rec->entnum);
+        rec->solid = LittleLong(rec->solid);
+        for (j = 0; j < 3; j++) {
+            rec->mins[j] = LittleFloat(rec->mins[j]);
+            rec->maxs[j] = LittleFloat(rec->maxs[j]);
+        }
+        if (rec->type > AREA_REC_TRIGGERS || rec->entnum >= header.numedicts) {
+            Com_Printf("%s has bad record %d\n", buffer, i);
+            Z_Free(recs);
+            return;
+        }
+    }
+
+    edicts = Z_Mallocz(header.numedicts * sizeof(*edicts));
+    tree = Z_Malloc(sizeof(*tree));
+
+    Com_Printf("Replaying %d area records %d times\n", numrecs, passes);
+
+    for (i = 0; i < 2; i++) {
+        memset(&bench[i], 0, sizeof(bench[i]));
+
+        start = Sys_Milliseconds();
+        for (j = 0; j < passes; j++)
+            SV_ReplayArea(tree, i, &header, recs, numrecs, edicts, &bench[i]);
+        msec = Sys_Milliseconds() - start;
+
+        Com_Printf("%-8s: %u msec, %d nodes, %.1f edicts scanned and %.1f returned per query\n",
+                   layouts[i], msec, tree->numnodes,
+                   (double)bench[i].scanned / max(bench[i].queries, 1),
+                   (double)bench[i].results / max(bench[i].queries, 1));
+    }
+
+    if (bench[0].results != bench[1].results || bench[0].checksum != bench[1].checksum)
+        Com_WPrintf("Area query results differ between layouts!\n");
+
+    Z_Free(tree);
+    Z_Free(edicts);
+    Z_Free(recs);
+}
+
+static const cmdreg_t c_world[] = {
+    { "arearecord", SV_AreaRecord_f },
+    { "areabench", SV_AreaBench_f },
+    { "tracestats", SV_TraceStats_f },
+    { NULL }
+};
+
+void SV_RegisterWorld(void)
+{
+    sv_area_adaptive = Cvar_Get("sv_area_adaptive", "1", 0);
+    sv_tracememo = Cvar_Get("sv_tracememo", "0", 0);
+    sv_tracememo->changed = sv_tracememo_changed;
+
+    Cmd_Register(c_world);
+}
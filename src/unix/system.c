@@ -80,6 +80,13 @@ unsigned Sys_Milliseconds(void)
     return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL;
 }
 
+uint64_t Sys_Microseconds(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000ULL;
+}
+
 /*
 =================
 Sys_Quit
@@ -128,6 +135,12 @@ void Sys_Sleep(int msec)
     nanosleep(&req, NULL);
 }
 
+int Sys_GetNumCPUs(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
 const char *Sys_ErrorString(int err)
 {
     return strerror(err);
@@ -209,6 +222,35 @@ Sys_IsFile(const char *path)
 	return false;
 }
 
+void *Sys_MapFile(const char *path, size_t *size, bool writable)
+{
+    struct stat st;
+    void *data;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+
+    data = NULL;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && st.st_size <= SIZE_MAX) {
+        data = mmap(NULL, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+            data = NULL;
+        else
+            *size = st.st_size;
+    }
+
+    close(fd);
+    return data;
+}
+
+void Sys_UnmapFile(void *data, size_t size)
+{
+    if (data)
+        munmap(data, size);
+}
+
 /*
 =================
 Sys_Init
@@ -876,6 +876,14 @@ unsigned Sys_Milliseconds(void)
     return tm.QuadPart * 1000ULL / timer_freq.QuadPart;
 }
 
+uint64_t Sys_Microseconds(void)
+{
+    LARGE_INTEGER tm;
+    QueryPerformanceCounter(&tm);
+    return tm.QuadPart / timer_freq.QuadPart * 1000000ULL +
+           tm.QuadPart % timer_freq.QuadPart * 1000000ULL / timer_freq.QuadPart;
+}
+
 void Sys_AddDefaultConfig(void)
 {
 }
@@ -885,6 +893,13 @@ void Sys_Sleep(int msec)
     Sleep(msec);
 }
 
+int Sys_GetNumCPUs(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+}
+
 const char *Sys_ErrorString(int err)
 {
     static char buf[256];
@@ -1171,6 +1186,40 @@ bool Sys_IsFile(const char *path)
 	return (fileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE)) == 0;
 }
 
+void *Sys_MapFile(const char *path, size_t *size, bool writable)
+{
+	WCHAR wpath[MAX_OSPATH] = { 0 };
+	LARGE_INTEGER filesize;
+	HANDLE file, mapping;
+	void *data = NULL;
+
+	MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, MAX_OSPATH);
+
+	file = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	if (GetFileSizeEx(file, &filesize) && filesize.QuadPart > 0 && filesize.QuadPart <= SIZE_MAX) {
+		mapping = CreateFileMappingW(file, NULL, writable ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+		if (mapping) {
+			// the view keeps the mapping object alive
+			data = MapViewOfFile(mapping, writable ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+			if (data)
+				*size = filesize.QuadPart;
+			CloseHandle(mapping);
+		}
+	}
+
+	CloseHandle(file);
+	return data;
+}
+
+void Sys_UnmapFile(void *data, size_t size)
+{
+	if (data)
+		UnmapViewOfFile(data);
+}
+
 /*
 ========================================================================
 